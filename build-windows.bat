@@ -11,7 +11,7 @@ n
 nif not exist %BUILD_DIR% mkdir %BUILD_DIR%
 n
 nREM compile all .c sources explicitly so MSYS/MinGW can find headers relatively
-ngcc -std=c11 -DWIN32 -O2 %SRC_DIR%\config.c %SRC_DIR%\decrypt.c %SRC_DIR%\encrypt.c %SRC_DIR%\key-parser.c %SRC_DIR%\main.c -I enigma\include -o %OUT%
+ngcc -std=c11 -DWIN32 -O2 %SRC_DIR%\arena.c %SRC_DIR%\batch.c %SRC_DIR%\config.c %SRC_DIR%\container.c %SRC_DIR%\crack.c %SRC_DIR%\encrypt.c %SRC_DIR%\encrypt-simd.c %SRC_DIR%\engine.c %SRC_DIR%\enigma.c %SRC_DIR%\key-compiler.c %SRC_DIR%\key-image.c %SRC_DIR%\key-parser.c %SRC_DIR%\main.c %SRC_DIR%\mmap-io.c %SRC_DIR%\multi.c %SRC_DIR%\parallel.c %SRC_DIR%\server.c %SRC_DIR%\spsc-queue.c %SRC_DIR%\stats.c %SRC_DIR%\stream.c %SRC_DIR%\thread-pool.c %SRC_DIR%\uring.c -I enigma\include -o %OUT% -pthread
 nif errorlevel 1 (
 n    echo Compilation failed with error %errorlevel%.
 n    exit /b %errorlevel%
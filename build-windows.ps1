@@ -9,7 +9,7 @@ $out = Join-Path $buildDir "enigma.exe"
 
 if (-not (Test-Path $buildDir)) { New-Item -ItemType Directory -Path $buildDir | Out-Null }
 
-$cmd = "gcc -std=c11 -DWIN32 -O2 $srcDir\config.c $srcDir\decrypt.c $srcDir\encrypt.c $srcDir\key-parser.c $srcDir\main.c -I enigma\include -o $out"
+$cmd = "gcc -std=c11 -DWIN32 -O2 $srcDir\arena.c $srcDir\batch.c $srcDir\config.c $srcDir\container.c $srcDir\crack.c $srcDir\encrypt.c $srcDir\encrypt-simd.c $srcDir\engine.c $srcDir\enigma.c $srcDir\key-compiler.c $srcDir\key-image.c $srcDir\key-parser.c $srcDir\main.c $srcDir\mmap-io.c $srcDir\multi.c $srcDir\parallel.c $srcDir\server.c $srcDir\spsc-queue.c $srcDir\stats.c $srcDir\stream.c $srcDir\thread-pool.c $srcDir\uring.c -I enigma\include -o $out -pthread"
 Write-Host "Running: $cmd"
 & cmd /c $cmd
 Write-Host "Built $out"
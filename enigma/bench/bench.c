@@ -0,0 +1,483 @@
+/*
+ * enigma-bench: throughput of key parsing, encrypt() and the I/O modes on synthetic
+ * corpora, across rotor counts and thread counts. Results are written as JSON with
+ * one result per line, and can be compared against a saved baseline run.
+ * Also: many short messages, each with its own key and rotor state, one at a time
+ * and through the multi-message lanes.
+ *
+ * Usage: enigma-bench [-o results.json] [--baseline baseline.json] [--threshold percent]
+ *                     [--time seconds] [--size bytes] [-j threads] [--dir scratch-dir]
+ */
+#include "../include/config.h"
+#include "../include/encrypt.h"
+#include "../include/key-image.h"
+#include "../include/key-parser.h"
+#include "../include/mmap-io.h"
+#include "../include/multi.h"
+#include "../include/stream.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SMALL_CORPUS (64 * 1024)
+#define DEFAULT_CORPUS (8 * 1024 * 1024)
+#define DEFAULT_MIN_TIME 0.2            // seconds spent on each case
+#define DEFAULT_THRESHOLD 10.0          // percent slower than the baseline that counts as a regression
+#define MIN_REPEATS 3
+#define MAX_RESULTS 512
+#define MAX_ID 96
+
+typedef struct BenchKey {
+    const char* name;
+    const char* reflector;
+    const char* rotors;
+    const char* rings;
+    const char* plugboard;
+} BenchKey;
+
+/* One key per kernel: a single rotor, M3, M4 and the generic stepping path */
+static const BenchKey KEYS[] = {
+    { "r1", "1", "1", "A", "AB" },
+    { "r3", "1", "1,2,3", "A,B,C", "AB,CD" },
+    { "r4", "2", "1,2,3,4", "A,B,C,D", "AB,CD" },
+    { "r8", "2", "1,2,3,4,5,6,7,8", "P,D,U,J,Z,A,B,C", "MN" },
+};
+#define KEY_COUNT (sizeof(KEYS) / sizeof(KEYS[0]))
+
+typedef enum { MIX_CAPS, MIX_MIXED, MIX_PUNCT, MIX_BINARY, MIX_COUNT } CorpusMix;
+
+static const char* MIX_NAMES[MIX_COUNT] = { "caps", "mixed", "punct", "binary" };
+
+typedef struct Corpus {
+    CorpusMix mix;
+    size_t size;
+    char* data;
+} Corpus;
+
+typedef struct Result {
+    char id[MAX_ID];
+    size_t bytes;                       // bytes per operation, 0 for key operations
+    double ns_per_op;
+} Result;
+
+typedef struct Bench {
+    double min_time;
+    size_t threads[2];                  // 1 and the -j count, if that is more
+    size_t thread_count;
+    const char* dir;
+    Result results[MAX_RESULTS];
+    size_t result_count;
+} Bench;
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* Best time of one call of fn(arg), over at least min_time seconds of calls */
+static double measure(const Bench* b, int (*fn)(void*), void* arg) {
+    double best = -1, total = 0;
+    for (size_t reps = 0; reps < MIN_REPEATS || total < b->min_time; ++reps) {
+        double t0 = now();
+        if (fn(arg) != 0) return -1;
+        double t = now() - t0;
+        total += t;
+        if (best < 0 || t < best) best = t;
+    }
+    return best;
+}
+
+static void record(Bench* b, const char* id, size_t bytes, double seconds) {
+    if (seconds < 0) { fprintf(stderr, "%-40s failed\n", id); return; }
+    if (b->result_count == MAX_RESULTS) return;
+    Result* r = &b->results[b->result_count++];
+    snprintf(r->id, sizeof(r->id), "%s", id);
+    r->bytes = bytes;
+    r->ns_per_op = seconds * 1e9;
+    if (bytes) printf("%-40s %10.1f MB/s %8.3f ns/char\n", id, bytes / seconds / 1e6, r->ns_per_op / bytes);
+    else printf("%-40s %10.1f us\n", id, r->ns_per_op / 1e3);
+    fflush(stdout);
+}
+
+/* ---- corpora ---- */
+
+static uint64_t next_random(uint64_t* s) {
+    *s ^= *s << 13;                     // xorshift64
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+static char corpus_char(CorpusMix mix, uint64_t r) {
+    static const char punct[] = ".,;:!?'\"-()0123456789\n";
+    switch (mix) {
+    case MIX_CAPS:   return r % 6 == 0 ? ' ' : (char)('A' + (r >> 8) % 26);
+    case MIX_MIXED:  return r % 6 == 0 ? ' ' : (char)((r & 0x100 ? 'a' : 'A') + (r >> 9) % 26);
+    case MIX_PUNCT:  return r % 2 == 0 ? punct[(r >> 8) % (sizeof(punct) - 1)] : (char)('a' + (r >> 8) % 26);
+    default:         return (char)(r >> 8);
+    }
+}
+
+static int make_corpus(Corpus* c, CorpusMix mix, size_t size) {
+    c->mix = mix;
+    c->size = size;
+    c->data = malloc(size);
+    if (!c->data) return 1;
+    uint64_t s = 0x9E3779B97F4A7C15ull ^ (uint64_t)mix;
+    for (size_t i = 0; i < size; ++i) c->data[i] = corpus_char(mix, next_random(&s));
+    return 0;
+}
+
+static int write_file(const char* path, const char* data, size_t len) {
+    FILE* f = fopen(path, "wb");
+    if (!f) { perror(path); return 1; }
+    int rc = fwrite(data, 1, len, f) != len;
+    if (fclose(f) != 0) rc = 1;
+    return rc;
+}
+
+/* ---- key parsing ---- */
+
+typedef struct KeyCase {
+    const BenchKey* key;
+    const char* path;
+} KeyCase;
+
+static int parse_components(void* arg) {
+    const BenchKey* k = ((KeyCase*)arg)->key;
+    Key* key = parse_key_components(k->reflector, k->rotors, k->rings, k->plugboard);
+    if (!key) return 1;
+    free_key(key);
+    return 0;
+}
+
+static int parse_quick(void* arg) {
+    const BenchKey* k = ((KeyCase*)arg)->key;
+    Key* key = parse_key_components_quick(k->reflector, k->rotors, k->rings, k->plugboard);
+    if (!key) return 1;
+    free_key(key);
+    return 0;
+}
+
+static int load_file(void* arg) {
+    Key* key = load_key_file(((KeyCase*)arg)->path);
+    if (!key) return 1;
+    free_key(key);
+    return 0;
+}
+
+static void bench_keys(Bench* b) {
+    char id[MAX_ID];
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        KeyCase kc = { &KEYS[i], NULL };
+        snprintf(id, sizeof(id), "parse/%s", KEYS[i].name);
+        record(b, id, 0, measure(b, parse_components, &kc));
+        snprintf(id, sizeof(id), "parse-quick/%s", KEYS[i].name);
+        record(b, id, 0, measure(b, parse_quick, &kc));
+    }
+
+    /* Key files of the M3 key: as text and as a compiled image */
+    const BenchKey* k = &KEYS[1];
+    char text[512], image[512], body[256];
+    snprintf(text, sizeof(text), "%s/bench.key", b->dir);
+    snprintf(image, sizeof(image), "%s/bench.keyc", b->dir);
+    snprintf(body, sizeof(body), "reflector=%s\nrotors=%s\nrings=%s\nplugboard=%s\n", k->reflector, k->rotors, k->rings, k->plugboard);
+    Key* key = parse_key_components(k->reflector, k->rotors, k->rings, k->plugboard);
+    if (key && write_file(text, body, strlen(body)) == 0 && write_key_image(key, image) == 0) {
+        KeyCase kc = { k, text };
+        snprintf(id, sizeof(id), "load-text/%s", k->name);
+        record(b, id, 0, measure(b, load_file, &kc));
+        kc.path = image;
+        snprintf(id, sizeof(id), "load-image/%s", k->name);
+        record(b, id, 0, measure(b, load_file, &kc));
+    }
+    free_key(key);
+    remove(text);
+    remove(image);
+}
+
+/* ---- encrypt() ---- */
+
+typedef struct CipherCase {
+    Config* config;
+    const Corpus* corpus;
+    char* out;
+} CipherCase;
+
+static int run_encrypt(void* arg) {
+    CipherCase* c = arg;
+    c->config->state = c->config->key->start;
+    c->config->input = c->corpus->data;
+    c->config->input_len = c->corpus->size;
+    c->config->out_buffer = c->out;
+    encrypt(c->config);
+    return c->config->out_len != c->corpus->size;
+}
+
+static void bench_encrypt(Bench* b, Corpus* corpora, size_t corpus_count, char* out) {
+    char id[MAX_ID];
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        const BenchKey* k = &KEYS[i];
+        Config cfg;
+        memset(&cfg, 0, sizeof(cfg));
+        cfg.key = parse_key_components(k->reflector, k->rotors, k->rings, k->plugboard);
+        if (!cfg.key) { fprintf(stderr, "Error: cannot parse key %s\n", k->name); continue; }
+
+        for (size_t c = 0; c < corpus_count; ++c) {
+            for (size_t t = 0; t < b->thread_count; ++t) {
+                cfg.threads = b->threads[t];
+                CipherCase cc = { &cfg, &corpora[c], out };
+                snprintf(id, sizeof(id), "encrypt/%s/%zu/%s/j%zu", MIX_NAMES[corpora[c].mix], corpora[c].size, k->name, cfg.threads);
+                record(b, id, corpora[c].size, measure(b, run_encrypt, &cc));
+            }
+        }
+        free_key(cfg.key);
+    }
+}
+
+/* ---- many short messages ---- */
+
+/* Messages of the short message cases, each with its own quickly compiled key */
+#define MESSAGE_KEYS 64
+static const size_t MESSAGE_LENGTHS[] = { 16, 128 };
+
+typedef struct MessageCase {
+    MultiJob* jobs;
+    size_t count;
+    RotorState* start;                  // per job, restored before every run
+} MessageCase;
+
+static int run_single(void* arg) {
+    MessageCase* c = arg;
+    for (size_t i = 0; i < c->count; ++i) {
+        MultiJob* job = &c->jobs[i];
+        *job->state = c->start[i];
+        encrypt_buffer(job->key, job->state, job->in, job->out, job->len);
+    }
+    return 0;
+}
+
+static int run_multi(void* arg) {
+    MessageCase* c = arg;
+    for (size_t i = 0; i < c->count; ++i) *c->jobs[i].state = c->start[i];
+    encrypt_multi(c->jobs, c->count);
+    return 0;
+}
+
+static void bench_messages(Bench* b, const Corpus* corpus, char* out) {
+    char id[MAX_ID];
+    for (size_t i = 0; i < KEY_COUNT; ++i) {
+        const BenchKey* k = &KEYS[i];
+        Key* keys[MESSAGE_KEYS];
+        size_t key_count = 0;
+        for (; key_count < MESSAGE_KEYS; ++key_count) {
+            keys[key_count] = parse_key_components_quick(k->reflector, k->rotors, k->rings, k->plugboard);
+            if (!keys[key_count]) break;
+        }
+
+        for (size_t m = 0; key_count == MESSAGE_KEYS && m < sizeof(MESSAGE_LENGTHS) / sizeof(MESSAGE_LENGTHS[0]); ++m) {
+            size_t len = MESSAGE_LENGTHS[m], count = corpus->size / len;
+            MessageCase mc = { malloc(count * sizeof(MultiJob)), count, malloc(2 * count * sizeof(RotorState)) };
+            if (!mc.jobs || !mc.start) { free(mc.jobs); free(mc.start); break; }
+            RotorState* states = mc.start + count;
+            uint64_t s = 0x2545F4914F6CDD1Dull;
+            for (size_t j = 0; j < count; ++j) {
+                for (size_t r = 0; r < MAX_ROTORS; ++r) mc.start[j].positions[r] = (unsigned char)(next_random(&s) % 26);
+                mc.jobs[j] = (MultiJob){ keys[j % MESSAGE_KEYS]->compiled, &states[j], corpus->data + j * len, out + j * len, len };
+            }
+            snprintf(id, sizeof(id), "messages/%zu/%s/single", len, k->name);
+            record(b, id, count * len, measure(b, run_single, &mc));
+            snprintf(id, sizeof(id), "messages/%zu/%s/multi", len, k->name);
+            record(b, id, count * len, measure(b, run_multi, &mc));
+            free(mc.jobs);
+            free(mc.start);
+        }
+        for (size_t j = 0; j < key_count; ++j) free_key(keys[j]);
+    }
+}
+
+/* ---- I/O modes ---- */
+
+typedef struct IoCase {
+    Config* config;
+    const char* input;
+    const char* output;
+} IoCase;
+
+static int run_buffered(void* arg) {
+    IoCase* c = arg;
+    FILE* in = fopen(c->input, "rb");
+    if (!in) return 1;
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+    char* buf = size > 0 ? malloc((size_t)size) : NULL;
+    int rc = !buf || fread(buf, 1, (size_t)size, in) != (size_t)size;
+    fclose(in);
+    if (rc == 0) {
+        c->config->state = c->config->key->start;
+        c->config->input = buf;
+        c->config->input_len = (size_t)size;
+        c->config->out_buffer = buf;
+        encrypt(c->config);
+        rc = write_file(c->output, buf, (size_t)size);
+    }
+    free(buf);
+    return rc;
+}
+
+static int run_stream(void* arg) {
+    IoCase* c = arg;
+    FILE* in = fopen(c->input, "rb");
+    FILE* out = fopen(c->output, "wb");
+    int rc = !in || !out;
+    if (rc == 0) {
+        c->config->state = c->config->key->start;
+        rc = encrypt_stream(c->config, in, out);
+    }
+    if (in) fclose(in);
+    if (out && fclose(out) != 0) rc = 1;
+    return rc;
+}
+
+static int run_mapped(void* arg) {
+    IoCase* c = arg;
+    c->config->state = c->config->key->start;
+    return encrypt_mapped(c->config, c->output);
+}
+
+static void bench_io(Bench* b, const Corpus* corpus) {
+    static const struct { const char* name; int (*run)(void*); } MODES[] = {
+        { "buffered", run_buffered }, { "stream", run_stream }, { "mmap", run_mapped },
+    };
+    char input[512], output[512], id[MAX_ID];
+    snprintf(input, sizeof(input), "%s/bench-input.txt", b->dir);
+    snprintf(output, sizeof(output), "%s/bench-output.txt", b->dir);
+    if (write_file(input, corpus->data, corpus->size) != 0) return;
+
+    const BenchKey* k = &KEYS[1];
+    Config cfg;
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.key = parse_key_components(k->reflector, k->rotors, k->rings, k->plugboard);
+    cfg.input_path = input;
+    for (size_t m = 0; cfg.key && m < sizeof(MODES) / sizeof(MODES[0]); ++m) {
+        for (size_t t = 0; t < b->thread_count; ++t) {
+            cfg.threads = b->threads[t];
+            IoCase ic = { &cfg, input, output };
+            snprintf(id, sizeof(id), "io/%s/%s/%zu/%s/j%zu", MODES[m].name, MIX_NAMES[corpus->mix], corpus->size, k->name, cfg.threads);
+            record(b, id, corpus->size, measure(b, MODES[m].run, &ic));
+        }
+    }
+    free_key(cfg.key);
+    remove(input);
+    remove(output);
+}
+
+/* ---- output and baseline ---- */
+
+static int write_results(const Bench* b, const char* path) {
+    FILE* f = fopen(path, "w");
+    if (!f) { perror(path); return 1; }
+    fprintf(f, "{\n  \"benchmark\": \"enigma\",\n  \"version\": 1,\n  \"results\": [\n");
+    for (size_t i = 0; i < b->result_count; ++i) {
+        const Result* r = &b->results[i];
+        fprintf(f, "    {\"id\": \"%s\", \"bytes\": %zu, \"ns_per_op\": %.1f", r->id, r->bytes, r->ns_per_op);
+        if (r->bytes) fprintf(f, ", \"mb_per_s\": %.2f, \"ns_per_char\": %.4f", r->bytes / r->ns_per_op * 1e3, r->ns_per_op / r->bytes);
+        fprintf(f, "}%s\n", i + 1 < b->result_count ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+    return fclose(f) != 0;
+}
+
+/* Compare with a file written by write_results(): results are matched by id and
+   compared on ns_per_op. Returns the number of regressions, or -1 on error. */
+static int compare_baseline(const Bench* b, const char* path, double threshold) {
+    FILE* f = fopen(path, "r");
+    if (!f) { perror(path); return -1; }
+    size_t compared = 0, faster = 0;
+    int slower = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        char id[MAX_ID];
+        const char* p = strstr(line, "\"id\": \"");
+        const char* t = strstr(line, "\"ns_per_op\": ");
+        if (!p || !t || sscanf(p + 7, "%95[^\"]", id) != 1) continue;
+        double base = atof(t + 13);
+        for (size_t i = 0; i < b->result_count; ++i) {
+            const Result* r = &b->results[i];
+            if (strcmp(r->id, id) != 0 || base <= 0) continue;
+            double change = (r->ns_per_op / base - 1) * 100;
+            ++compared;
+            if (change > threshold) {
+                printf("REGRESSION %-40s %+.1f%%\n", id, change);
+                ++slower;
+            } else if (change < -threshold) {
+                ++faster;
+            }
+        }
+    }
+    fclose(f);
+    printf("Compared %zu results with %s: %d slower, %zu faster by more than %.0f%%\n", compared, path, slower, faster, threshold);
+    return slower;
+}
+
+int main(int argc, char* argv[]) {
+    static Bench b;
+    b.min_time = DEFAULT_MIN_TIME;
+    b.dir = ".";
+    const char* output = NULL;
+    const char* baseline = NULL;
+    double threshold = DEFAULT_THRESHOLD;
+    size_t size = DEFAULT_CORPUS;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cpus > 0 ? (size_t)cpus : 1;
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) output = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc) baseline = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--time") == 0 && i + 1 < argc) b.min_time = atof(argv[++i]);
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc) size = (size_t)strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) threads = (size_t)strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) b.dir = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s [-o results.json] [--baseline baseline.json] [--threshold percent]\n"
+                            "       [--time seconds] [--size bytes] [-j threads] [--dir scratch-dir]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (size < SMALL_CORPUS) size = SMALL_CORPUS;
+    b.threads[b.thread_count++] = 1;
+    if (threads > 1) b.threads[b.thread_count++] = threads;
+
+    /* Every mix at a small (cache-resident) size and at the full size */
+    Corpus corpora[2 * MIX_COUNT];
+    size_t corpus_count = 0;
+    char* out = malloc(size + 1);
+    int rc = out ? 0 : 1;
+    for (int m = 0; rc == 0 && m < MIX_COUNT; ++m) {
+        rc |= make_corpus(&corpora[corpus_count++], (CorpusMix)m, SMALL_CORPUS);
+        if (size > SMALL_CORPUS) rc |= make_corpus(&corpora[corpus_count++], (CorpusMix)m, size);
+    }
+    if (rc != 0) { fprintf(stderr, "Error: out of memory\n"); return 1; }
+
+    bench_keys(&b);
+    bench_encrypt(&b, corpora, corpus_count, out);
+    bench_messages(&b, &corpora[size > SMALL_CORPUS ? 2 : 1], out);     // small mixed corpus
+    bench_io(&b, &corpora[size > SMALL_CORPUS ? 1 : 0]);
+
+    if (output && write_results(&b, output) == 0) printf("Wrote results to %s\n", output);
+    if (baseline) {
+        int slower = compare_baseline(&b, baseline, threshold);
+        if (slower != 0) rc = 1;
+    }
+
+    for (size_t i = 0; i < corpus_count; ++i) free(corpora[i].data);
+    free(out);
+    return rc;
+}
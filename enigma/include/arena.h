@@ -0,0 +1,55 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Default size of an arena block; larger requests get a block of their own */
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+/* Alignment of every arena allocation */
+#define ARENA_ALIGN 16
+
+
+
+typedef struct ArenaBlock ArenaBlock;
+
+/* Arena: bump allocator over a chain of blocks. Allocations are never freed one by
+   one; everything is released at once by arena_reset() (blocks kept for reuse) or
+   arena_free(). Consecutive allocations are adjacent in memory while they fit in a block.
+   Not thread-safe: use one arena per thread. */
+typedef struct Arena {
+    ArenaBlock* first;                  // blocks in allocation order
+    ArenaBlock* current;                // block allocations are taken from (later blocks are empty)
+    size_t block_size;                  // size of new blocks (created on first use)
+} Arena;
+
+/* Position in an arena to rewind to */
+typedef struct ArenaMark {
+    ArenaBlock* block;
+    size_t used;
+} ArenaMark;
+
+/* Set up an empty arena; no memory is allocated until the first request */
+void arena_init(Arena* arena, size_t block_size);
+
+/* size bytes aligned to ARENA_ALIGN, or NULL when out of memory */
+void* arena_alloc(Arena* arena, size_t size);
+
+/* Zero-filled array of count elements of size bytes */
+void* arena_calloc(Arena* arena, size_t count, size_t size);
+
+char* arena_strdup(Arena* arena, const char* s);
+
+/* Release everything allocated after mark was taken (e.g. parse scratch space) */
+ArenaMark arena_mark(const Arena* arena);
+void arena_rewind(Arena* arena, ArenaMark mark);
+
+/* Release all allocations in one step, keeping the blocks for the next job */
+void arena_reset(Arena* arena);
+
+/* Return all blocks to the system */
+void arena_free(Arena* arena);
+
+
+
+#endif /* ARENA_H */
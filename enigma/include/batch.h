@@ -0,0 +1,24 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stddef.h>
+
+
+
+/*
+ * Run every job of a manifest file in one process. Each non-empty line that does
+ * not start with '#' is one job of whitespace-separated fields:
+ *
+ *   input key output [encrypt|decrypt]
+ *
+ * The direction defaults to encrypt (both directions are the same operation; it is
+ * only checked). Every distinct key file is parsed and compiled once and shared by
+ * all of its jobs. Jobs run on `threads` threads, each reusing one I/O buffer.
+ * Returns 0 if every job succeeded, nonzero if the manifest could not be read or
+ * any job failed (failed jobs are reported on stderr with their manifest line).
+ */
+int run_batch(const char* manifest_path, size_t threads);
+
+
+
+#endif /* BATCH_H */
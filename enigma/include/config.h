@@ -1,11 +1,16 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 #include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "rotor-state.h"
 
 typedef struct Config Config;
 typedef struct Key Key;
 typedef struct Rotor Rotor;
 typedef struct Reflector Reflector;
+typedef struct CompiledKey CompiledKey;
 
 /* Enum for the 26 allowed letters A-Z */
 typedef enum {
@@ -23,11 +28,11 @@ typedef unsigned char RingSetting;
 /* Plugboard: maps each of 26 letters to another (0-25) */
 typedef unsigned char Plugboard[26];
 
-/* Rotor: has internal wiring, notch position, and current position (message key) */
+/* Rotor: has internal wiring and notch position. Its position lives in a RotorState;
+   rotor 0 is the fast rotor. */
 typedef struct Rotor {
     unsigned char wiring[26];           // internal wiring permutation
     unsigned char notch;                // position (0-25) where rotor steps
-    unsigned char position;             // current position (message key): 0-25
 } Rotor;
 
 /* Reflector: has internal wiring that swaps pairs */
@@ -35,21 +40,58 @@ typedef struct Reflector {
     unsigned char wiring[26];           // reflection wiring: must be symmetric (wiring[wiring[i]] == i)
 } Reflector;
 
-/* Key: enigma key configuration */
+/* Key: enigma key configuration. Read-only once parsed, so one key can be shared
+   by any number of messages and threads. */
 typedef struct Key {
     struct Reflector* reflector;        // Umkehrwalze (required)
     struct Rotor* rotors;               // rotors in order (e.g., left to right)
     RingSetting* ring_settings;         // ring settings for each rotor (0-25)
     size_t rotor_count;                 // number of rotors used
     Plugboard plugboard_settings;       // plugboard swaps (0-25 for each of 26 inputs)
+    RotorState start;                   // rotor positions at the start of a message (message key)
+    struct CompiledKey* compiled;       // derived lookup tables (built by the key parser; keys without them are refused)
+    Arena arena;                        // holds the key itself and all of the above when parsed
+    void* image;                        // compiled-key image the tables point into, if loaded from one
+    size_t image_size;
 } Key;
 
+/* How the input is read and the output written */
+typedef enum {
+    IO_BUFFERED = 0,                    // load the whole input, encrypt into a heap buffer, write it at once
+    IO_STREAM,                          // read, encrypt and write fixed-size chunks, overlapped (the default)
+    IO_MMAP                             // map input and output files and encrypt between the mappings
+} IoMode;
+
 /* Config: runtime configuration for encryption/decryption */
 typedef struct Config {
     char* input;
+    size_t input_len;                   // bytes in input (0: input is NUL-terminated)
     struct Key* key;
-    char* out_buffer;                   // output buffer (allocated by encrypt/decrypt if NULL)
+    RotorState state;                   // rotor state of the message (starts as key->start)
+    char* out_buffer;                   // output buffer (may be input; taken from the arena by encrypt if NULL)
+    size_t out_len;                     // bytes written to out_buffer by encrypt
     char* output_path;                  // optional output filename (allocated) 
+    size_t threads;                     // worker threads for encryption (1 = serial; 0 = one per processor, --crack only)
+    char* input_path;                   // input filename (allocated), "-" for stdin
+    IoMode io_mode;                     // input is only loaded for IO_BUFFERED
+    char* batch_path;                   // manifest for --batch (allocated); no input or key is loaded then
+    char* image_path;                   // --compile-key output (allocated); the key is written there instead
+    char* serve_path;                   // socket for --serve (allocated); no input or key is loaded then
+    int stats;                          // --stats report format (StatsFormat), STATS_OFF if not wanted
+    int indexed;                        // --indexed: write an indexed container (read one with -d)
+    size_t block_size;                  // --block-size of a written container (0: CONTAINER_BLOCK_SIZE)
+    uint64_t range_begin;               // --range of the plaintext read from a container,
+    uint64_t range_end;                 // [begin, end) with end UINT64_MAX for the whole message
+    int crack;                          // --crack: search for the key of input instead of loading one
+    size_t crack_rotors;                // rotor count searched by --crack
+    char* crib;                         // --crib: known plaintext to search stops for (allocated), or NULL
+    size_t crib_at;                     // --crib-at byte offset of the crib, SIZE_MAX for anywhere
+    char* work_dir;                     // --work-dir of sharded --crack searches (allocated)
+    size_t shard;                       // --shard I/N: run part `shard` of `shards` of the rotor search,
+    size_t shards;                      // 0 shards for an unsharded search
+    int merge;                          // --merge N: combine the `shards` finished parts instead
+    int tune;                           // --tune: measure the engine thresholds and write the profile to output_path
+    Arena arena;                        // backs input, out_buffer and the paths; freed by free_config
 } Config;
 
 /* Parse command line arguments into cfg. On success return 0 and set *do_encrypt:
@@ -60,6 +102,10 @@ int load_config_from_args(int argc, char* argv[], Config* cfg, int* do_encrypt);
 /* Free all resources allocated in cfg */
 void free_config(Config* cfg);
 
+/* Whether paths a and b name the same existing file ("-" names none), so that opening
+   one for writing would truncate the other */
+int same_file_path(const char* a, const char* b);
+
 
 
 #endif
\ No newline at end of file
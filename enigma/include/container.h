@@ -0,0 +1,73 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include "config.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Indexed ciphertext container: the ciphertext cut into fixed-size blocks, with an
+ * index giving the rotor state at the start of every block, so any slice can be
+ * deciphered without going through what comes before it, and all blocks can be
+ * deciphered in parallel. Layout:
+ *
+ *   ContainerHeader | block 0 | block 1 | ... | index | ContainerTrailer
+ *
+ * Every block but the last holds exactly block_size bytes. The index is written
+ * after the blocks (and found through the trailer), so a container can be written
+ * to a pipe. All fields are native-endian, as in compiled-key images.
+ */
+#define CONTAINER_MAGIC "ENIGIDXC"
+#define CONTAINER_VERSION 1
+#define CONTAINER_BYTE_ORDER 0x01020304u
+
+/* Block size used when none is given */
+#define CONTAINER_BLOCK_SIZE (64 * 1024)
+
+/* Blocks enciphered or deciphered per thread and pass */
+#define CONTAINER_BATCH_BLOCKS 16
+
+
+
+/* At offset 0 */
+typedef struct ContainerHeader {
+    char magic[8];                      // CONTAINER_MAGIC, not NUL-terminated
+    uint32_t version;                   // CONTAINER_VERSION
+    uint32_t byte_order;                // CONTAINER_BYTE_ORDER as written
+    uint64_t block_size;
+    uint32_t rotor_count;               // of the key the container was written with
+    uint32_t reserved;
+} ContainerHeader;
+
+/* One per block */
+typedef struct ContainerIndexEntry {
+    uint64_t offset;                    // file offset of the block
+    uint64_t letters;                   // characters of the block that step the rotors
+    RotorState state;                   // rotor positions before the block's first letter
+} ContainerIndexEntry;
+
+/* The last bytes of the file */
+typedef struct ContainerTrailer {
+    uint64_t index_offset;              // file offset of block_count ContainerIndexEntry
+    uint64_t block_count;
+    uint64_t data_size;                 // ciphertext bytes in all blocks (same as the plaintext)
+    uint64_t checksum;                  // of the index entries
+    char magic[8];                      // CONTAINER_MAGIC again
+} ContainerTrailer;
+
+/* Encipher everything read from in into a container written to out, in blocks of
+   block_size bytes (CONTAINER_BLOCK_SIZE if 0), with config->key from config->state.
+   Blocks are enciphered in parallel with config->threads > 1. Returns 0 on success. */
+int write_container(Config* config, FILE* in, FILE* out, size_t block_size);
+
+/* Decipher bytes [begin, end) of the message held in the container file at path
+   (end is clamped to its size) and write them to out. Only the blocks overlapping
+   the range are read, each from the rotor state in the index, in parallel with
+   config->threads > 1. The key must be the one the container was written with.
+   Returns 0 on success. */
+int read_container(Config* config, const char* path, uint64_t begin, uint64_t end, FILE* out);
+
+
+
+#endif /* CONTAINER_H */
@@ -0,0 +1,185 @@
+#ifndef CRACK_H
+#define CRACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Rotor counts the search covers: every extra rotor multiplies the rotor orders by
+   up to 8 and the ring settings by 26 */
+#define CRACK_MAX_ROTORS 4
+
+/* Letters of the ciphertext scored per trial (the rest is not read) */
+#define CRACK_MAX_LETTERS 2048
+
+/* Best rotor settings kept from each (reflector, rotor order) of the rotor search,
+   and in total for the plugboard search */
+#define CRACK_KEEP_PER_ORDER 4
+#define CRACK_CANDIDATES 64
+
+/* Plugboard pairs the hill climb may connect (10 was standard wartime practice) */
+#define CRACK_MAX_PLUGS 10
+
+/* A recovered key, in the terms of a key file */
+typedef struct CrackResult {
+    size_t rotor_count;
+    unsigned char reflector;            // 0 = B, 1 = C
+    unsigned char rotors[CRACK_MAX_ROTORS];     // rotor types 0-7 (I-VIII), rotors[0] is the fast rotor
+    unsigned char rings[CRACK_MAX_ROTORS];      // ring settings, which are also the start positions
+    unsigned char plugboard[26];
+    size_t letters;                     // letters scored
+    double ioc;                         // index of coincidence of the deciphered letters
+    double score;                       // mean English bigram log-probability per letter pair
+    uint64_t trials;                    // trial decryptions of the rotor search
+    uint64_t rotor_ns;                  // wall time of the rotor search
+    uint64_t plugboard_ns;              // wall time of the plugboard search
+} CrackResult;
+
+/*
+ * Checkpoint of one shard of a sharded rotor search (see crack_shard()), in a file
+ * crack-I-of-N.ckpt of the work directory:
+ *
+ *   CrackCheckpoint | kept * CrackCheckpointEntry
+ *
+ * A shard is a fixed range of the search's (reflector, rotor order) tasks, done when
+ * next_task reaches end_task. Native-endian, as in compiled-key images.
+ */
+#define CRACK_CHECKPOINT_MAGIC "ENIGCKPT"
+#define CRACK_CHECKPOINT_VERSION 1
+#define CRACK_CHECKPOINT_BYTE_ORDER 0x01020304u
+
+/* Most shards a search may be cut into */
+#define CRACK_MAX_SHARDS 65536
+
+/* A running shard saves its progress at most this often */
+#define CRACK_CHECKPOINT_SECONDS 10
+
+typedef struct CrackCheckpoint {
+    char magic[8];                      // CRACK_CHECKPOINT_MAGIC, not NUL-terminated
+    uint32_t version;                   // CRACK_CHECKPOINT_VERSION
+    uint32_t byte_order;                // CRACK_CHECKPOINT_BYTE_ORDER as written
+    uint64_t fingerprint;               // of the ciphertext letters searched
+    uint32_t rotor_count;
+    uint32_t shard;                     // this is shard `shard` of `shards`
+    uint32_t shards;
+    uint32_t kept;                      // entries that follow, best first (up to CRACK_CANDIDATES)
+    uint64_t next_task;                 // first task not searched yet
+    uint64_t end_task;                  // the shard's tasks end here
+    uint64_t trials;                    // trial decryptions done
+    uint64_t ns;                        // search time, over all runs of the shard
+} CrackCheckpoint;
+
+/* Rotor settings kept by the rotor search */
+typedef struct CrackCheckpointEntry {
+    int64_t coincidences;               // as the IoC times letters * (letters - 1)
+    unsigned char reflector;
+    unsigned char rotors[CRACK_MAX_ROTORS];
+    unsigned char rings[CRACK_MAX_ROTORS];
+    unsigned char reserved[7];
+} CrackCheckpointEntry;
+
+/* Longest crib the crib search takes, in letters */
+#define CRIB_MAX_LETTERS 64
+
+/* Surviving stops kept from each (reflector, rotor order), and in total */
+#define CRIB_STOPS_PER_ORDER 8
+#define CRIB_STOPS 32
+
+/* A rotor setting the crib search could not rule out, with the plug pairs the crib implies */
+typedef struct CribStop {
+    unsigned char reflector;            // 0 = B, 1 = C
+    unsigned char rotors[CRACK_MAX_ROTORS];
+    unsigned char rings[CRACK_MAX_ROTORS];
+    unsigned char plugboard[26];        // pairs implied by the crib, unplugged elsewhere
+    size_t offset;                      // byte offset of the crib's first letter in the ciphertext
+    double score;                       // mean bigram log-probability of the message with those pairs
+    uint64_t ns;                        // time taken to test this stop
+} CribStop;
+
+typedef struct CribResult {
+    size_t rotor_count;
+    CribStop* stops;                    // best score first (release with free_crib_result())
+    size_t stop_count;
+    uint64_t found;                     // surviving stops, kept or not
+    uint64_t offsets;                   // crib offsets tried
+    uint64_t tested;                    // stops tested: rotor settings times crib offsets
+    uint64_t ruled_out;                 // stops not tested because a crib letter faces itself in the
+                                        // ciphertext (only on machines where no letter enciphers to itself)
+    uint64_t ns;                        // wall time of the search
+} CribResult;
+
+
+
+/*
+ * Recover the key of a ciphertext alone, for a machine of rotor_count rotors chosen
+ * from the standard eight with reflector B or C. Deciphering is done as with -d:
+ * letters and spaces (as X) step the rotors, everything else is skipped.
+ *
+ * The rotor search tries every reflector, rotor order and ring setting without a
+ * plugboard and keeps the settings whose output has the highest index of coincidence;
+ * ring settings are also the start positions here, and the slowest rotor's ring
+ * changes nothing, so it is not searched. The plugboard is then hill-climbed for each
+ * of them, first on the index of coincidence and then on English bigram scores, and
+ * the rings are searched once more with the plugboard in place.
+ *
+ * Trials never build a Key: the rotors are read from the shared table of shifted
+ * rotors (shifted_rotors()), and a trial is two lookups per letter. Trials with the
+ * same fast ring go alike until a slow rotor steps differently, so they only decipher
+ * from there on. Rotor orders and candidates are split across `threads` threads
+ * (0: one per processor).
+ * Needs a few hundred letters to be reliable. Returns 0 on success.
+ */
+int crack_key(const char* text, size_t len, size_t rotor_count, size_t threads, CrackResult* result);
+
+/*
+ * Run shard `shard` of `shards` of crack_key()'s rotor search, for worker processes
+ * sharing the work directory `dir`: the (reflector, rotor order) tasks are cut into
+ * `shards` fixed ranges, so any process can take any shard. Progress and the best
+ * settings found are saved to the shard's checkpoint file every
+ * CRACK_CHECKPOINT_SECONDS and at the end, and a shard started again resumes from its
+ * checkpoint. *progress gets the final checkpoint. Returns 0 on success.
+ */
+int crack_shard(const char* text, size_t len, size_t rotor_count, size_t shard, size_t shards, const char* dir,
+                size_t threads, CrackCheckpoint* progress);
+
+/* Combine the checkpoints of all `shards` finished shards in dir and finish the search
+   as crack_key() does. result->rotor_ns is the search time of all shards together.
+   Returns 0 on success, 12 if a shard is missing or unfinished. */
+int crack_merge(const char* text, size_t len, size_t rotor_count, size_t shards, const char* dir, size_t threads,
+                CrackResult* result);
+
+/* Write a recovered key to f in key file format, with its scores as a comment.
+   Returns 0 on success. */
+int write_crack_key(FILE* f, const CrackResult* result);
+
+/*
+ * Find the rotor settings under which a known plaintext (the crib) can have been
+ * enciphered into the ciphertext, as the Bombe did. Letters of the crib are letters
+ * of the plaintext (spaces as X); it lies at byte offset crib_at of the ciphertext,
+ * or anywhere in its first CRACK_MAX_LETTERS letters with crib_at = SIZE_MAX.
+ *
+ * The crib's letter pairs make a menu. At each stop (reflector, rotor order, ring
+ * setting and crib offset) every plug partner of the menu's most connected letter is
+ * assumed in turn, and what it implies is followed through the rotors along the menu
+ * and back across the plugboard, with each letter's partners as a 26-bit set: the
+ * first letter with two partners rules the assumption out. No text is deciphered.
+ * A stop survives if an assumption does, with the plug pairs it implied; survivors
+ * are then ranked by the bigram score of the message deciphered with those pairs.
+ * With reflector B and rotors that are true permutations no letter enciphers to
+ * itself, so crib offsets where a crib letter meets itself are not tried.
+ *
+ * Rotor orders are split across `threads` threads (0: one per processor).
+ * Returns 0 on success; release the result with free_crib_result().
+ */
+int crack_crib(const char* text, size_t len, const char* crib, size_t crib_at, size_t rotor_count, size_t threads,
+               CribResult* result);
+
+/* Write the stops of a crib search to f, best first, each as a key file with its
+   offset, score and time as a comment. Returns 0 on success. */
+int write_crib_stops(FILE* f, const CribResult* result);
+
+void free_crib_result(CribResult* result);
+
+
+
+#endif /* CRACK_H */
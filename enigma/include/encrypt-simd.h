@@ -0,0 +1,40 @@
+#ifndef ENCRYPT_SIMD_H
+#define ENCRYPT_SIMD_H
+
+#include "key-compiler.h"
+
+
+
+/* Cipher class of a byte: its letter index 0-25 (spaces encipher as X), or -1 for
+   bytes that pass through unchanged. *upper is set for letters written in uppercase.
+   ASCII only, which is what isalpha()/isupper() give in the default "C" locale. */
+static inline int cipher_index(unsigned char c, int* upper) {
+    if ((unsigned char)(c - 'A') < 26) { *upper = 1; return c - 'A'; }
+    if ((unsigned char)(c - 'a') < 26) { *upper = 0; return c - 'a'; }
+    if (c == ' ') { *upper = 1; return 'X' - 'A'; }
+    return -1;
+}
+
+/* Period table kernel: encipher in[0, len) into out, where j is the state index
+   before the first letter. Returns the state index after the last letter. */
+typedef size_t (*PeriodKernel)(const struct CompiledKey* ck, size_t j, const char* in, char* out, size_t len);
+
+/* Fastest kernel this CPU supports: the one the engine profile measured fastest (see
+   engine.h), or the widest. The ENIGMA_KERNEL environment variable (scalar, sse4,
+   avx2, avx512) forces a specific one when it is available. Chosen on the first call
+   and kept for the life of the process. */
+PeriodKernel select_period_kernel(void);
+
+/* Length of the run of pass-through bytes (neither letters nor spaces) at the start
+   of in[0, len), so callers can copy or skip it at once */
+typedef size_t (*PassthroughScan)(const char* in, size_t len);
+
+/* Fastest scan this CPU supports, chosen on the first call */
+PassthroughScan select_passthrough_scan(void);
+
+/* Kernel by name, or NULL if the name is unknown or the CPU lacks the instructions */
+PeriodKernel find_period_kernel(const char* name);
+
+
+
+#endif /* ENCRYPT_SIMD_H */
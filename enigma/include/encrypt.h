@@ -3,13 +3,35 @@
 
 #include "config.h"
 
+#include <stdint.h>
+
 
 
 /* Encrypt the message in the provided Config. The function writes the result into
-   config->out_buffer. If out_buffer is NULL it will be allocated (caller must free).
+   config->out_buffer, which may be config->input itself. If out_buffer is NULL it is
+   allocated from config->arena (released by free_config).
+   config->input_len bytes are processed (up to the first NUL if it is 0); the
+   result is NUL-terminated and its length stored in config->out_len.
+   The rotors of config->state step with every enciphered letter and keep their final
+   positions, so a further call continues the same message. With config->threads > 1 large
+   inputs are split into chunks enciphered in parallel (same output).
 */
 void encrypt(Config* config);
 
+/* Move state to where the rotors of key are after `letters` more enciphered letters
+   (letters and spaces; other characters do not step the rotors). Runs in constant
+   time per rotor, so any offset of a long message can be reached directly.
+   Returns 0 on success, nonzero if the key has not been compiled. */
+int encrypt_seek(const Key* key, RotorState* state, uint64_t letters);
+
+/* Encipher len bytes from in into out (which may be in) with a compiled key. state
+   is the rotor state before the first letter and is advanced past every enciphered
+   letter; the key itself is only read. */
+void encrypt_buffer(const struct CompiledKey* ck, RotorState* state, const char* in, char* out, size_t len);
+
+/* Number of characters in in[0, len) that step the rotors (letters and spaces) */
+uint64_t count_letters(const char* in, size_t len);
+
 
 
 #endif /* ENCRYPT_H */
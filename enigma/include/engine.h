@@ -0,0 +1,87 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "key-compiler.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * Engine selection: which of the cipher paths a message takes. A period table makes
+ * every letter one lookup but costs milliseconds to build, so short messages are
+ * cheaper on the stepping path; which period kernel is fastest depends on the CPU;
+ * splitting a message across threads only pays once it outweighs starting them.
+ * The crossovers are measured on the host by engine_tune() (enigma --tune) and kept in
+ * a profile file that every later run loads; without one, defaults measured on a
+ * typical x86-64 machine apply.
+ */
+#define ENGINE_PROFILE_VERSION 1
+
+/* The profile is read from $ENIGMA_PROFILE (no profile if set but empty), otherwise
+   from this file in the home directory */
+#define ENGINE_PROFILE_NAME ".enigma-profile"
+
+/* Message length to pass when it is not known in advance (stdin): keys get every table */
+#define ENGINE_SIZE_UNKNOWN UINT64_MAX
+
+/* What the thresholds of a profile depend on. A profile tuned on another host is not used. */
+typedef struct EngineHost {
+    char features[32];                  // period kernels the CPU runs, fastest first ("avx512,avx2,sse4,scalar")
+    size_t cache_bytes;                 // L2 data cache, 0 if unknown
+    size_t cpus;                        // processors online
+} EngineHost;
+
+typedef struct EngineProfile {
+    EngineHost host;                    // machine the thresholds were measured on
+    uint64_t period_min_bytes[PERIOD_TABLE_MAX_ROTORS + 1];    // by rotor count: messages of at least this many
+                                                                // bytes get a period table (UINT64_MAX: never)
+    char kernel[16];                    // period kernel ("" for the fastest the CPU supports)
+    size_t parallel_min_bytes;          // with -j, messages of more than this many bytes are split across threads
+    int tuned;                          // 1 if read from a profile file
+} EngineProfile;
+
+
+
+/* The profile in effect, loaded on first use */
+const EngineProfile* engine_profile(void);
+
+/* Load the profile and choose the period kernel now if that has not happened yet.
+   Opening a key calls this, so enciphering never reads a file or prints a warning. */
+void engine_load(void);
+
+/* Describe this machine */
+void engine_host(EngineHost* host);
+
+/* Path of the profile file, or NULL if there is none (no home directory, or
+   ENIGMA_PROFILE set but empty) */
+const char* engine_profile_path(void);
+
+/* Compile flags (see compile_key_flags_in) for a key of rotor_count rotors that will
+   encipher about `bytes` bytes of messages (ENGINE_SIZE_UNKNOWN if not known): no
+   period table when it would cost more to build than it saves */
+unsigned engine_compile_flags(size_t rotor_count, uint64_t bytes);
+
+/* Whether a message of len bytes should be split across `threads` threads */
+int engine_parallel(size_t threads, size_t len);
+
+/* Period kernel of the profile, or NULL to pick the fastest the CPU supports */
+const char* engine_kernel(void);
+
+/* Read a profile file into *profile. Returns 0 on success, -1 if the file does not
+   exist, 11 if it is not a profile, 12 if it was tuned on another host. */
+int read_engine_profile(const char* path, EngineProfile* profile);
+
+/* Write a profile in its text format. Returns 0 on success. */
+int write_engine_profile(FILE* f, const EngineProfile* profile);
+
+/*
+ * Measure the crossovers on this machine: for each rotor count, the time to build a
+ * period table against the time it saves per letter, every period kernel on a message
+ * larger than the L2 cache, and the cost of starting a thread pool against the time
+ * per byte. Progress goes to report (if not NULL). Returns 0 on success.
+ */
+int engine_tune(EngineProfile* profile, FILE* report);
+
+
+
+#endif /* ENGINE_H */
@@ -0,0 +1,129 @@
+#ifndef ENIGMA_H
+#define ENIGMA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * libenigma: the cipher without the command line. This header is all a program
+ * linking against libenigma.a needs; keys are opaque.
+ *
+ * A context holds a parsed and compiled key plus the rotor state of one message.
+ * Processing never allocates and never scans for a terminating NUL, so the same
+ * context can encipher arbitrary binary buffers piece by piece on a hot path.
+ * Enciphering and deciphering are the same operation.
+ */
+typedef struct EnigmaContext EnigmaContext;
+
+/* Create a context from a key file (see key-parser.h for the format). NULL on error. */
+EnigmaContext* enigma_open_key_file(const char* path);
+
+/* Create a context from key components (same strings as the --reflector, --rotors,
+   --rings and --plugboard options; any may be NULL). NULL on error. */
+EnigmaContext* enigma_open_key(const char* reflector, const char* rotors, const char* rings, const char* plugboard);
+
+/* Encipher len bytes from in into out (out may be in). Continues where the previous
+   call on this context stopped. Returns 0 on success. */
+int enigma_process(EnigmaContext* ctx, const char* in, size_t len, char* out);
+
+/* Move the rotors to where they are after `letters` letters of the message
+   (counted from the start of the message, not from the current state) */
+void enigma_seek(EnigmaContext* ctx, uint64_t letters);
+
+/* Start a new message with the key's start positions */
+void enigma_reset(EnigmaContext* ctx);
+
+void enigma_close(EnigmaContext* ctx);
+
+/*
+ * Shared keys and per-message streams.
+ *
+ * An EnigmaKey is read-only once opened: any number of threads may encipher with
+ * it at the same time, each message keeping its own rotor state in an EnigmaStream.
+ * A stream is a small plain value that can live on the stack or be copied to fork
+ * a message at its current position.
+ */
+typedef struct EnigmaKey EnigmaKey;
+
+/* Most rotors a key can have */
+#define ENIGMA_MAX_ROTORS 8
+
+/* Rotor positions of a message (0-25 per rotor, fast rotor first) */
+typedef struct EnigmaStream {
+    unsigned char positions[ENIGMA_MAX_ROTORS];
+} EnigmaStream;
+
+/* Parse and compile a key; NULL on error. Arguments as for the context functions. */
+EnigmaKey* enigma_key_open_file(const char* path);
+EnigmaKey* enigma_key_open(const char* reflector, const char* rotors, const char* rings, const char* plugboard);
+void enigma_key_close(EnigmaKey* key);
+
+/* Same as enigma_key_open without the precomputed period table: opens in microseconds
+   instead of milliseconds, enciphers more slowly. For keys used on a few short messages. */
+EnigmaKey* enigma_key_open_quick(const char* reflector, const char* rotors, const char* rings, const char* plugboard);
+
+/* Start a new message with the key's start positions */
+void enigma_stream_init(const EnigmaKey* key, EnigmaStream* stream);
+
+/* Encipher len bytes from in into out (out may be in), advancing stream. Returns 0 on success. */
+int enigma_stream_process(const EnigmaKey* key, EnigmaStream* stream, const char* in, size_t len, char* out);
+
+/* Move stream to where it is after `letters` letters of the message (counted from its start) */
+void enigma_stream_seek(const EnigmaKey* key, EnigmaStream* stream, uint64_t letters);
+
+/* One message of enigma_process_many */
+typedef struct EnigmaJob {
+    const EnigmaKey* key;
+    EnigmaStream* stream;
+    const char* in;
+    char* out;                          // may be in
+    size_t len;
+} EnigmaJob;
+
+/* Encipher many independent messages at once, each with its own key and stream (see
+   multi.h): the same result as enigma_stream_process on each job, several messages
+   per vector instruction. Streams must not be shared between jobs. Returns 0 on
+   success, nonzero if a job is missing its key, stream or buffers. */
+int enigma_process_many(const EnigmaJob* jobs, size_t count);
+
+/*
+ * Run statistics: time spent loading keys and enciphering, bytes, and counts of
+ * letters, spaces and pass-through characters, gathered for the whole process
+ * (all contexts, keys and threads). Off by default; while off the library only
+ * tests a flag per call.
+ */
+
+/* Timed phases, indexes of EnigmaStats::ns */
+enum {
+    ENIGMA_STATS_READ = 0,              // reading the input
+    ENIGMA_STATS_KEY,                   // parsing, compiling or loading keys
+    ENIGMA_STATS_CIPHER,                // enciphering, summed over all threads
+    ENIGMA_STATS_WRITE,                 // writing the output
+    ENIGMA_STATS_PHASES
+};
+
+typedef struct EnigmaStats {
+    uint64_t ns[ENIGMA_STATS_PHASES];   // time spent per phase
+    uint64_t wall_ns;                   // since stats were enabled or last reset
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint64_t letters;                   // A-Z and a-z
+    uint64_t spaces;                    // enciphered as 'X'
+    uint64_t passthrough;               // everything else, copied unchanged
+} EnigmaStats;
+
+/* Turn gathering on (resetting the counters) or off */
+void enigma_stats_enable(int on);
+
+void enigma_stats_reset(void);
+
+/* Copy the current counters into stats */
+void enigma_stats_get(EnigmaStats* stats);
+
+/* Write the counters to f as text, or as a JSON object if json is nonzero */
+void enigma_stats_report(FILE* f, int json);
+
+
+
+#endif /* ENIGMA_H */
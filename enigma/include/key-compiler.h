@@ -0,0 +1,156 @@
+#ifndef KEY_COMPILER_H
+#define KEY_COMPILER_H
+
+#include "config.h"
+#include "key-parser.h"
+
+#include <stdint.h>
+
+/* Keys with at most this many rotors get a precomputed table for every rotor
+   state of their stepping period (26 * 25 * 26 states, ~440 KB for 3 rotors) */
+#define PERIOD_TABLE_MAX_ROTORS 3
+
+/* The period table repeats this many cycle states after its end (plus a few spare
+   bytes), so vector kernels can index a whole block of letters without wrapping */
+#define STATE_PADDING 64
+
+/* Marks rotor positions that are not part of the period table */
+#define STATE_NONE 0xFFFF
+
+/* Inline even where the compiler would not, so loops over a constant rotor count unroll */
+#if defined(__GNUC__)
+#define FORCE_INLINE inline __attribute__((always_inline))
+#else
+#define FORCE_INLINE inline
+#endif
+
+/* Rows per rotor in the shared table of shifted rotors: offsets 0-50, so the 26 rows
+   of a rotor at any ring setting follow each other */
+#define SHIFTED_ROWS 51
+
+/*
+ * The standard rotors at every offset (position minus ring setting), and the standard
+ * reflectors: forward[t][o][in] is what rotor type t (0-7 for I-VIII) at offset o % 26
+ * makes of in, backward[t][o] its inverse. Built once per process (about 21 KB) and
+ * shared by all keys and threads: a standard rotor's tables in a CompiledKey are rows
+ * of this table, so compiling one is choosing a pointer.
+ */
+typedef struct ShiftedRotors {
+    unsigned char forward[ROTOR_TYPES][SHIFTED_ROWS][26];
+    unsigned char backward[ROTOR_TYPES][SHIFTED_ROWS][26];
+    unsigned char reflectors[3][26];    // B, C and (for keys without one) the identity
+} ShiftedRotors;
+
+/* The shared table, built on first use */
+const ShiftedRotors* shifted_rotors(void);
+
+/* Machine shapes with code specialised at build time (rotor loops unrolled, plugboard
+   lookups dropped when unplugged); chosen once by compile_key */
+typedef enum KeyVariant {
+    KEY_VARIANT_GENERIC = 0,            // any rotor count: loops over the rotors
+    KEY_VARIANT_M3,                     // 3 rotors with plugboard
+    KEY_VARIANT_M3_UNPLUGGED,           // 3 rotors, identity plugboard
+    KEY_VARIANT_M4,                     // 4 rotors with plugboard
+    KEY_VARIANT_M4_UNPLUGGED            // 4 rotors, identity plugboard
+} KeyVariant;
+
+
+/* CompiledKey: lookup tables derived once from a parsed Key so the cipher never
+   walks wirings, searches for inverses or reduces offsets per character.
+   All tables live in the same allocation as the struct itself, but for the rotor and
+   reflector tables of standard rotors and reflectors, which are in shifted_rotors().
+   Rotor 0 is the fast rotor: it sits next to the plugboard and steps on every letter. */
+typedef struct CompiledKey {
+    size_t rotor_count;                 // number of rotors (same as Key::rotor_count)
+    KeyVariant variant;                 // specialised code path for this key
+    const unsigned char (*forward[MAX_ROTORS])[26];     // forward[i][position][in]: rotor i, ring setting folded in
+    const unsigned char (*backward[MAX_ROTORS])[26];    // backward[i][position][in]: inverse wiring, ring setting folded in
+    unsigned char (*entry)[26];         // entry[position][in]: plugboard then fast rotor
+    unsigned char (*exit)[26];          // exit[position][in]: fast rotor inverse then plugboard
+    unsigned char* notches;             // notch position of each rotor
+    unsigned char plugboard[26];        // plugboard (identity when unplugged)
+    const unsigned char* reflector;     // reflector wiring (identity when missing)
+
+    /* Period table (only for rotor_count <= PERIOD_TABLE_MAX_ROTORS, otherwise state_count == 0).
+       States are stored in stepping order from the key's start positions: a prefix of
+       cycle_start states followed by the cycle the machine then repeats forever. */
+    size_t state_count;                 // number of stored states
+    size_t cycle_start;                 // index of the first state of the cycle
+    unsigned char (*states)[26];        // states[j]: fused substitution for state j (then STATE_PADDING more)
+    unsigned char* state_positions;     // rotor positions of state j (rotor_count bytes each)
+    unsigned short* state_index;        // rotor positions as a base-26 number -> state j or STATE_NONE
+} CompiledKey;
+
+/* Build the tables for k, using its start positions as the start of the period table.
+   Returns a newly allocated CompiledKey (caller must free with free_compiled_key) */
+struct CompiledKey* compile_key(const struct Key* k);
+
+/* Same, with the tables allocated from arena (released with the arena, not with
+   free_compiled_key) */
+struct CompiledKey* compile_key_in(Arena* arena, const struct Key* k);
+
+/* Flags of compile_key_flags_in */
+#define COMPILE_NO_PERIOD_TABLE 0x1u    // stepping tables only (keys without rotors still get one)
+
+/* compile_key_in with flags. Skipping the period table makes compiling a 3 rotor key
+   take microseconds instead of milliseconds, for keys that only encipher a few short
+   messages; those are enciphered on the stepping path. */
+struct CompiledKey* compile_key_flags_in(Arena* arena, const struct Key* k, unsigned flags);
+
+/* Variant for a key with n rotors and the given (normalised) plugboard */
+KeyVariant select_key_variant(size_t n, const unsigned char plugboard[26]);
+
+/* Fuse plugboard -> rotors -> reflector -> rotors^-1 -> plugboard for the given
+   rotor positions (one byte per rotor, 0-25) into a single 26-byte substitution. */
+void compile_state_table(const struct CompiledKey* ck, const unsigned char* positions, unsigned char out[26]);
+
+/* Advance rotor positions by one key press (odometer stepping with double-stepping).
+   Returns nonzero if any rotor other than the fast one moved. */
+int step_rotors(const struct CompiledKey* ck, unsigned char* positions);
+
+/*
+ * step_rotors() for callers that know n at compile time. Rotor 0 always steps. Pawl i
+ * (1..n-1) engages when rotor i-1 sits at its notch and pushes both rotor i and rotor
+ * i-1, which gives the double-step of the middle rotor. All pawls look at the positions
+ * before the press. Branch-free: the pushes are collected as a bit mask first.
+ */
+static FORCE_INLINE int step_positions(const unsigned char* notches, size_t n, unsigned char* p) {
+    if (n == 0) return 0;
+    unsigned at = 0;                    // bit i: rotor i at its notch, pawl i + 1 engages
+    for (size_t i = 0; i + 1 < n; ++i) at |= (unsigned)(p[i] == notches[i]) << i;
+    unsigned push = 1u | at | (at << 1);
+    for (size_t i = 0; i < n; ++i) {
+        unsigned v = p[i] + ((push >> i) & 1u);
+        p[i] = (unsigned char)(v == 26 ? 0 : v);
+    }
+    return at != 0;
+}
+
+/* Substitution of the slow rotors and reflector (everything between the entry and
+   exit tables) for the given positions; n is the rotor count */
+static FORCE_INLINE void compile_inner_table(const CompiledKey* ck, const unsigned char* positions, unsigned char inner[26], size_t n) {
+    for (int c = 0; c < 26; ++c) {
+        int v = c;
+        for (size_t i = 1; i < n; ++i) v = ck->forward[i][positions[i]][v];
+        v = ck->reflector[v];
+        for (size_t i = n; i-- > 1;) v = ck->backward[i][positions[i]][v];
+        inner[c] = (unsigned char)v;
+    }
+}
+
+/* Inverse of a rotor wiring: for each output, the first input mapping to it
+   (identity for outputs the wiring never produces) */
+void invert_wiring(const unsigned char wiring[26], unsigned char inverse[26]);
+
+/* Advance rotor positions by the given number of key presses in O(rotor_count),
+   computed from the notches instead of pressing the keys one by one. */
+void seek_rotors(const struct CompiledKey* ck, unsigned char* positions, uint64_t letters);
+
+/* Index of the period table state for the given rotor positions, or STATE_NONE */
+size_t lookup_state(const struct CompiledKey* ck, const unsigned char* positions);
+
+void free_compiled_key(struct CompiledKey* ck);
+
+
+
+#endif /* KEY_COMPILER_H */
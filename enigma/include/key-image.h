@@ -0,0 +1,72 @@
+#ifndef KEY_IMAGE_H
+#define KEY_IMAGE_H
+
+#include "config.h"
+
+#include <stdint.h>
+
+/* Compiled-key image: a binary file holding a key and all of its derived tables,
+   laid out so they can be used straight from a read-only mapping */
+#define KEY_IMAGE_MAGIC "ENIGKEYC"
+#define KEY_IMAGE_VERSION 1
+
+/* Byte order marker; images are native-endian and rejected on a mismatch */
+#define KEY_IMAGE_BYTE_ORDER 0x01020304u
+
+/* The image carries the period table (keys with up to PERIOD_TABLE_MAX_ROTORS rotors) */
+#define KEY_IMAGE_HAS_STATES 0x1u
+
+/* Alignment of every table in the image */
+#define KEY_IMAGE_ALIGN 64
+
+
+
+/* Fixed header at offset 0. Table offsets are in bytes from the start of the image,
+   0 for tables the image does not have. The checksum covers the whole image with
+   the checksum field itself set to 0. */
+typedef struct KeyImageHeader {
+    char magic[8];                      // KEY_IMAGE_MAGIC, not NUL-terminated
+    uint32_t version;                   // KEY_IMAGE_VERSION
+    uint32_t byte_order;                // KEY_IMAGE_BYTE_ORDER as written
+    uint64_t size;                      // total image bytes
+    uint64_t checksum;
+    uint64_t state_count;               // CompiledKey::state_count
+    uint64_t cycle_start;               // CompiledKey::cycle_start
+    uint64_t forward;                   // rotor_count * [26][26]
+    uint64_t backward;                  // rotor_count * [26][26]
+    uint64_t entry;                     // [26][26]
+    uint64_t exit;                      // [26][26]
+    uint64_t states;                    // (state_count + STATE_PADDING) * [26] + 4 spare bytes
+    uint64_t state_positions;           // state_count * rotor_count
+    uint64_t state_index;               // 26^rotor_count unsigned shorts
+    uint32_t flags;                     // KEY_IMAGE_HAS_STATES
+    uint32_t rotor_count;
+    unsigned char start[MAX_ROTORS];    // Key::start
+    unsigned char rings[MAX_ROTORS];    // Key::ring_settings
+    unsigned char notches[MAX_ROTORS];  // Rotor::notch
+    unsigned char wiring[MAX_ROTORS][26];   // Rotor::wiring
+    unsigned char reflector[26];        // Reflector::wiring
+    unsigned char plugboard[26];        // Key::plugboard_settings
+} KeyImageHeader;
+
+/* Write k (which must be compiled) as an image to path. Returns 0 on success. */
+int write_key_image(const Key* k, const char* path);
+
+/* Load an image written by write_key_image(). The file is mapped read-only and the
+   tables are used in place: nothing is parsed or recomputed, the load only checks the
+   header, the checksum and the table bounds. Free the key with free_key(). NULL on error. */
+struct Key* load_key_image(const char* path);
+
+/* Return an image mapped by load_key_image() (called by free_key) */
+void release_key_image(void* image, size_t size);
+
+/* Load a key from either a compiled image or a text key file, told apart by the magic */
+struct Key* load_key_file(const char* path);
+
+/* Same for a key that will encipher about `bytes` bytes of messages (see
+   parse_key_file_for); images always carry the tables they were compiled with */
+struct Key* load_key_file_for(const char* path, uint64_t bytes);
+
+
+
+#endif /* KEY_IMAGE_H */
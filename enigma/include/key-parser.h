@@ -3,8 +3,19 @@
 
 #include "config.h"
 
+#include <stdint.h>
 
 
+
+/* Rotor types a key can name (rotors=1-8 for I-VIII) */
+#define ROTOR_TYPES 8
+
+/* Standard wirings of rotors I-VIII, their notch positions and reflectors B and C */
+extern const unsigned char ROTOR_WIRINGS[ROTOR_TYPES][26];
+extern const unsigned char ROTOR_NOTCHES[ROTOR_TYPES];
+extern const unsigned char REFLECTOR_B[26];
+extern const unsigned char REFLECTOR_C[26];
+
 /* Parse a key from a key file. Supported simple text format (key=value lines):
    reflector=25
    rotors=3,1,4
@@ -17,6 +28,18 @@ struct Key* parse_key_file(const char* path);
    Strings are the same format as above (comma-separated lists). */
 struct Key* parse_key_components(const char* reflector_str, const char* rotors_str, const char* rings_str, const char* plugboard_str);
 
+/* parse_key_file and parse_key_components for keys that will encipher about `bytes`
+   bytes of messages: the period table is only built if it pays off for that much
+   (see engine_compile_flags) */
+struct Key* parse_key_file_for(const char* path, uint64_t bytes);
+struct Key* parse_key_components_for(const char* reflector_str, const char* rotors_str, const char* rings_str, const char* plugboard_str, uint64_t bytes);
+
+/* Same, compiled without a period table (see COMPILE_NO_PERIOD_TABLE): much cheaper to
+   build, slower per letter. For keys that only encipher a few short messages. */
+struct Key* parse_key_components_quick(const char* reflector_str, const char* rotors_str, const char* rings_str, const char* plugboard_str);
+
+/* Free a key returned by the parser. Each parsed key lives in an arena of its own,
+   so this releases the key and all of its tables at once. */
 void free_key(struct Key* k);
 
 
@@ -0,0 +1,24 @@
+#ifndef MMAP_IO_H
+#define MMAP_IO_H
+
+#include "config.h"
+
+/* Returned by encrypt_mapped() when the input cannot be mapped (not a regular
+   file, or no mmap on this platform); nothing has been written in that case */
+#define MAPPED_UNSUPPORTED (-1)
+
+
+
+/* Encipher config->input_path without copying it through heap buffers. The input
+   file is mapped read-only and enciphered straight into output_path, which is
+   created at its final size and mapped too. If output_path is "-" a private
+   (copy-on-write) mapping of the input is transformed in place and written to
+   stdout, as it is to outputs that are not regular files (devices, pipes); if it
+   names the input file itself, the file is transformed in place.
+   config->state is advanced as with encrypt(). Returns 0 on success,
+   MAPPED_UNSUPPORTED, or a positive error code. */
+int encrypt_mapped(Config* config, const char* output_path);
+
+
+
+#endif /* MMAP_IO_H */
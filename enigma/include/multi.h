@@ -0,0 +1,34 @@
+#ifndef MULTI_H
+#define MULTI_H
+
+#include "config.h"
+
+/* Messages enciphered side by side, one per vector lane */
+#define MULTI_LANES 8
+
+/* One message of a batch: len bytes of in enciphered into out (which may be in)
+   with key, starting from and advancing *state like encrypt_buffer() */
+typedef struct MultiJob {
+    const struct CompiledKey* key;
+    RotorState* state;
+    const char* in;
+    char* out;
+    size_t len;
+} MultiJob;
+
+
+
+/*
+ * Encipher many independent messages, each with its own key and rotor state. The
+ * output and final states are those of encrypt_buffer() on every job in turn, but
+ * up to MULTI_LANES messages are in flight at once: their rotor stacks are laid out
+ * side by side and stepped in vector lanes, with each lane gathering from the tables
+ * of its own key. This gives vector throughput for messages far too short to be
+ * vectorised on their own, and skips the per-call setup of encrypt_buffer().
+ * Jobs may share keys but not states, and their outputs must not overlap.
+ */
+void encrypt_multi(const MultiJob* jobs, size_t count);
+
+
+
+#endif /* MULTI_H */
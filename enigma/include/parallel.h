@@ -0,0 +1,19 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "config.h"
+#include "thread-pool.h"
+
+/* Inputs are split into chunks of this many bytes for the worker threads */
+#define PARALLEL_CHUNK_SIZE (1 << 20)
+
+
+
+/* Encipher len bytes like encrypt_buffer(), with chunks of the input running on the
+   pool. Each chunk seeks the rotors to the state reached after the letters of all
+   chunks before it, so the output and final state match the serial path. */
+void encrypt_parallel(ThreadPool* pool, const struct CompiledKey* ck, RotorState* state, const char* in, char* out, size_t len);
+
+
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,18 @@
+#ifndef ROTOR_STATE_H
+#define ROTOR_STATE_H
+
+
+
+/* Maximum number of rotors in a key */
+#define MAX_ROTORS 8
+
+/* RotorState: the mutable part of a message, the position (0-25) of every rotor.
+   Keys are read-only once parsed; each message being enciphered with a key keeps
+   its own RotorState, so any number of them can share one key without locking. */
+typedef struct RotorState {
+    unsigned char positions[MAX_ROTORS];
+} RotorState;
+
+
+
+#endif /* ROTOR_STATE_H */
@@ -0,0 +1,58 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Daemon mode (--serve): a long-lived process answering cipher requests on a Unix
+ * domain socket. Clients send framed requests over a stream connection and may send
+ * any number of them, one after the other, on the same connection; every request gets
+ * exactly one response, in order. Frames are in native byte order (local clients only).
+ *
+ * Request:  ServeRequest, then key_len bytes of key file path (text key or compiled
+ *           image, no NUL), then data_len bytes of message.
+ * Response: ServeResponse, then data_len bytes of enciphered message (0 on errors).
+ *
+ * Enciphering and deciphering are the same operation, so there is one request type.
+ * Keys are kept compiled in an LRU cache keyed by path, modification time and size.
+ */
+#define SERVE_REQUEST_MAGIC 0x51524E45u     // "ENRQ"
+#define SERVE_RESPONSE_MAGIC 0x53524E45u    // "ENRS"
+
+/* Limits on a single request */
+#define SERVE_MAX_KEY_PATH 4096
+#define SERVE_MAX_MESSAGE (64u * 1024 * 1024)
+
+/* Compiled keys kept by the server */
+#define SERVE_KEY_CACHE 64
+
+/* Response status */
+#define SERVE_OK 0
+#define SERVE_BAD_REQUEST 1                 // bad magic or over the limits; the connection is closed
+#define SERVE_BAD_KEY 2                     // key file missing or invalid
+
+typedef struct ServeRequest {
+    uint32_t magic;                     // SERVE_REQUEST_MAGIC
+    uint32_t key_len;                   // bytes of key path that follow
+    uint64_t data_len;                  // bytes of message after the key path
+    uint64_t offset;                    // letters of the message before this part (0: from the start)
+} ServeRequest;
+
+typedef struct ServeResponse {
+    uint32_t magic;                     // SERVE_RESPONSE_MAGIC
+    uint32_t status;                    // SERVE_OK or an error
+    uint64_t data_len;                  // bytes of enciphered message that follow
+} ServeResponse;
+
+
+
+/* Listen on socket_path and serve requests until SIGINT or SIGTERM, enciphering on
+   `threads` threads. A stale socket file at the path is replaced. Returns 0 after a
+   clean shutdown, nonzero if the socket could not be set up or on platforms
+   without epoll. */
+int run_server(const char* socket_path, size_t threads);
+
+
+
+#endif /* SERVER_H */
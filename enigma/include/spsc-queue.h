@@ -0,0 +1,46 @@
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+/* Slots of a queue; a power of two */
+#define SPSC_QUEUE_SLOTS 8
+
+/* Empty polls before a consumer goes to sleep on the queue */
+#define SPSC_QUEUE_SPIN 1024
+
+/* Cache line size, to keep the producer and consumer indices apart */
+#define SPSC_CACHE_LINE 64
+
+
+
+/*
+ * Bounded single-producer/single-consumer queue of pointers. Pushing and popping
+ * are lock-free; a consumer that finds the queue empty for a while sleeps on a
+ * condition variable, and the producer only takes the lock to wake it.
+ */
+typedef struct SpscQueue {
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t head;    // next slot to pop, written by the consumer
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t tail;    // next slot to push, written by the producer
+    _Alignas(SPSC_CACHE_LINE) atomic_int sleeping;   // the consumer waits on wake
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    void* slots[SPSC_QUEUE_SLOTS];
+} SpscQueue;
+
+/* Returns 0 on success */
+int spsc_queue_init(SpscQueue* q);
+
+void spsc_queue_destroy(SpscQueue* q);
+
+/* Append item; producer thread only. Returns 0, or 1 if the queue is full. */
+int spsc_queue_push(SpscQueue* q, void* item);
+
+/* Take the oldest item, waiting for one if the queue is empty; consumer thread only */
+void* spsc_queue_pop(SpscQueue* q);
+
+
+
+#endif /* SPSC_QUEUE_H */
@@ -0,0 +1,62 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "enigma.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Timed phases of a run (the ENIGMA_STATS_* indexes of EnigmaStats::ns) */
+typedef enum {
+    STATS_READ = ENIGMA_STATS_READ,
+    STATS_KEY = ENIGMA_STATS_KEY,
+    STATS_CIPHER = ENIGMA_STATS_CIPHER,
+    STATS_WRITE = ENIGMA_STATS_WRITE,
+    STATS_PHASES = ENIGMA_STATS_PHASES
+} StatsPhase;
+
+/* Report formats of --stats */
+typedef enum {
+    STATS_OFF = 0,
+    STATS_TEXT,
+    STATS_JSON
+} StatsFormat;
+
+
+
+/* Nonzero while stats are enabled. Every probe tests it first, so disabled stats
+   cost one predictable branch per probe; probes sit at chunk and file level, never
+   per character. Building with ENIGMA_NO_STATS removes the probes altogether. */
+extern int stats_active;
+
+#ifdef ENIGMA_NO_STATS
+#define STATS_ON 0
+#else
+#define STATS_ON stats_active
+#endif
+
+/* Turn gathering on or off (off by default); turning it on resets the counters */
+void stats_enable(int on);
+
+/* Zero the counters and restart the wall clock */
+void stats_reset(void);
+
+/* Copy the counters gathered across all threads (EnigmaStats is in enigma.h) */
+void stats_get(EnigmaStats* out);
+
+/* Write the counters to f as text or as one JSON object */
+void stats_report(FILE* f, StatsFormat format);
+
+/* Probes: a monotonic timestamp in ns, and the time since start added to a phase */
+uint64_t stats_clock(void);
+void stats_add_time(StatsPhase phase, uint64_t start);
+
+void stats_add_bytes(uint64_t read, uint64_t written);
+
+/* Count the letters, spaces and pass-through characters of in[0, len) */
+void stats_count_chars(const char* in, size_t len);
+
+
+
+#endif /* STATS_H */
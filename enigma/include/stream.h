@@ -0,0 +1,27 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "config.h"
+
+#include <stdio.h>
+
+/* Bytes read, enciphered and written at a time by the streaming engine */
+#define STREAM_CHUNK_SIZE (256 * 1024)
+
+/* Chunks in flight: one being read, one enciphered and one written */
+#define STREAM_DEPTH 3
+
+
+
+/* Encipher everything readable from in and write it to out as it goes, one chunk
+   at a time, carrying config->state from chunk to chunk. Reading, enciphering and
+   writing overlap: a reader and a writer thread run beside the cipher, or with
+   io_uring (built with ENIGMA_IO_URING) the kernel does both. Memory use does not
+   depend on the input size (STREAM_DEPTH chunks of STREAM_CHUNK_SIZE, or of
+   PARALLEL_CHUNK_SIZE per thread with config->threads > 1). config->input is not
+   used. Returns 0 on success, nonzero on I/O or allocation errors. */
+int encrypt_stream(Config* config, FILE* in, FILE* out);
+
+
+
+#endif /* STREAM_H */
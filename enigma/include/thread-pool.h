@@ -0,0 +1,32 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <stddef.h>
+
+
+
+typedef struct ThreadPool ThreadPool;
+
+/* Task callback: called once for every index of a thread_pool_run() call */
+typedef void (*ThreadPoolTask)(void* arg, size_t index);
+
+/* Create a pool that runs tasks on `threads` threads in total (the thread calling
+   thread_pool_run() is one of them). Returns NULL on failure. */
+ThreadPool* thread_pool_create(size_t threads);
+
+/* Number of threads tasks run on, including the caller */
+size_t thread_pool_size(const ThreadPool* pool);
+
+/* Run task(arg, i) for every i in [0, count) and wait for all of them. Indices are
+   split evenly between the threads; a thread that runs out steals half of the
+   remaining indices of another one. */
+void thread_pool_run(ThreadPool* pool, size_t count, ThreadPoolTask task, void* arg);
+
+void thread_pool_destroy(ThreadPool* pool);
+
+/* Processors online, for a pool that uses the whole machine (at least 1) */
+size_t thread_pool_cpu_count(void);
+
+
+
+#endif /* THREAD_POOL_H */
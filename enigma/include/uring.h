@@ -0,0 +1,35 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* File position of an fd, for reads and writes that go wherever the last one ended */
+#define URING_CURRENT_POSITION (-1)
+
+
+
+/*
+ * Minimal io_uring ring for reads and writes, on the raw system calls (no liburing).
+ * Only built in with ENIGMA_IO_URING on Linux (make IO_URING=1); otherwise, and on
+ * kernels or sandboxes without io_uring, uring_open() returns NULL and callers fall
+ * back to ordinary I/O.
+ */
+typedef struct Uring Uring;
+
+/* A ring with room for `entries` requests in flight; NULL if io_uring is not available */
+Uring* uring_open(unsigned entries);
+
+/* Queue and submit a read (write = 0) or write of len bytes at offset on fd; the
+   completion carries tag. Returns 0 on success. */
+int uring_submit(Uring* ring, int write, int fd, void* buf, unsigned len, int64_t offset, uint64_t tag);
+
+/* Wait for the next completion: its tag and result (bytes transferred or -errno).
+   Returns 0 on success. */
+int uring_wait(Uring* ring, uint64_t* tag, int* result);
+
+void uring_close(Uring* ring);
+
+
+
+#endif /* URING_H */
@@ -0,0 +1,104 @@
+#include "../include/arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct ArenaBlock {
+    ArenaBlock* next;
+    size_t size;                        // usable bytes after the header
+    size_t used;
+};
+
+/* Block header size rounded up so the data starts aligned */
+#define BLOCK_HEADER ((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+static unsigned char* block_data(ArenaBlock* b) {
+    return (unsigned char*)b + BLOCK_HEADER;
+}
+
+static size_t align_up(size_t n) {
+    return (n + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+void arena_init(Arena* arena, size_t block_size) {
+    if (!arena) return;
+    arena->first = NULL;
+    arena->current = NULL;
+    arena->block_size = block_size ? block_size : ARENA_BLOCK_SIZE;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    if (!arena) return NULL;
+    size = align_up(size ? size : 1);
+
+    ArenaBlock* b = arena->current;
+    if (b && b->size - b->used >= size) {
+        void* p = block_data(b) + b->used;
+        b->used += size;
+        return p;
+    }
+
+    /* Move on to the next empty block that fits; blocks skipped over stay unused until the next reset */
+    ArenaBlock* prev = b;
+    for (b = b ? b->next : arena->first; b; prev = b, b = b->next) {
+        if (b->size >= size) break;
+    }
+    if (!b) {
+        size_t bytes = size > arena->block_size ? size : arena->block_size;
+        if (bytes > SIZE_MAX - BLOCK_HEADER) return NULL;
+        b = malloc(BLOCK_HEADER + bytes);
+        if (!b) return NULL;
+        b->next = NULL;
+        b->size = bytes;
+        if (prev) prev->next = b;
+        else arena->first = b;
+    }
+    b->used = size;
+    arena->current = b;
+    return block_data(b);
+}
+
+void* arena_calloc(Arena* arena, size_t count, size_t size) {
+    if (size && count > SIZE_MAX / size) return NULL;
+    void* p = arena_alloc(arena, count * size);
+    if (p) memset(p, 0, count * size);
+    return p;
+}
+
+char* arena_strdup(Arena* arena, const char* s) {
+    if (!s) return NULL;
+    size_t len = strlen(s) + 1;
+    char* p = arena_alloc(arena, len);
+    if (p) memcpy(p, s, len);
+    return p;
+}
+
+ArenaMark arena_mark(const Arena* arena) {
+    ArenaMark mark = { arena->current, arena->current ? arena->current->used : 0 };
+    return mark;
+}
+
+void arena_rewind(Arena* arena, ArenaMark mark) {
+    if (!arena) return;
+    if (!mark.block) { arena_reset(arena); return; }
+    arena->current = mark.block;
+    mark.block->used = mark.used;
+}
+
+void arena_reset(Arena* arena) {
+    if (!arena) return;
+    arena->current = NULL;
+}
+
+void arena_free(Arena* arena) {
+    if (!arena) return;
+    ArenaBlock* b = arena->first;
+    while (b) {
+        ArenaBlock* next = b->next;
+        free(b);
+        b = next;
+    }
+    arena->first = NULL;
+    arena->current = NULL;
+}
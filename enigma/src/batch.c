@@ -0,0 +1,272 @@
+#include "../include/batch.h"
+#include "../include/config.h"
+#include "../include/encrypt.h"
+#include "../include/engine.h"
+#include "../include/key-image.h"
+#include "../include/key-parser.h"
+#include "../include/stats.h"
+#include "../include/stream.h"
+#include "../include/thread-pool.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+typedef struct BatchJob {
+    const char* input;
+    const char* output;
+    size_t key;                         // index into Batch::keys
+    size_t line;                        // manifest line, for messages
+} BatchJob;
+
+typedef struct BatchKey {
+    const char* path;
+    Key* key;                           // NULL if the key file could not be parsed
+    uint64_t bytes;                     // input bytes of all jobs with this key (ENGINE_SIZE_UNKNOWN if not all are files)
+} BatchKey;
+
+typedef struct Batch {
+    char* manifest;                     // manifest contents; the job strings point into it
+    BatchJob* jobs;
+    size_t job_count;
+    BatchKey* keys;                     // distinct key files in order of first use
+    size_t key_count;
+    size_t* key_slots;                  // open addressing on the key path: key index + 1, 0 = empty
+    size_t slot_count;                  // power of two, at least twice key_count
+
+    pthread_mutex_t lock;               // guards the free buffers and the failure count
+    char** free_buffers;                // STREAM_CHUNK_SIZE buffers not in use by a job
+    size_t free_count;
+    size_t failed;
+} Batch;
+
+static char* read_file(const char* path) {
+    FILE* f = fopen(path, "rb");
+    if (!f) { perror(path); return NULL; }
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char* data = sz >= 0 ? malloc((size_t)sz + 1) : NULL;
+    if (data && fread(data, 1, (size_t)sz, f) != (size_t)sz) { free(data); data = NULL; }
+    if (data) data[sz] = '\0';
+    else fprintf(stderr, "Error: cannot read %s\n", path);
+    fclose(f);
+    return data;
+}
+
+static uint64_t hash_path(const char* s) {
+    uint64_t h = 14695981039346656037ull;   // FNV-1a
+    while (*s) { h ^= (unsigned char)*s++; h *= 1099511628211ull; }
+    return h;
+}
+
+/* Double the slot table and rehash every key */
+static int grow_key_slots(Batch* b) {
+    size_t count = b->slot_count ? b->slot_count * 2 : 64;
+    size_t* slots = calloc(count, sizeof(*slots));
+    if (!slots) return 1;
+    for (size_t i = 0; i < b->key_count; ++i) {
+        size_t s = (size_t)hash_path(b->keys[i].path) & (count - 1);
+        while (slots[s]) s = (s + 1) & (count - 1);
+        slots[s] = i + 1;
+    }
+    free(b->key_slots);
+    b->key_slots = slots;
+    b->slot_count = count;
+    return 0;
+}
+
+/* Index of the key file at path, added on first use; (size_t)-1 on allocation failure */
+static size_t find_key(Batch* b, const char* path) {
+    if (2 * (b->key_count + 1) > b->slot_count) {
+        if (grow_key_slots(b)) return (size_t)-1;
+        BatchKey* keys = realloc(b->keys, b->slot_count / 2 * sizeof(*keys));
+        if (!keys) return (size_t)-1;
+        b->keys = keys;
+    }
+    size_t s = (size_t)hash_path(path) & (b->slot_count - 1);
+    while (b->key_slots[s]) {
+        size_t k = b->key_slots[s] - 1;
+        if (strcmp(b->keys[k].path, path) == 0) return k;
+        s = (s + 1) & (b->slot_count - 1);
+    }
+    b->keys[b->key_count].path = path;
+    b->keys[b->key_count].key = NULL;
+    b->keys[b->key_count].bytes = 0;
+    b->key_slots[s] = ++b->key_count;
+    return b->key_count - 1;
+}
+
+/* Cut the next whitespace-separated field off *p, NULL at the end of the line */
+static char* next_field(char** p) {
+    char* s = *p;
+    while (*s == ' ' || *s == '\t' || *s == '\r') ++s;
+    if (*s == '\0') { *p = s; return NULL; }
+    char* e = s;
+    while (*e && !isspace((unsigned char)*e)) ++e;
+    if (*e) *e++ = '\0';
+    *p = e;
+    return s;
+}
+
+/* Split the manifest into jobs and collect the distinct key files */
+static int parse_manifest(Batch* b) {
+    size_t lines = 1;
+    for (const char* c = b->manifest; *c; ++c) lines += *c == '\n';
+    b->jobs = malloc(lines * sizeof(*b->jobs));
+    if (!b->jobs) return 1;
+
+    char* line = b->manifest;
+    for (size_t number = 1; line; ++number) {
+        char* end = strchr(line, '\n');
+        if (end) *end = '\0';
+        char* p = line;
+        line = end ? end + 1 : NULL;
+
+        char* input = next_field(&p);
+        if (!input || input[0] == '#') continue;
+        char* key = next_field(&p);
+        char* output = next_field(&p);
+        char* direction = next_field(&p);
+        if (!key || !output || next_field(&p)) {
+            fprintf(stderr, "Error: manifest line %zu: expected input key output [encrypt|decrypt]\n", number);
+            return 2;
+        }
+        if (direction && strcmp(direction, "encrypt") != 0 && strcmp(direction, "decrypt") != 0) {
+            fprintf(stderr, "Error: manifest line %zu: unknown direction: %s\n", number, direction);
+            return 2;
+        }
+
+        BatchJob* job = &b->jobs[b->job_count++];
+        job->input = input;
+        job->output = output;
+        job->line = number;
+        job->key = find_key(b, key);
+        if (job->key == (size_t)-1) return 1;
+
+        /* A key used for a few short messages is cheaper without its period table */
+        struct stat st;
+        uint64_t* bytes = &b->keys[job->key].bytes;
+        if (stat(input, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size >= ENGINE_SIZE_UNKNOWN - *bytes) *bytes = ENGINE_SIZE_UNKNOWN;
+        else *bytes += (uint64_t)st.st_size;
+    }
+    return 0;
+}
+
+static void load_key_task(void* arg, size_t index) {
+    BatchKey* k = &((Batch*)arg)->keys[index];
+    k->key = load_key_file_for(k->path, k->bytes);
+    if (k->key && !k->key->compiled) { free_key(k->key); k->key = NULL; }
+}
+
+static char* take_buffer(Batch* b) {
+    pthread_mutex_lock(&b->lock);
+    char* buf = b->free_count ? b->free_buffers[--b->free_count] : NULL;
+    pthread_mutex_unlock(&b->lock);
+    return buf ? buf : malloc(STREAM_CHUNK_SIZE);
+}
+
+/* There are never more buffers than threads, so free_buffers always has room */
+static void return_buffer(Batch* b, char* buf) {
+    pthread_mutex_lock(&b->lock);
+    b->free_buffers[b->free_count++] = buf;
+    pthread_mutex_unlock(&b->lock);
+}
+
+/* Encipher one file chunk by chunk through buf; 0 on success */
+static int run_job(const BatchJob* job, const Key* key, char* buf) {
+    FILE* in = fopen(job->input, "rb");
+    if (!in) { perror(job->input); return 1; }
+    FILE* out = fopen(job->output, "wb");
+    if (!out) { perror(job->output); fclose(in); return 1; }
+    /* Whole chunks are read and written at a time: stdio buffers would only add copies */
+    setvbuf(in, NULL, _IONBF, 0);
+    setvbuf(out, NULL, _IONBF, 0);
+
+    RotorState state = key->start;
+    int rc = 0;
+    for (;;) {
+        uint64_t t0 = STATS_ON ? stats_clock() : 0;
+        size_t got = fread(buf, 1, STREAM_CHUNK_SIZE, in);
+        if (STATS_ON) stats_add_time(STATS_READ, t0);
+        if (got == 0) break;
+        encrypt_buffer(key->compiled, &state, buf, buf, got);
+        if (STATS_ON) t0 = stats_clock();
+        size_t put = fwrite(buf, 1, got, out);
+        if (STATS_ON) {
+            stats_add_time(STATS_WRITE, t0);
+            stats_add_bytes(got, put);
+        }
+        if (put != got) { perror(job->output); rc = 1; break; }
+    }
+    if (!rc && ferror(in)) { perror(job->input); rc = 1; }
+    fclose(in);
+    if (fclose(out) != 0 && !rc) { perror(job->output); rc = 1; }
+    return rc;
+}
+
+static void run_job_task(void* arg, size_t index) {
+    Batch* b = arg;
+    const BatchJob* job = &b->jobs[index];
+    const BatchKey* k = &b->keys[job->key];
+
+    int rc = 1;
+    if (!k->key) {
+        fprintf(stderr, "Error: manifest line %zu: invalid key file %s\n", job->line, k->path);
+    } else if (same_file_path(job->input, job->output)) {
+        /* Opening the output would empty the input before it is read */
+        fprintf(stderr, "Error: manifest line %zu: the output %s is the input file\n", job->line, job->output);
+    } else {
+        char* buf = take_buffer(b);
+        if (buf) {
+            rc = run_job(job, k->key, buf);
+            return_buffer(b, buf);
+        } else {
+            fprintf(stderr, "Error: manifest line %zu: out of memory\n", job->line);
+        }
+    }
+    if (rc) {
+        pthread_mutex_lock(&b->lock);
+        b->failed++;
+        pthread_mutex_unlock(&b->lock);
+    }
+}
+
+int run_batch(const char* manifest_path, size_t threads) {
+    if (!manifest_path) return 1;
+    Batch b;
+    memset(&b, 0, sizeof(b));
+    b.manifest = read_file(manifest_path);
+    if (!b.manifest) return 4;
+
+    int rc = parse_manifest(&b);
+    ThreadPool* pool = NULL;
+    if (rc == 0) {
+        pool = thread_pool_create(threads);
+        b.free_buffers = pool ? calloc(thread_pool_size(pool), sizeof(*b.free_buffers)) : NULL;
+        if (!b.free_buffers) rc = 6;
+    }
+    if (rc == 0) {
+        pthread_mutex_init(&b.lock, NULL);
+        thread_pool_run(pool, b.key_count, load_key_task, &b);
+        thread_pool_run(pool, b.job_count, run_job_task, &b);
+        pthread_mutex_destroy(&b.lock);
+
+        printf("Processed %zu jobs with %zu keys, %zu failed\n", b.job_count, b.key_count, b.failed);
+        if (b.failed) rc = 1;
+    }
+    thread_pool_destroy(pool);
+
+    for (size_t i = 0; i < b.free_count; ++i) free(b.free_buffers[i]);
+    for (size_t i = 0; i < b.key_count; ++i) free_key(b.keys[i].key);
+    free(b.free_buffers);
+    free(b.key_slots);
+    free(b.keys);
+    free(b.jobs);
+    free(b.manifest);
+    return rc;
+}
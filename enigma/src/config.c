@@ -1,15 +1,89 @@
 #include "../include/config.h"
+#include "../include/crack.h"
+#include "../include/engine.h"
+#include "../include/key-image.h"
 #include "../include/key-parser.h"
+#include "../include/stats.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/stat.h>
 
 
 
+/* Parse a byte offset of --range, --block-size or --crib-at; returns 0 on success */
+static int parse_size(const char* s, const char* end, uint64_t* out) {
+    if (s == end) return 1;
+    uint64_t v = 0;
+    for (; s < end; ++s) {
+        if (*s < '0' || *s > '9' || v > (UINT64_MAX - 9) / 10) return 1;
+        v = v * 10 + (uint64_t)(*s - '0');
+    }
+    *out = v;
+    return 0;
+}
+
+/* --range A:B, where either end may be left out */
+static int parse_range(const char* arg, uint64_t* begin, uint64_t* end) {
+    const char* colon = strchr(arg, ':');
+    if (!colon) return 1;
+    *begin = 0;
+    *end = UINT64_MAX;
+    if (colon > arg && parse_size(arg, colon, begin) != 0) return 1;
+    if (colon[1] && parse_size(colon + 1, colon + strlen(colon), end) != 0) return 1;
+    return *begin > *end;
+}
+
+/* --shard I/N with I < N */
+static int parse_shard(const char* arg, size_t* shard, size_t* shards) {
+    const char* slash = strchr(arg, '/');
+    uint64_t i, n;
+    if (!slash || parse_size(arg, slash, &i) != 0 || parse_size(slash + 1, slash + strlen(slash), &n) != 0) return 1;
+    if (n == 0 || n > CRACK_MAX_SHARDS || i >= n) return 1;
+    *shard = (size_t)i;
+    *shards = (size_t)n;
+    return 0;
+}
+
+/* Bytes of the message the key will encipher, so that it only gets the tables that
+   pay off (see engine_compile_flags): the input file's size, or as much of it as the
+   --range asks for; unknown for stdin and anything that is not a regular file */
+static uint64_t message_size(const char* infile, uint64_t range_begin, uint64_t range_end) {
+    struct stat st;
+    if (!infile || strcmp(infile, "-") == 0 || stat(infile, &st) != 0 || !S_ISREG(st.st_mode)) return ENGINE_SIZE_UNKNOWN;
+    uint64_t size = (uint64_t)st.st_size;
+    return range_end - range_begin < size ? range_end - range_begin : size;
+}
+
+/* Read the whole input file into cfg->input (NUL-terminated) */
+static int load_input_file(Config* cfg, const char* infile) {
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
+    FILE* f = fopen(infile, "rb");
+    if (!f) { perror("fopen"); return 4; }
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (sz < 0) { fclose(f); return 5; }
+    cfg->input = arena_alloc(&cfg->arena, (size_t)sz + 1);
+    if (!cfg->input) { fclose(f); return 6; }
+    if (fread(cfg->input, 1, (size_t)sz, f) != (size_t)sz) {
+        cfg->input = NULL; fclose(f); return 7;
+    }
+    cfg->input[sz] = '\0';
+    cfg->input_len = (size_t)sz;
+    fclose(f);
+    if (STATS_ON) {
+        stats_add_time(STATS_READ, t0);
+        stats_add_bytes((uint64_t)sz, 0);
+    }
+    return 0;
+}
+
 int load_config_from_args(int argc, char* argv[], Config* cfg, int* do_encrypt) {
     if (!cfg || !do_encrypt) return 1;
     memset(cfg, 0, sizeof(*cfg));
+    arena_init(&cfg->arena, ARENA_BLOCK_SIZE);
 
     const char* infile = NULL;
     const char* outfile = NULL;
@@ -18,8 +92,27 @@ int load_config_from_args(int argc, char* argv[], Config* cfg, int* do_encrypt)
     const char* rotors = NULL;
     const char* rings = NULL;
     const char* plugboard = NULL;
+    const char* batchfile = NULL;
+    const char* imagefile = NULL;
+    const char* servefile = NULL;
+    int tune = 0;
 
     int mode_encrypt = 1; // default: encrypt
+    size_t threads = 1;
+    int threads_given = 0;
+    IoMode io_mode = IO_STREAM;
+    StatsFormat stats = STATS_OFF;
+    int indexed = 0;
+    int ranged = 0;
+    uint64_t block_size = 0;
+    uint64_t range_begin = 0, range_end = UINT64_MAX;
+    int crack = 0;
+    size_t crack_rotors = 3;
+    const char* crib = NULL;
+    uint64_t crib_at = UINT64_MAX;
+    const char* workdir = NULL;
+    size_t shard = 0, shards = 0;
+    int merge = 0;
 
     for (int i = 1; i < argc; ++i) {
         if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
@@ -36,10 +129,120 @@ int load_config_from_args(int argc, char* argv[], Config* cfg, int* do_encrypt)
             rings = argv[++i];
         } else if (strcmp(argv[i], "--plugboard") == 0 && i + 1 < argc) {
             plugboard = argv[++i];
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            char* end = NULL;
+            long n = strtol(argv[++i], &end, 10);
+            if (!end || *end != '\0' || n < 1) {
+                fprintf(stderr, "Error: -j expects a positive thread count, got: %s\n", argv[i]);
+                return 2;
+            }
+            threads = (size_t)n;
+            threads_given = 1;
+        } else if (strcmp(argv[i], "--stream") == 0) {
+            io_mode = IO_STREAM;
+        } else if (strcmp(argv[i], "--mmap") == 0) {
+            io_mode = IO_MMAP;
+        } else if (strcmp(argv[i], "--buffered") == 0) {
+            io_mode = IO_BUFFERED;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats = STATS_TEXT;
+        } else if (strcmp(argv[i], "--stats=json") == 0) {
+            stats = STATS_JSON;
+        } else if (strcmp(argv[i], "--indexed") == 0) {
+            indexed = 1;
+        } else if (strcmp(argv[i], "--block-size") == 0 && i + 1 < argc) {
+            ++i;
+            if (parse_size(argv[i], argv[i] + strlen(argv[i]), &block_size) != 0 || block_size == 0 || block_size > (1u << 30)) {
+                fprintf(stderr, "Error: --block-size expects a byte count from 1 to 2^30, got: %s\n", argv[i]);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--range") == 0 && i + 1 < argc) {
+            if (parse_range(argv[++i], &range_begin, &range_end) != 0) {
+                fprintf(stderr, "Error: --range expects start:end byte offsets (either may be empty), got: %s\n", argv[i]);
+                return 2;
+            }
+            indexed = ranged = 1;
+        } else if (strcmp(argv[i], "--crack") == 0) {
+            crack = 1;
+        } else if (strcmp(argv[i], "--crack-rotors") == 0 && i + 1 < argc) {
+            char* end = NULL;
+            long n = strtol(argv[++i], &end, 10);
+            if (!end || *end != '\0' || n < 1 || n > CRACK_MAX_ROTORS) {
+                fprintf(stderr, "Error: --crack-rotors expects a rotor count from 1 to %d, got: %s\n", CRACK_MAX_ROTORS, argv[i]);
+                return 2;
+            }
+            crack_rotors = (size_t)n;
+            crack = 1;
+        } else if (strcmp(argv[i], "--shard") == 0 && i + 1 < argc) {
+            if (parse_shard(argv[++i], &shard, &shards) != 0) {
+                fprintf(stderr, "Error: --shard expects I/N with I from 0 to N - 1 and N up to %d, got: %s\n", CRACK_MAX_SHARDS, argv[i]);
+                return 2;
+            }
+            merge = 0;
+            crack = 1;
+        } else if (strcmp(argv[i], "--merge") == 0 && i + 1 < argc) {
+            char* end = NULL;
+            long n = strtol(argv[++i], &end, 10);
+            if (!end || *end != '\0' || n < 1 || n > CRACK_MAX_SHARDS) {
+                fprintf(stderr, "Error: --merge expects a shard count from 1 to %d, got: %s\n", CRACK_MAX_SHARDS, argv[i]);
+                return 2;
+            }
+            shards = (size_t)n;
+            merge = 1;
+            crack = 1;
+        } else if (strcmp(argv[i], "--work-dir") == 0 && i + 1 < argc) {
+            workdir = argv[++i];
+        } else if (strcmp(argv[i], "--crib") == 0 && i + 1 < argc) {
+            crib = argv[++i];
+            crack = 1;
+        } else if (strcmp(argv[i], "--crib-at") == 0 && i + 1 < argc) {
+            ++i;
+            if (parse_size(argv[i], argv[i] + strlen(argv[i]), &crib_at) != 0 || crib_at >= SIZE_MAX) {
+                fprintf(stderr, "Error: --crib-at expects a byte offset, got: %s\n", argv[i]);
+                return 2;
+            }
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchfile = argv[++i];
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            servefile = argv[++i];
+        } else if (strcmp(argv[i], "--tune") == 0) {
+            tune = 1;
+        } else if (strcmp(argv[i], "--compile-key") == 0 && i + 2 < argc) {
+            keyfile = argv[++i];
+            imagefile = argv[++i];
         } else if (strcmp(argv[i], "-d") == 0 || strcmp(argv[i], "--decrypt") == 0) {
             mode_encrypt = 0;
         } else if (strcmp(argv[i], "-h") == 0 || strcmp(argv[i], "--help") == 0) {
-            fprintf(stdout, "Usage: %s -i input.txt (-o output.txt) (-k keyfile | --reflector R --rotors W --rings R) [-d]\n", argv[0]);
+            fprintf(stdout, "Usage: %s -i input.txt (-o output.txt) (-k keyfile | --reflector R --rotors W --rings R) [-d] [-j threads] [--stream | --mmap | --buffered]\n"
+                            "       %s -i input.txt -o output.enc (key) --indexed [--block-size bytes] [-j threads]\n"
+                            "       %s -i input.enc (key) -d [--indexed | --range start:end] [-j threads]\n"
+                            "       %s -i input.enc --crack [--crack-rotors n] [-o out.key] [-j threads]\n"
+                            "       %s -i input.enc --crack (--shard I/N | --merge N) --work-dir dir [--crack-rotors n] [-o out.key] [-j threads]\n"
+                            "       %s -i input.enc --crib TEXT [--crib-at offset] [--crack-rotors n] [-o stops] [-j threads]\n"
+                            "       %s --batch manifest [-j threads]\n"
+                            "       %s --compile-key in.key out.keyc\n"
+                            "       %s --serve socket [-j threads]\n"
+                            "       %s --tune [-o profile]\n"
+                            "Use - as input or output file for stdin/stdout (implies --stream unless --mmap).\n"
+                            "--stream (the default) reads, enciphers and writes in overlapping chunks;\n"
+                            "--buffered loads the whole input first.\n"
+                            "--stats (or --stats=json) reports time per phase and character counts on stderr.\n"
+                            "A manifest lists one job per line: input key output [encrypt|decrypt]\n"
+                            "Compiled keys (.keyc) are accepted wherever a key file is.\n"
+                            "--indexed writes the ciphertext as blocks with an index of rotor states, so that\n"
+                            "-d --range deciphers just bytes [start, end) and -d -j deciphers blocks in parallel.\n"
+                            "--crack recovers the key of a ciphertext alone (3 rotors unless --crack-rotors) and\n"
+                            "writes it as a key file (to stdout without -o), on all processors unless -j.\n"
+                            "--crib finds the rotor settings (stops) under which the known plaintext TEXT can\n"
+                            "lie at byte --crib-at of the ciphertext (anywhere near its start without), with\n"
+                            "the plug pairs it implies, and writes the best of them as key files.\n"
+                            "--shard I/N runs part I of N of the --crack rotor search, for independent workers\n"
+                            "sharing a --work-dir; it saves its progress there and resumes from it when run\n"
+                            "again. --merge N then combines the N parts and finishes the search.\n"
+                            "--tune measures when period tables, vector kernels and threads pay off on this\n"
+                            "machine and saves the thresholds to $ENIGMA_PROFILE (~/" ENGINE_PROFILE_NAME " without -o),\n"
+                            "which later runs load to pick how each message is enciphered.\n",
+                            argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
             return -2;
         } else {
             fprintf(stderr, "Unknown argument: %s\n", argv[i]);
@@ -47,47 +250,155 @@ int load_config_from_args(int argc, char* argv[], Config* cfg, int* do_encrypt)
         }
     }
 
-    if (!infile) {
+    /* Everything from here on is measured */
+    cfg->stats = stats;
+    if (stats != STATS_OFF) stats_enable(1);
+
+    /* Tuning measures the machine: no input, no key */
+    if (tune) {
+        if (outfile) cfg->output_path = arena_strdup(&cfg->arena, outfile);
+        if (outfile && !cfg->output_path) { free_config(cfg); return 6; }
+        cfg->tune = 1;
+        *do_encrypt = mode_encrypt;
+        return 0;
+    }
+
+    /* Batch jobs and server requests bring their own files and keys */
+    if (batchfile || servefile) {
+        if (batchfile) cfg->batch_path = arena_strdup(&cfg->arena, batchfile);
+        if (servefile) cfg->serve_path = arena_strdup(&cfg->arena, servefile);
+        if ((batchfile && !cfg->batch_path) || (servefile && !cfg->serve_path)) { free_config(cfg); return 6; }
+        cfg->threads = threads;
+        *do_encrypt = mode_encrypt;
+        return 0;
+    }
+
+    /* Key compilation needs no input; the key is loaded below as usual */
+    if (!infile && !imagefile) {
         fprintf(stderr, "Input file is required (-i).\n");
         return 3;
     }
 
+    if ((shards != 0) != (workdir != NULL)) {
+        fprintf(stderr, "Error: %s\n", workdir ? "--work-dir needs --shard or --merge" : "--shard and --merge need a --work-dir");
+        return 2;
+    }
+    if (shards && crib) {
+        fprintf(stderr, "Error: --crib searches cannot be sharded\n");
+        return 2;
+    }
+    if (crib_at != UINT64_MAX && !crib) {
+        fprintf(stderr, "Error: --crib-at needs a --crib\n");
+        return 2;
+    }
+    if (crack && imagefile) {
+        fprintf(stderr, "Error: --compile-key cannot be combined with --crack or --crib\n");
+        return 2;
+    }
 
-    FILE* f = fopen(infile, "rb");
-    if (!f) { perror("fopen"); return 4; }
-    fseek(f, 0, SEEK_END);
-    long sz = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    if (sz < 0) { fclose(f); return 5; }
-    cfg->input = malloc((size_t)sz + 1);
-    if (!cfg->input) { fclose(f); return 6; }
-    if (fread(cfg->input, 1, (size_t)sz, f) != (size_t)sz) {
-        free(cfg->input); cfg->input = NULL; fclose(f); return 7;
+    /* Cracking loads the ciphertext and searches for the key instead of loading one */
+    if (crack) {
+        if (strcmp(infile, "-") == 0) {
+            fprintf(stderr, "Error: --crack reads the ciphertext from a file, not stdin\n");
+            return 2;
+        }
+        int rc = load_input_file(cfg, infile);
+        if (rc != 0) { free_config(cfg); return rc; }
+        if (outfile) cfg->output_path = arena_strdup(&cfg->arena, outfile);
+        if (outfile && !cfg->output_path) { free_config(cfg); return 6; }
+        cfg->crack = 1;
+        cfg->crack_rotors = crack_rotors;
+        if (crib) {
+            cfg->crib = arena_strdup(&cfg->arena, crib);
+            if (!cfg->crib) { free_config(cfg); return 6; }
+        }
+        cfg->crib_at = crib_at == UINT64_MAX ? SIZE_MAX : (size_t)crib_at;
+        if (workdir) {
+            cfg->work_dir = arena_strdup(&cfg->arena, workdir);
+            if (!cfg->work_dir) { free_config(cfg); return 6; }
+        }
+        cfg->shard = shard;
+        cfg->shards = shards;
+        cfg->merge = merge;
+        cfg->threads = threads_given ? threads : 0;
+        *do_encrypt = 0;
+        return 0;
+    }
+
+    if (ranged && mode_encrypt) {
+        fprintf(stderr, "Error: --range only applies when decrypting (-d)\n");
+        return 2;
+    }
+    if (indexed && !mode_encrypt && infile && strcmp(infile, "-") == 0) {
+        fprintf(stderr, "Error: indexed containers are read from a file, not stdin\n");
+        return 2;
+    }
+    /* Containers are read and written block by block */
+    if (indexed) io_mode = IO_STREAM;
+
+    /* Pipes cannot be loaded up front or mapped: stream them */
+    if (infile && strcmp(infile, "-") == 0) io_mode = IO_STREAM;
+    if (outfile && strcmp(outfile, "-") == 0 && io_mode == IO_BUFFERED) io_mode = IO_STREAM;
+    if (infile) {
+        cfg->input_path = arena_strdup(&cfg->arena, infile);
+        if (!cfg->input_path) { free_config(cfg); return 6; }
+    }
+    if (imagefile) {
+        cfg->image_path = arena_strdup(&cfg->arena, imagefile);
+        if (!cfg->image_path) { free_config(cfg); return 6; }
+        io_mode = IO_BUFFERED;
+    } else if (io_mode == IO_BUFFERED) {
+        int rc = load_input_file(cfg, infile);
+        if (rc != 0) { free_config(cfg); return rc; }
     }
-    cfg->input[sz] = '\0';
-    fclose(f);
 
 
+    /* Compiled images keep every table, whatever they are used for later */
+    uint64_t size = imagefile ? ENGINE_SIZE_UNKNOWN : message_size(infile, range_begin, range_end);
     if (keyfile) {
-        cfg->key = parse_key_file(keyfile);
+        cfg->key = load_key_file_for(keyfile, size);
         if (!cfg->key) { free_config(cfg); return 8; }
     } else {
         // must at least provide rotors/rings/reflector via args
-        cfg->key = parse_key_components(reflector, rotors, rings, plugboard);
+        cfg->key = parse_key_components_for(reflector, rotors, rings, plugboard, size);
         if (!cfg->key) { free_config(cfg); return 9; }
     }
 
-    if (outfile) cfg->output_path = strdup(outfile);
+    cfg->state = cfg->key->start;
+    if (outfile) cfg->output_path = arena_strdup(&cfg->arena, outfile);
 
     cfg->out_buffer = NULL;
+    cfg->threads = threads;
+    cfg->io_mode = io_mode;
+    cfg->indexed = indexed;
+    cfg->block_size = (size_t)block_size;
+    cfg->range_begin = range_begin;
+    cfg->range_end = range_end;
     *do_encrypt = mode_encrypt;
     return 0;
 }
 
 void free_config(Config* cfg) {
     if (!cfg) return;
-    if (cfg->input) { free(cfg->input); cfg->input = NULL; }
-    if (cfg->out_buffer) { free(cfg->out_buffer); cfg->out_buffer = NULL; }
-    if (cfg->output_path) { free(cfg->output_path); cfg->output_path = NULL; }
     if (cfg->key) { free_key(cfg->key); cfg->key = NULL; }
+    arena_free(&cfg->arena);
+    cfg->input = NULL;
+    cfg->out_buffer = NULL;
+    cfg->output_path = NULL;
+    cfg->input_path = NULL;
+    cfg->batch_path = NULL;
+    cfg->image_path = NULL;
+    cfg->serve_path = NULL;
+}
+
+int same_file_path(const char* a, const char* b) {
+    if (!a || !b || strcmp(a, "-") == 0 || strcmp(b, "-") == 0) return 0;
+#ifdef WIN32
+    /* No inode numbers: compare the absolute paths */
+    char full_a[_MAX_PATH], full_b[_MAX_PATH];
+    return _fullpath(full_a, a, sizeof(full_a)) && _fullpath(full_b, b, sizeof(full_b)) && _stricmp(full_a, full_b) == 0;
+#else
+    struct stat sa, sb;
+    return stat(a, &sa) == 0 && stat(b, &sb) == 0 && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+#endif
 }
@@ -0,0 +1,280 @@
+#include "../include/container.h"
+#include "../include/encrypt.h"
+#include "../include/key-compiler.h"
+#include "../include/stats.h"
+#include "../include/thread-pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* The blocks of one pass: data holds them back to back, entries[i] belongs to block i */
+typedef struct BlockBatch {
+    const CompiledKey* ck;
+    char* data;
+    size_t len;                         // bytes in data
+    size_t block_size;
+    ContainerIndexEntry* entries;
+} BlockBatch;
+
+static size_t block_len(const BlockBatch* b, size_t i) {
+    size_t begin = i * b->block_size;
+    return b->len - begin < b->block_size ? b->len - begin : b->block_size;
+}
+
+static void count_block(void* arg, size_t i) {
+    BlockBatch* b = arg;
+    b->entries[i].letters = count_letters(b->data + i * b->block_size, block_len(b, i));
+}
+
+/* Encipher block i in place from the rotor state in its index entry */
+static void cipher_block(void* arg, size_t i) {
+    BlockBatch* b = arg;
+    RotorState state = b->entries[i].state;
+    char* p = b->data + i * b->block_size;
+    encrypt_buffer(b->ck, &state, p, p, block_len(b, i));
+}
+
+static void run_blocks(ThreadPool* pool, size_t count, ThreadPoolTask task, BlockBatch* b) {
+    if (pool) thread_pool_run(pool, count, task, b);
+    else for (size_t i = 0; i < count; ++i) task(b, i);
+}
+
+static uint64_t index_checksum(const ContainerIndexEntry* index, size_t count) {
+    const unsigned char* p = (const unsigned char*)index;
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < count * sizeof(*index); ++i) h = (h ^ p[i]) * 1099511628211ull;
+    return h;
+}
+
+/* 64-bit file positions on every platform */
+static int seek_file(FILE* f, int64_t offset, int whence) {
+#ifdef WIN32
+    return _fseeki64(f, offset, whence);
+#else
+    return fseeko(f, (off_t)offset, whence);
+#endif
+}
+
+static int64_t tell_file(FILE* f) {
+#ifdef WIN32
+    return _ftelli64(f);
+#else
+    return (int64_t)ftello(f);
+#endif
+}
+
+static size_t read_data(FILE* in, char* buf, size_t size) {
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
+    size_t got = fread(buf, 1, size, in);
+    if (STATS_ON) {
+        stats_add_time(STATS_READ, t0);
+        stats_add_bytes(got, 0);
+    }
+    return got;
+}
+
+static int write_data(FILE* out, const void* buf, size_t len) {
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
+    int rc = fwrite(buf, 1, len, out) != len;
+    if (rc) perror("fwrite");
+    if (STATS_ON) {
+        stats_add_time(STATS_WRITE, t0);
+        stats_add_bytes(0, len);
+    }
+    return rc;
+}
+
+static ThreadPool* create_pool(const Config* config, size_t* batch_blocks) {
+    ThreadPool* pool = config->threads > 1 ? thread_pool_create(config->threads) : NULL;
+    *batch_blocks = (pool ? thread_pool_size(pool) : 1) * CONTAINER_BATCH_BLOCKS;
+    return pool;
+}
+
+int write_container(Config* config, FILE* in, FILE* out, size_t block_size) {
+    if (!config || !config->key || !in || !out) return 1;
+    const Key* k = config->key;
+    if (!k->compiled) return 2;
+    if (block_size == 0) block_size = CONTAINER_BLOCK_SIZE;
+
+    ContainerHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, CONTAINER_MAGIC, sizeof(h.magic));
+    h.version = CONTAINER_VERSION;
+    h.byte_order = CONTAINER_BYTE_ORDER;
+    h.block_size = block_size;
+    h.rotor_count = (uint32_t)k->rotor_count;
+
+    size_t batch_blocks;
+    ThreadPool* pool = create_pool(config, &batch_blocks);
+    size_t batch_bytes = batch_blocks * block_size;
+    BlockBatch b = { k->compiled, malloc(batch_bytes), 0, block_size, NULL };
+    ContainerIndexEntry* index = NULL;
+    size_t count = 0, capacity = 0;
+    uint64_t data_size = 0;
+
+    int rc = b.data ? 0 : 3;
+    if (rc == 0 && write_data(out, &h, sizeof(h)) != 0) rc = 4;
+    while (rc == 0) {
+        /* Only the last pass may end in a partial block: fread fills all but the last */
+        b.len = read_data(in, b.data, batch_bytes);
+        if (b.len == 0) break;
+        size_t blocks = (b.len + block_size - 1) / block_size;
+        if (count + blocks > capacity) {
+            size_t grown = capacity ? 2 * capacity : batch_blocks;
+            while (grown < count + blocks) grown *= 2;
+            ContainerIndexEntry* p = realloc(index, grown * sizeof(*index));
+            if (!p) { rc = 3; break; }
+            index = p;
+            capacity = grown;
+        }
+
+        /* Letters per block give every block's start state; then all blocks at once */
+        b.entries = index + count;
+        memset(b.entries, 0, blocks * sizeof(*b.entries));
+        run_blocks(pool, blocks, count_block, &b);
+        for (size_t i = 0; i < blocks; ++i) {
+            b.entries[i].offset = sizeof(h) + data_size + i * block_size;
+            b.entries[i].state = config->state;
+            seek_rotors(k->compiled, config->state.positions, b.entries[i].letters);
+        }
+        run_blocks(pool, blocks, cipher_block, &b);
+
+        if (write_data(out, b.data, b.len) != 0) rc = 4;
+        count += blocks;
+        data_size += b.len;
+        if (b.len < batch_bytes) break;
+    }
+    if (rc == 0 && ferror(in)) { perror("fread"); rc = 5; }
+
+    if (rc == 0) {
+        ContainerTrailer t;
+        memset(&t, 0, sizeof(t));
+        t.index_offset = sizeof(h) + data_size;
+        t.block_count = count;
+        t.data_size = data_size;
+        t.checksum = index_checksum(index, count);
+        memcpy(t.magic, CONTAINER_MAGIC, sizeof(t.magic));
+        if ((count && write_data(out, index, count * sizeof(*index)) != 0) || write_data(out, &t, sizeof(t)) != 0) rc = 4;
+    }
+    if (rc == 0 && fflush(out) != 0) { perror("fflush"); rc = 4; }
+
+    free(index);
+    free(b.data);
+    thread_pool_destroy(pool);
+    return rc;
+}
+
+/* Read and check header, trailer and index of the container f. Returns 0 on success. */
+static int read_index(FILE* f, size_t rotor_count, ContainerHeader* h, ContainerTrailer* t, ContainerIndexEntry** index) {
+    if (fread(h, sizeof(*h), 1, f) != 1 || memcmp(h->magic, CONTAINER_MAGIC, sizeof(h->magic)) != 0) {
+        fprintf(stderr, "Error: not an indexed container\n");
+        return 11;
+    }
+    if (h->version != CONTAINER_VERSION || h->byte_order != CONTAINER_BYTE_ORDER || h->block_size == 0 || h->block_size > SIZE_MAX / CONTAINER_BATCH_BLOCKS) {
+        fprintf(stderr, "Error: unsupported container (version %u)\n", (unsigned)h->version);
+        return 11;
+    }
+    if (h->rotor_count != rotor_count) {
+        fprintf(stderr, "Error: the container was written with a %u rotor key, this key has %zu\n", (unsigned)h->rotor_count, rotor_count);
+        return 12;
+    }
+
+    int64_t size = seek_file(f, 0, SEEK_END) == 0 ? tell_file(f) : -1;
+    if (size < 0) {
+        fprintf(stderr, "Error: indexed containers must be read from a seekable file\n");
+        return 11;
+    }
+    if ((uint64_t)size < sizeof(*h) + sizeof(*t) || seek_file(f, size - (int64_t)sizeof(*t), SEEK_SET) != 0 ||
+        fread(t, sizeof(*t), 1, f) != 1 || memcmp(t->magic, CONTAINER_MAGIC, sizeof(t->magic)) != 0) {
+        fprintf(stderr, "Error: the container is truncated\n");
+        return 11;
+    }
+
+    /* The blocks fill the file up to the index, which fills it up to the trailer */
+    uint64_t blocks = t->data_size / h->block_size + (t->data_size % h->block_size != 0);
+    if (t->index_offset != sizeof(*h) + t->data_size || t->index_offset > (uint64_t)size || t->block_count != blocks ||
+        t->block_count > ((uint64_t)size - t->index_offset) / sizeof(**index) ||
+        t->index_offset + t->block_count * sizeof(**index) + sizeof(*t) != (uint64_t)size) {
+        fprintf(stderr, "Error: the container's index does not match its size\n");
+        return 11;
+    }
+
+    size_t count = (size_t)t->block_count;
+    *index = count ? malloc(count * sizeof(**index)) : NULL;
+    if (count && !*index) return 3;
+    if (count && (seek_file(f, (int64_t)t->index_offset, SEEK_SET) != 0 || fread(*index, sizeof(**index), count, f) != count)) {
+        fprintf(stderr, "Error: cannot read the container's index\n");
+        return 11;
+    }
+    if (index_checksum(*index, count) != t->checksum) {
+        fprintf(stderr, "Error: the container's index is corrupt\n");
+        return 11;
+    }
+    /* Start states index the rotor tables: the checksum alone does not make them safe */
+    for (size_t i = 0; i < count; ++i) {
+        const ContainerIndexEntry* e = &(*index)[i];
+        int bad = e->offset != sizeof(*h) + i * h->block_size || e->letters > h->block_size;
+        for (size_t r = 0; r < rotor_count; ++r) bad |= e->state.positions[r] >= 26;
+        if (bad) {
+            fprintf(stderr, "Error: the container's index is corrupt\n");
+            return 11;
+        }
+    }
+    return 0;
+}
+
+int read_container(Config* config, const char* path, uint64_t begin, uint64_t end, FILE* out) {
+    if (!config || !config->key || !path || !out) return 1;
+    const Key* k = config->key;
+    if (!k->compiled) return 2;
+
+    FILE* f = fopen(path, "rb");
+    if (!f) { perror(path); return 4; }
+    ContainerHeader h;
+    ContainerTrailer t;
+    ContainerIndexEntry* index = NULL;
+    int rc = read_index(f, k->rotor_count, &h, &t, &index);
+    if (rc == 0) {
+        if (end > t.data_size) end = t.data_size;
+        if (begin > end) {
+            fprintf(stderr, "Error: the range starts past the end of the message (%llu bytes)\n", (unsigned long long)t.data_size);
+            rc = 10;
+        }
+    }
+
+    ThreadPool* pool = NULL;
+    BlockBatch b = { k->compiled, NULL, 0, 0, NULL };
+    if (rc == 0 && begin < end) {
+        size_t batch_blocks;
+        pool = create_pool(config, &batch_blocks);
+        b.block_size = (size_t)h.block_size;
+        b.data = malloc(batch_blocks * b.block_size);
+        if (!b.data) rc = 3;
+
+        /* Whole blocks are deciphered; only the part inside the range is written */
+        uint64_t first = begin / h.block_size, last = (end - 1) / h.block_size;
+        for (uint64_t block = first; rc == 0 && block <= last; block += batch_blocks) {
+            size_t blocks = last - block + 1 < batch_blocks ? (size_t)(last - block + 1) : batch_blocks;
+            uint64_t from = block * h.block_size;
+            b.len = t.data_size - from < blocks * h.block_size ? (size_t)(t.data_size - from) : blocks * b.block_size;
+            if (seek_file(f, (int64_t)index[block].offset, SEEK_SET) != 0 || read_data(f, b.data, b.len) != b.len) {
+                fprintf(stderr, "Error: cannot read block %llu of the container\n", (unsigned long long)block);
+                rc = 5;
+                break;
+            }
+            b.entries = index + block;
+            run_blocks(pool, blocks, cipher_block, &b);
+
+            size_t skip = begin > from ? (size_t)(begin - from) : 0;
+            size_t stop = end - from < b.len ? (size_t)(end - from) : b.len;
+            if (write_data(out, b.data + skip, stop - skip) != 0) rc = 4;
+        }
+    }
+    if (rc == 0 && fflush(out) != 0) { perror("fflush"); rc = 4; }
+
+    free(b.data);
+    free(index);
+    thread_pool_destroy(pool);
+    fclose(f);
+    return rc;
+}
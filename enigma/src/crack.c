@@ -0,0 +1,1182 @@
+#include "../include/crack.h"
+#include "../include/encrypt-simd.h"
+#include "../include/key-compiler.h"
+#include "../include/key-parser.h"
+#include "../include/stats.h"
+#include "../include/thread-pool.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* English bigram log-probabilities (natural log, times 100), counted over half a million
+   letters of prose written as the machine sees it: letters only, X for every space */
+static const short BIGRAMS[26][26] = {
+    /* A */ {-1118, -689, -564, -644, -1149, -776, -705, -1132, -661, -1067, -711, -526, -643, -422, -1194, -652, -1027, -501, -521, -482, -785, -726, -844, -579, -606, -1149},
+    /* B */ {-862, -892, -925, -988, -530, -1194, -1228, -1027, -780, -830, -1388, -619, -1169, -1169, -633, -1388, -1279, -726, -728, -957, -690, -1228, -1388, -841, -584, -1388},
+    /* C */ {-650, -1008, -768, -1022, -550, -1118, -1169, -563, -641, -1132, -696, -703, -1388, -1094, -516, -1132, -1118, -742, -1033, -560, -691, -1388, -1388, -791, -1039, -1388},
+    /* D */ {-816, -1169, -1075, -811, -552, -1194, -861, -1067, -553, -1105, -1132, -821, -984, -1149, -708, -1228, -1169, -834, -739, -871, -808, -1105, -1228, -401, -830, -1388},
+    /* E */ {-553, -859, -583, -503, -599, -566, -740, -959, -622, -1118, -865, -625, -651, -487, -861, -736, -746, -430, -470, -579, -1169, -721, -784, -313, -668, -1149},
+    /* F */ {-692, -1279, -1228, -1388, -689, -740, -977, -1279, -618, -1388, -1194, -674, -1084, -1279, -589, -1388, -1194, -566, -1149, -742, -836, -1388, -1388, -450, -1022, -1388},
+    /* G */ {-790, -1388, -1388, -1118, -617, -1279, -940, -582, -716, -1388, -1228, -650, -977, -854, -774, -1388, -1132, -632, -757, -855, -784, -1388, -1388, -551, -1094, -1388},
+    /* H */ {-521, -1169, -1388, -901, -360, -1169, -1279, -1388, -524, -1149, -1279, -1084, -999, -944, -616, -1228, -1228, -722, -971, -607, -827, -1388, -1279, -507, -884, -1279},
+    /* I */ {-743, -698, -562, -621, -653, -642, -585, -1279, -892, -1388, -801, -610, -646, -419, -539, -860, -805, -570, -506, -492, -806, -710, -1388, -621, -1388, -947},
+    /* J */ {-1045, -1388, -1388, -1388, -816, -1388, -1388, -1388, -1388, -1388, -1194, -1388, -1388, -1388, -1033, -1388, -1388, -1388, -1388, -1228, -1027, -1388, -1388, -1017, -1388, -1388},
+    /* K */ {-1149, -1279, -1279, -1169, -685, -1279, -1279, -1169, -797, -1388, -1228, -1059, -1194, -756, -1075, -1279, -1169, -1279, -857, -1228, -1388, -1388, -1194, -674, -1169, -1388},
+    /* L */ {-576, -1388, -1067, -715, -502, -825, -1017, -1388, -552, -1228, -1094, -542, -940, -1084, -569, -952, -1388, -1094, -730, -788, -660, -832, -977, -535, -612, -1388},
+    /* M */ {-583, -801, -1084, -949, -541, -974, -1149, -1228, -632, -1388, -1228, -1094, -856, -940, -616, -713, -1279, -1094, -757, -1105, -736, -1279, -1388, -554, -884, -1388},
+    /* N */ {-709, -1105, -564, -454, -542, -817, -510, -1279, -683, -1169, -999, -818, -1022, -789, -601, -1052, -1084, -1149, -569, -543, -769, -836, -995, -430, -711, -1388},
+    /* O */ {-812, -674, -812, -692, -921, -461, -776, -1017, -757, -1194, -811, -567, -570, -467, -734, -651, -1388, -505, -605, -567, -509, -745, -615, -495, -1052, -1194},
+    /* P */ {-577, -1279, -1279, -1022, -561, -1279, -1169, -784, -766, -1388, -1388, -668, -1279, -1169, -589, -687, -1084, -598, -901, -755, -802, -1388, -1052, -743, -1388, -1388},
+    /* Q */ {-1388, -1388, -1132, -1388, -1228, -1228, -1279, -1388, -1279, -1388, -1194, -1388, -1279, -1194, -1388, -1388, -1279, -999, -1388, -1228, -657, -1388, -1388, -864, -1388, -1388},
+    /* R */ {-512, -929, -708, -653, -426, -760, -774, -1003, -555, -1094, -816, -830, -725, -790, -544, -781, -1228, -828, -590, -588, -759, -743, -891, -441, -678, -1388},
+    /* S */ {-676, -1279, -744, -1003, -509, -1045, -1194, -667, -577, -1388, -981, -830, -672, -1118, -596, -656, -907, -1388, -578, -525, -611, -1105, -944, -374, -885, -1388},
+    /* T */ {-611, -1388, -981, -1388, -496, -1388, -925, -336, -506, -1279, -1388, -726, -911, -1008, -522, -1118, -1084, -621, -611, -687, -691, -1132, -685, -399, -727, -1228},
+    /* U */ {-689, -764, -674, -880, -683, -878, -714, -1388, -768, -1388, -1228, -649, -664, -637, -869, -684, -1388, -554, -626, -601, -991, -1194, -1388, -849, -1279, -1279},
+    /* V */ {-710, -1388, -1388, -1084, -560, -1388, -1388, -1388, -675, -1388, -1388, -1388, -1388, -1194, -918, -1388, -1388, -1388, -1194, -1149, -1059, -1388, -1279, -898, -1118, -1388},
+    /* W */ {-617, -1388, -1388, -892, -639, -1388, -1388, -546, -600, -1388, -1388, -1017, -1075, -829, -701, -1279, -1388, -1022, -844, -1169, -1388, -1388, -1169, -660, -1388, -1388},
+    /* X */ {-379, -449, -489, -534, -557, -499, -586, -591, -424, -954, -789, -530, -507, -596, -407, -480, -758, -488, -454, -328, -645, -619, -468, -775, -705, -1075},
+    /* Y */ {-1169, -1194, -1169, -1027, -697, -1149, -1228, -1228, -912, -1388, -1194, -1059, -1059, -1228, -848, -1003, -1388, -1194, -649, -1388, -1388, -1388, -1388, -460, -1388, -1279},
+    /* Z */ {-1169, -1388, -1388, -1279, -1033, -1388, -1388, -1388, -1149, -1388, -1388, -1279, -1388, -1388, -1045, -1388, -1388, -1388, -1388, -1388, -1228, -1388, -1388, -999, -1279, -1388},
+};
+
+/* a - b mod 26 for a and b in 0-25, without a division */
+static inline int offset26(int a, int b) {
+    int d = a - b;
+    return d < 0 ? d + 26 : d;
+}
+
+/*
+ * A machine of one reflector and rotor order, for trial decryptions of the ciphertext
+ * at any ring setting. Ring settings are the start positions, so every rotor starts at
+ * offset 0 (position minus ring) and the substitution only depends on the offsets: the
+ * rings just decide when the rotors turn over. Tables are indexed by offset.
+ */
+typedef struct TrialMachine {
+    size_t rotor_count;
+    unsigned char notches[CRACK_MAX_ROTORS];
+    const unsigned char (*forward[CRACK_MAX_ROTORS])[26];      // forward[i][offset][in]: rows of shifted_rotors()
+    const unsigned char (*backward[CRACK_MAX_ROTORS])[26];
+    const unsigned char* reflector;
+    unsigned char entry[26][26];        // entry[offset][in]: plugboard then fast rotor
+    unsigned char exit[26][26];         // exit[offset][in]: fast rotor inverse then plugboard
+    unsigned char (*inner)[26];         // slow rotors and reflector by their offsets in base 26,
+    unsigned char* built;               // each built on first use
+    const unsigned char* letters;       // the ciphertext's letter indices
+    size_t len;
+    unsigned char* entered;             // letters through the entry tables (see set_plugboard)
+    unsigned char* out;                 // output of the last trial
+} TrialMachine;
+
+/* Rotor settings and plugboard under test, with their scores */
+typedef struct Candidate {
+    unsigned char reflector;
+    unsigned char rotors[CRACK_MAX_ROTORS];
+    unsigned char rings[CRACK_MAX_ROTORS];
+    unsigned char plugboard[26];
+    int64_t coincidences;               // letter pairs with equal letters: IoC times len * (len - 1)
+    int64_t score;                      // sum of BIGRAMS over the deciphered text
+} Candidate;
+
+/* Number of combinations of the slow rotors' offsets (or of the searched rings): 26^(n-1) */
+static size_t slow_states(size_t n) {
+    size_t s = 1;
+    for (size_t i = 1; i < n; ++i) s *= 26;
+    return s;
+}
+
+/* Rotor types of rotor order k out of the 8!/(8-n)! orders of n distinct rotors */
+static void rotor_order(size_t k, size_t n, unsigned char* rotors) {
+    unsigned char left[ROTOR_TYPES];
+    for (int t = 0; t < ROTOR_TYPES; ++t) left[t] = (unsigned char)t;
+    for (size_t i = 0; i < n; ++i) {
+        size_t choices = ROTOR_TYPES - i;
+        size_t pick = k % choices;
+        k /= choices;
+        rotors[i] = left[pick];
+        memmove(left + pick, left + pick + 1, choices - pick - 1);
+    }
+}
+
+/* Fold the plugboard into the fast rotor's tables. The fast rotor's offset at letter t
+   is (t + 1) % 26 whatever the rings, so the entry lookups of the whole ciphertext are
+   done here once for all ring settings. */
+static void set_plugboard(TrialMachine* m, const unsigned char plugboard[26]) {
+    for (int o = 0; o < 26; ++o) {
+        for (int v = 0; v < 26; ++v) {
+            m->entry[o][v] = m->forward[0][o][plugboard[v]];
+            m->exit[o][v] = plugboard[m->backward[0][o][v]];
+        }
+    }
+    for (size_t t = 0, fast = 1; t < m->len; ++t, fast = fast == 25 ? 0 : fast + 1) m->entered[t] = m->entry[fast][m->letters[t]];
+}
+
+static int setup_machine(TrialMachine* m, const Candidate* c, size_t n, const unsigned char* letters, size_t len) {
+    const ShiftedRotors* table = shifted_rotors();
+    m->rotor_count = n;
+    for (size_t i = 0; i < n; ++i) {
+        m->notches[i] = ROTOR_NOTCHES[c->rotors[i]] % 26;
+        m->forward[i] = table->forward[c->rotors[i]];
+        m->backward[i] = table->backward[c->rotors[i]];
+    }
+    m->reflector = table->reflectors[c->reflector];
+
+    size_t states = slow_states(n);
+    m->inner = malloc(states * sizeof(*m->inner));
+    m->built = calloc(states, 1);
+    m->letters = letters;
+    m->len = len;
+    m->entered = malloc(2 * len);
+    m->out = m->entered ? m->entered + len : NULL;
+    if (!m->inner || !m->built || !m->entered) return 1;
+    set_plugboard(m, c->plugboard);
+    return 0;
+}
+
+static void free_machine(TrialMachine* m) {
+    free(m->inner);
+    free(m->built);
+    free(m->entered);
+}
+
+static void build_inner(TrialMachine* m, size_t code) {
+    unsigned char offsets[CRACK_MAX_ROTORS];
+    size_t n = m->rotor_count;
+    for (size_t i = 1, rest = code; i < n; ++i, rest /= 26) offsets[i] = (unsigned char)(rest % 26);
+    for (int c = 0; c < 26; ++c) {
+        int v = c;
+        for (size_t i = 1; i < n; ++i) v = m->forward[i][offsets[i]][v];
+        v = m->reflector[v];
+        for (size_t i = n; i-- > 1;) v = m->backward[i][offsets[i]][v];
+        m->inner[code][c] = (unsigned char)v;
+    }
+    m->built[code] = 1;
+}
+
+/* The slow rotors' offsets as a base 26 number */
+static FORCE_INLINE size_t slow_code(const unsigned char* positions, const unsigned char* rings, size_t n) {
+    size_t code = 0;
+    for (size_t i = n; i-- > 1;) code = code * 26 + (size_t)offset26(positions[i], rings[i]);
+    return code;
+}
+
+static FORCE_INLINE const unsigned char* slow_table(TrialMachine* m, const unsigned char* positions, const unsigned char* rings, size_t n) {
+    size_t code = slow_code(positions, rings, n);
+    if (!m->built[code]) build_inner(m, code);
+    return m->inner[code];
+}
+
+/* Letters from the one just stepped for up to the fast rotor's next notch, out of
+   `left`: between two engagements of a pawl only the fast rotor moves, so they all go
+   through the same inner table. A slow rotor waiting at its notch engages next. */
+static FORCE_INLINE size_t run_length(const TrialMachine* m, const unsigned char* positions, size_t left, size_t n) {
+    if (n < 2) return left;
+    int waiting = 0;
+    for (size_t i = 1; i + 1 < n; ++i) waiting |= positions[i] == m->notches[i];
+    size_t free_steps = waiting ? 0 : (size_t)offset26(m->notches[0], positions[0]);
+    return free_steps + 1 < left ? free_steps + 1 : left;
+}
+
+/* The start of one run of decipher(): before the step for letter t */
+typedef struct TrialPoint {
+    size_t t;
+    unsigned short code;                // slow_code() after the step
+    unsigned short run;                 // letters of the run
+    unsigned short counts[26];          // output letters before t (CRACK_MAX_LETTERS fits)
+} TrialPoint;
+
+/*
+ * Decipher the entered letters from letter t on, with the given rings and rotor
+ * positions before the step for letter t (updated), into m->out or (when counts is
+ * given) just adding up the output letters. With points, the start of every run is
+ * recorded there (with counts); returns the number of runs.
+ */
+static FORCE_INLINE size_t decipher(TrialMachine* m, const unsigned char* rings, unsigned char* positions, size_t t, size_t n,
+                                    uint32_t* counts, TrialPoint* points) {
+    const unsigned char* inner = slow_table(m, positions, rings, n);
+    const unsigned char* entered = m->entered;
+    unsigned char* out = m->out;
+    size_t len = m->len;
+    size_t runs = 0;
+    int fast = (int)(t % 26);
+    while (t < len) {
+        if (step_positions(m->notches, n, positions)) inner = slow_table(m, positions, rings, n);
+        size_t run = run_length(m, positions, len - t, n);
+        if (points) {
+            TrialPoint* p = &points[runs];
+            p->t = t;
+            p->code = (unsigned short)slow_code(positions, rings, n);
+            p->run = (unsigned short)run;
+            for (int v = 0; v < 26; ++v) p->counts[v] = (unsigned short)counts[v];
+        }
+        ++runs;
+        positions[0] = (unsigned char)((positions[0] + run - 1) % 26);
+        for (size_t end = t + run; t < end; ++t) {
+            fast = fast == 25 ? 0 : fast + 1;
+            unsigned char v = m->exit[fast][inner[entered[t]]];
+            if (counts) counts[v]++;
+            else out[t] = v;
+        }
+    }
+    return runs;
+}
+
+/*
+ * Trials with the same fast ring step alike until the first run where their slow
+ * rotors differ (a double step comes earlier or later): follow the runs of a trial
+ * against the recorded runs of another and return the first that differs, with the
+ * positions before it. Returns `count` if all runs are the same, and so the output.
+ */
+static size_t diverging_run(const TrialMachine* m, const unsigned char* rings, unsigned char* positions, const TrialPoint* points, size_t count, size_t n) {
+    memcpy(positions, rings, n);
+    for (size_t j = 0; j < count; ++j) {
+        unsigned char p[CRACK_MAX_ROTORS];
+        memcpy(p, positions, n);
+        step_positions(m->notches, n, p);
+        size_t run = run_length(m, p, m->len - points[j].t, n);
+        if (slow_code(p, rings, n) != points[j].code || run != points[j].run) return j;
+        memcpy(positions, p, n);
+        positions[0] = (unsigned char)((positions[0] + run - 1) % 26);
+    }
+    return count;
+}
+
+static int64_t coincidences(const uint32_t counts[26]) {
+    int64_t sum = 0;
+    for (int v = 0; v < 26; ++v) sum += (int64_t)counts[v] * ((int64_t)counts[v] - 1);
+    return sum;
+}
+
+static int64_t bigram_score(const unsigned char* text, size_t len) {
+    int64_t sum = 0;
+    for (size_t t = 1; t < len; ++t) sum += BIGRAMS[text[t - 1]][text[t]];
+    return sum;
+}
+
+enum { SCORE_COINCIDENCES, SCORE_BIGRAMS };
+
+/* Rotor loops unrolled for every rotor count */
+static FORCE_INLINE size_t decipher_unrolled(TrialMachine* m, const unsigned char* rings, unsigned char* positions, size_t t,
+                                             uint32_t* counts, TrialPoint* points) {
+    switch (m->rotor_count) {
+    case 1: return decipher(m, rings, positions, t, 1, counts, points);
+    case 2: return decipher(m, rings, positions, t, 2, counts, points);
+    case 3: return decipher(m, rings, positions, t, 3, counts, points);
+    default: return decipher(m, rings, positions, t, 4, counts, points);
+    }
+}
+
+/* Decipher with the given rings and score the output */
+static int64_t score_trial(TrialMachine* m, const unsigned char* rings, int kind) {
+    unsigned char positions[CRACK_MAX_ROTORS];
+    memcpy(positions, rings, m->rotor_count);
+    if (kind == SCORE_BIGRAMS) {
+        decipher_unrolled(m, rings, positions, 0, NULL, NULL);
+        return bigram_score(m->out, m->len);
+    }
+    uint32_t counts[26] = {0};
+    decipher_unrolled(m, rings, positions, 0, counts, NULL);
+    return coincidences(counts);
+}
+
+/* Ring settings number r of the search: base 26 digits for all rotors but the slowest */
+static void ring_setting(size_t r, size_t n, unsigned char* rings) {
+    for (size_t i = 0; i + 1 < n; ++i, r /= 26) rings[i] = (unsigned char)(r % 26);
+    rings[n - 1] = 0;
+}
+
+typedef struct CrackSearch {
+    const unsigned char* letters;
+    size_t len;
+    size_t rotor_count;
+    size_t orders;                      // rotor orders per reflector
+    size_t first_task;                  // task of the rotor search's first kept list
+    Candidate* kept;                    // CRACK_KEEP_PER_ORDER per task of the rotor search
+    Candidate* candidates;              // input and output of the plugboard search
+    int failed;                         // a task could not allocate its tables
+} CrackSearch;
+
+/* Add c to the list of the best `size`, sorted best first (empty places have
+   coincidences -1) */
+static void keep_candidate(Candidate* kept, size_t size, const Candidate* c) {
+    size_t k = size;
+    while (k > 0 && c->coincidences > kept[k - 1].coincidences) --k;
+    if (k == size) return;
+    memmove(kept + k + 1, kept + k, (size - k - 1) * sizeof(*kept));
+    kept[k] = *c;
+}
+
+static void clear_candidates(Candidate* list, size_t count) {
+    memset(list, 0, count * sizeof(*list));
+    for (size_t i = 0; i < count; ++i) list[i].coincidences = -1;
+}
+
+/* Rotor search task: all ring settings of one reflector and rotor order. The first
+   trial of every fast ring records its runs, the others only decipher from where
+   they start to differ from it. */
+static void search_order(void* arg, size_t index) {
+    CrackSearch* s = arg;
+    size_t n = s->rotor_count;
+    size_t task = s->first_task + index;
+    Candidate* kept = s->kept + index * CRACK_KEEP_PER_ORDER;
+
+    Candidate c;
+    memset(&c, 0, sizeof(c));
+    c.reflector = (unsigned char)(task / s->orders);
+    rotor_order(task % s->orders, n, c.rotors);
+    for (int v = 0; v < 26; ++v) c.plugboard[v] = (unsigned char)v;
+
+    TrialMachine m;
+    TrialPoint* points = malloc(s->len * sizeof(*points));        // a run has at least one letter
+    if (setup_machine(&m, &c, n, s->letters, s->len) != 0 || !points) {
+        free(points);
+        free_machine(&m);
+        s->failed = 1;
+        return;
+    }
+    size_t fast_rings = n > 1 ? 26 : 1;
+    size_t others = slow_states(n) / fast_rings;
+    for (size_t fast_ring = 0; fast_ring < fast_rings; ++fast_ring) {
+        size_t count = 0;
+        for (size_t other = 0; other < others; ++other) {
+            unsigned char positions[CRACK_MAX_ROTORS];
+            uint32_t counts[26] = {0};
+            ring_setting(fast_ring + fast_rings * other, n, c.rings);
+            if (other == 0) {
+                memcpy(positions, c.rings, n);
+                count = decipher_unrolled(&m, c.rings, positions, 0, counts, points);
+            } else {
+                size_t j = diverging_run(&m, c.rings, positions, points, count, n);
+                if (j == count) continue;                       // the same output as the first
+                for (int v = 0; v < 26; ++v) counts[v] = points[j].counts[v];
+                decipher_unrolled(&m, c.rings, positions, points[j].t, counts, NULL);
+            }
+            c.coincidences = coincidences(counts);
+            keep_candidate(kept, CRACK_KEEP_PER_ORDER, &c);
+        }
+    }
+    free(points);
+    free_machine(&m);
+}
+
+static int plug_pairs(const unsigned char plugboard[26]) {
+    int pairs = 0;
+    for (int v = 0; v < 26; ++v) pairs += plugboard[v] > v;
+    return pairs;
+}
+
+/* Connect a and b, unplugging whatever they were connected to; or disconnect them
+   if they already were connected to each other */
+static void swap_plugs(unsigned char plugboard[26], int a, int b) {
+    if (plugboard[a] == b) {
+        plugboard[a] = (unsigned char)a;
+        plugboard[b] = (unsigned char)b;
+        return;
+    }
+    plugboard[plugboard[a]] = plugboard[a];
+    plugboard[plugboard[b]] = plugboard[b];
+    plugboard[a] = (unsigned char)b;
+    plugboard[b] = (unsigned char)a;
+}
+
+/* Try every change of one plug pair and keep those that raise the score, until none
+   does. Returns the score of c's plugboard, which is left set in m. */
+static int64_t climb_plugboard(TrialMachine* m, Candidate* c, int kind) {
+    int64_t best = score_trial(m, c->rings, kind);
+    for (int improved = 1; improved;) {
+        improved = 0;
+        for (int a = 0; a < 26; ++a) {
+            for (int b = a + 1; b < 26; ++b) {
+                unsigned char trial[26];
+                memcpy(trial, c->plugboard, sizeof(trial));
+                swap_plugs(trial, a, b);
+                if (plug_pairs(trial) > CRACK_MAX_PLUGS) continue;
+                set_plugboard(m, trial);
+                int64_t score = score_trial(m, c->rings, kind);
+                if (score > best) {
+                    best = score;
+                    memcpy(c->plugboard, trial, sizeof(trial));
+                    improved = 1;
+                }
+            }
+        }
+        set_plugboard(m, c->plugboard);
+    }
+    return best;
+}
+
+/* Plugboard search task: one candidate of the rotor search */
+static void search_plugboard(void* arg, size_t index) {
+    CrackSearch* s = arg;
+    Candidate* c = &s->candidates[index];
+    size_t n = s->rotor_count;
+
+    TrialMachine m;
+    if (setup_machine(&m, c, n, s->letters, s->len) != 0) {
+        free_machine(&m);
+        s->failed = 1;
+        return;
+    }
+    climb_plugboard(&m, c, SCORE_COINCIDENCES);
+    c->score = climb_plugboard(&m, c, SCORE_BIGRAMS);
+
+    /* With the plugboard in place the rings show much more clearly: search them again */
+    unsigned char rings[CRACK_MAX_ROTORS];
+    size_t settings = slow_states(n);
+    int moved = 0;
+    for (size_t r = 0; r < settings; ++r) {
+        ring_setting(r, n, rings);
+        int64_t score = score_trial(&m, rings, SCORE_BIGRAMS);
+        if (score > c->score) {
+            c->score = score;
+            memcpy(c->rings, rings, n);
+            moved = 1;
+        }
+    }
+    if (moved) c->score = climb_plugboard(&m, c, SCORE_BIGRAMS);
+    c->coincidences = score_trial(&m, c->rings, SCORE_COINCIDENCES);
+    free_machine(&m);
+}
+
+static int by_coincidences(const void* a, const void* b) {
+    int64_t x = ((const Candidate*)a)->coincidences, y = ((const Candidate*)b)->coincidences;
+    return (x < y) - (x > y);
+}
+
+static void run_tasks(ThreadPool* pool, size_t count, ThreadPoolTask task, void* arg) {
+    if (pool) thread_pool_run(pool, count, task, arg);
+    else for (size_t i = 0; i < count; ++i) task(arg, i);
+}
+
+/* Deciphering only sees the letters (spaces are X); the rest never steps the rotors */
+static int cipher_letters(const char* text, size_t len, unsigned char** letters, size_t* count) {
+    *letters = malloc(CRACK_MAX_LETTERS);
+    if (!*letters) return 3;
+    *count = 0;
+    for (size_t i = 0; i < len && *count < CRACK_MAX_LETTERS; ++i) {
+        int upper;
+        int idx = cipher_index((unsigned char)text[i], &upper);
+        if (idx >= 0) (*letters)[(*count)++] = (unsigned char)idx;
+    }
+    if (*count < 2) {
+        fprintf(stderr, "Error: the ciphertext has too few letters to crack\n");
+        free(*letters);
+        *letters = NULL;
+        return 10;
+    }
+    return 0;
+}
+
+static void init_search(CrackSearch* s, const unsigned char* letters, size_t count, size_t rotor_count) {
+    memset(s, 0, sizeof(*s));
+    s->letters = letters;
+    s->len = count;
+    s->rotor_count = rotor_count;
+    s->orders = 1;
+    for (size_t i = 0; i < rotor_count; ++i) s->orders *= ROTOR_TYPES - i;
+}
+
+/* Plugboard search of the first `count` of s->candidates, then the best of them into
+   result (all but the timings) */
+static int finish_search(ThreadPool* pool, CrackSearch* s, size_t count, CrackResult* result) {
+    run_tasks(pool, count, search_plugboard, s);
+    if (s->failed) return 3;
+    if (count == 0) return 1;
+
+    const Candidate* best = &s->candidates[0];
+    for (size_t i = 1; i < count; ++i) {
+        if (s->candidates[i].score > best->score) best = &s->candidates[i];
+    }
+    size_t letters = s->len;
+    result->rotor_count = s->rotor_count;
+    result->reflector = best->reflector;
+    memcpy(result->rotors, best->rotors, sizeof(result->rotors));
+    memcpy(result->rings, best->rings, sizeof(result->rings));
+    memcpy(result->plugboard, best->plugboard, sizeof(result->plugboard));
+    result->letters = letters;
+    result->ioc = (double)best->coincidences / ((double)letters * (double)(letters - 1));
+    result->score = (double)best->score / (100.0 * (double)(letters - 1));
+    result->trials = (uint64_t)2 * s->orders * slow_states(s->rotor_count);
+    return 0;
+}
+
+int crack_key(const char* text, size_t len, size_t rotor_count, size_t threads, CrackResult* result) {
+    if (!text || !result || rotor_count < 1 || rotor_count > CRACK_MAX_ROTORS) return 1;
+    memset(result, 0, sizeof(*result));
+
+    unsigned char* letters;
+    size_t count;
+    int rc = cipher_letters(text, len, &letters, &count);
+    if (rc != 0) return rc;
+
+    CrackSearch s;
+    init_search(&s, letters, count, rotor_count);
+    size_t tasks = 2 * s.orders;
+    s.kept = malloc(tasks * CRACK_KEEP_PER_ORDER * sizeof(*s.kept));
+    if (s.kept) clear_candidates(s.kept, tasks * CRACK_KEEP_PER_ORDER);
+
+    if (threads == 0) threads = thread_pool_cpu_count();
+    ThreadPool* pool = threads > 1 ? thread_pool_create(threads) : NULL;
+    rc = s.kept ? 0 : 3;
+
+    uint64_t t0 = stats_clock();
+    if (rc == 0) {
+        run_tasks(pool, tasks, search_order, &s);
+        if (s.failed) rc = 3;
+    }
+    uint64_t t1 = stats_clock();
+
+    /* The best settings of all orders go on to the plugboard search */
+    if (rc == 0) {
+        qsort(s.kept, tasks * CRACK_KEEP_PER_ORDER, sizeof(*s.kept), by_coincidences);
+        size_t candidates = tasks * CRACK_KEEP_PER_ORDER < CRACK_CANDIDATES ? tasks * CRACK_KEEP_PER_ORDER : CRACK_CANDIDATES;
+        while (candidates > 0 && s.kept[candidates - 1].coincidences < 0) --candidates;
+        s.candidates = s.kept;
+        rc = finish_search(pool, &s, candidates, result);
+    }
+    uint64_t t2 = stats_clock();
+    if (STATS_ON) stats_add_time(STATS_CIPHER, t0);
+    result->rotor_ns = t1 - t0;
+    result->plugboard_ns = t2 - t1;
+
+    thread_pool_destroy(pool);
+    free(s.kept);
+    free(letters);
+    return rc;
+}
+
+/* Tasks of the rotor search handed to a worker between two looks at the clock */
+#define CRACK_SHARD_BATCH 8
+
+static uint64_t letters_fingerprint(const unsigned char* letters, size_t count) {
+    uint64_t h = 14695981039346656037ull;
+    for (size_t i = 0; i < count; ++i) h = (h ^ letters[i]) * 1099511628211ull;
+    return h;
+}
+
+static char* checkpoint_path(const char* dir, size_t shard, size_t shards) {
+    size_t size = strlen(dir) + 64;
+    char* path = malloc(size);
+    if (path) snprintf(path, size, "%s/crack-%zu-of-%zu.ckpt", dir, shard, shards);
+    return path;
+}
+
+/* The header a shard's checkpoint must have, with nothing searched yet */
+static void expect_checkpoint(CrackCheckpoint* h, const CrackSearch* s, uint64_t fingerprint, size_t shard, size_t shards) {
+    uint64_t tasks = 2 * (uint64_t)s->orders;
+    memset(h, 0, sizeof(*h));
+    memcpy(h->magic, CRACK_CHECKPOINT_MAGIC, sizeof(h->magic));
+    h->version = CRACK_CHECKPOINT_VERSION;
+    h->byte_order = CRACK_CHECKPOINT_BYTE_ORDER;
+    h->fingerprint = fingerprint;
+    h->rotor_count = (uint32_t)s->rotor_count;
+    h->shard = (uint32_t)shard;
+    h->shards = (uint32_t)shards;
+    h->next_task = tasks * shard / shards;
+    h->end_task = tasks * (shard + 1) / shards;
+}
+
+/*
+ * Read the checkpoint at path into *h and best (CRACK_CANDIDATES, cleared first) if
+ * it matches `expected`. Returns 0 on success, -1 if there is none, 11 if it is not a
+ * checkpoint and 12 if it belongs to another search.
+ */
+static int load_checkpoint(const char* path, const CrackCheckpoint* expected, CrackCheckpoint* h, Candidate* best) {
+    clear_candidates(best, CRACK_CANDIDATES);
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+    CrackCheckpointEntry entries[CRACK_CANDIDATES];
+    int rc = 0;
+    if (fread(h, sizeof(*h), 1, f) != 1 || memcmp(h->magic, CRACK_CHECKPOINT_MAGIC, sizeof(h->magic)) != 0 ||
+        h->version != CRACK_CHECKPOINT_VERSION || h->byte_order != CRACK_CHECKPOINT_BYTE_ORDER || h->kept > CRACK_CANDIDATES ||
+        fread(entries, sizeof(*entries), h->kept, f) != h->kept) {
+        fprintf(stderr, "Error: %s is not a readable checkpoint\n", path);
+        rc = 11;
+    } else if (h->fingerprint != expected->fingerprint || h->rotor_count != expected->rotor_count || h->shard != expected->shard ||
+               h->shards != expected->shards || h->end_task != expected->end_task || h->next_task < expected->next_task ||
+               h->next_task > h->end_task) {
+        fprintf(stderr, "Error: %s belongs to another search (ciphertext or rotor count)\n", path);
+        rc = 12;
+    }
+    fclose(f);
+    for (uint32_t i = 0; rc == 0 && i < h->kept; ++i) {
+        const CrackCheckpointEntry* e = &entries[i];
+        Candidate c;
+        memset(&c, 0, sizeof(c));
+        c.reflector = e->reflector;
+        memcpy(c.rotors, e->rotors, sizeof(c.rotors));
+        memcpy(c.rings, e->rings, sizeof(c.rings));
+        for (int v = 0; v < 26; ++v) c.plugboard[v] = (unsigned char)v;
+        c.coincidences = e->coincidences;
+        int valid = c.reflector <= 1 && c.coincidences >= 0;
+        for (size_t r = 0; r < CRACK_MAX_ROTORS; ++r) valid &= c.rotors[r] < ROTOR_TYPES && c.rings[r] < 26;
+        if (!valid) {
+            fprintf(stderr, "Error: %s holds impossible rotor settings\n", path);
+            rc = 11;
+        } else {
+            keep_candidate(best, CRACK_CANDIDATES, &c);
+        }
+    }
+    return rc;
+}
+
+/* Write the checkpoint next to path and move it over the old one, so that a worker
+   stopped at any moment leaves either checkpoint whole */
+static int save_checkpoint(const char* path, CrackCheckpoint* h, const Candidate* best) {
+    CrackCheckpointEntry entries[CRACK_CANDIDATES];
+    h->kept = 0;
+    for (size_t i = 0; i < CRACK_CANDIDATES && best[i].coincidences >= 0; ++i) {
+        CrackCheckpointEntry* e = &entries[h->kept++];
+        memset(e, 0, sizeof(*e));
+        e->coincidences = best[i].coincidences;
+        e->reflector = best[i].reflector;
+        memcpy(e->rotors, best[i].rotors, sizeof(e->rotors));
+        memcpy(e->rings, best[i].rings, sizeof(e->rings));
+    }
+
+    size_t size = strlen(path) + 5;
+    char* tmp = malloc(size);
+    if (!tmp) return 3;
+    snprintf(tmp, size, "%s.tmp", path);
+    FILE* f = fopen(tmp, "wb");
+    int rc = f ? 0 : 4;
+    if (rc == 0 && (fwrite(h, sizeof(*h), 1, f) != 1 || fwrite(entries, sizeof(*entries), h->kept, f) != h->kept)) rc = 4;
+    if (f && fclose(f) != 0) rc = 4;
+#ifdef WIN32
+    if (rc == 0) remove(path);          // rename() does not replace files on Windows
+#endif
+    if (rc == 0 && rename(tmp, path) != 0) rc = 4;
+    if (rc != 0) perror(tmp);
+    free(tmp);
+    return rc;
+}
+
+int crack_shard(const char* text, size_t len, size_t rotor_count, size_t shard, size_t shards, const char* dir,
+                size_t threads, CrackCheckpoint* progress) {
+    if (!text || !dir || !progress || rotor_count < 1 || rotor_count > CRACK_MAX_ROTORS || shard >= shards) return 1;
+    memset(progress, 0, sizeof(*progress));
+
+    unsigned char* letters;
+    size_t count;
+    int rc = cipher_letters(text, len, &letters, &count);
+    if (rc != 0) return rc;
+
+    CrackSearch s;
+    init_search(&s, letters, count, rotor_count);
+    CrackCheckpoint expected, h;
+    expect_checkpoint(&expected, &s, letters_fingerprint(letters, count), shard, shards);
+    Candidate best[CRACK_CANDIDATES];
+    char* path = checkpoint_path(dir, shard, shards);
+    rc = path ? load_checkpoint(path, &expected, &h, best) : 3;
+    if (rc < 0) {
+        h = expected;
+        rc = 0;
+    }
+
+    if (threads == 0) threads = thread_pool_cpu_count();
+    ThreadPool* pool = NULL;
+    size_t batch = 0;
+    if (rc == 0 && h.next_task < h.end_task) {
+        pool = threads > 1 ? thread_pool_create(threads) : NULL;
+        batch = (pool ? thread_pool_size(pool) : 1) * CRACK_SHARD_BATCH;
+        s.kept = malloc(batch * CRACK_KEEP_PER_ORDER * sizeof(*s.kept));
+        if (!s.kept) rc = 3;
+    }
+
+    uint64_t saved = stats_clock();
+    while (rc == 0 && h.next_task < h.end_task) {
+        size_t tasks = h.end_task - h.next_task < batch ? (size_t)(h.end_task - h.next_task) : batch;
+        clear_candidates(s.kept, tasks * CRACK_KEEP_PER_ORDER);
+        s.first_task = (size_t)h.next_task;
+        uint64_t t0 = stats_clock();
+        run_tasks(pool, tasks, search_order, &s);
+        if (s.failed) { rc = 3; break; }
+        for (size_t i = 0; i < tasks * CRACK_KEEP_PER_ORDER; ++i) {
+            if (s.kept[i].coincidences >= 0) keep_candidate(best, CRACK_CANDIDATES, &s.kept[i]);
+        }
+        uint64_t now = stats_clock();
+        if (STATS_ON) stats_add_time(STATS_CIPHER, t0);
+        h.next_task += tasks;
+        h.trials += (uint64_t)tasks * slow_states(rotor_count);
+        h.ns += now - t0;
+        if (h.next_task == h.end_task || now - saved >= (uint64_t)CRACK_CHECKPOINT_SECONDS * 1000000000ull) {
+            rc = save_checkpoint(path, &h, best);
+            saved = now;
+        }
+    }
+    if (rc == 0) *progress = h;
+
+    thread_pool_destroy(pool);
+    free(s.kept);
+    free(path);
+    free(letters);
+    return rc;
+}
+
+int crack_merge(const char* text, size_t len, size_t rotor_count, size_t shards, const char* dir, size_t threads,
+                CrackResult* result) {
+    if (!text || !dir || !result || rotor_count < 1 || rotor_count > CRACK_MAX_ROTORS || shards == 0) return 1;
+    memset(result, 0, sizeof(*result));
+
+    unsigned char* letters;
+    size_t count;
+    int rc = cipher_letters(text, len, &letters, &count);
+    if (rc != 0) return rc;
+
+    /* Every shard's best settings, which hold the best of the whole search */
+    CrackSearch s;
+    init_search(&s, letters, count, rotor_count);
+    uint64_t fingerprint = letters_fingerprint(letters, count);
+    Candidate best[CRACK_CANDIDATES], shard_best[CRACK_CANDIDATES];
+    clear_candidates(best, CRACK_CANDIDATES);
+    uint64_t ns = 0;
+    for (size_t shard = 0; shard < shards && rc != 3; ++shard) {
+        CrackCheckpoint expected, h;
+        expect_checkpoint(&expected, &s, fingerprint, shard, shards);
+        char* path = checkpoint_path(dir, shard, shards);
+        int r = path ? load_checkpoint(path, &expected, &h, shard_best) : 3;
+        if (r < 0) {
+            fprintf(stderr, "Error: shard %zu of %zu has no checkpoint in %s\n", shard, shards, dir);
+            r = 12;
+        } else if (r == 0 && h.next_task < h.end_task) {
+            fprintf(stderr, "Error: shard %zu of %zu is unfinished (%llu of %llu tasks)\n", shard, shards,
+                    (unsigned long long)(h.next_task - expected.next_task), (unsigned long long)(h.end_task - expected.next_task));
+            r = 12;
+        }
+        for (size_t i = 0; r == 0 && i < CRACK_CANDIDATES && shard_best[i].coincidences >= 0; ++i) {
+            keep_candidate(best, CRACK_CANDIDATES, &shard_best[i]);
+        }
+        if (r == 0) ns += h.ns;
+        else if (rc == 0 || r == 3) rc = r;
+        free(path);
+    }
+
+    if (threads == 0) threads = thread_pool_cpu_count();
+    ThreadPool* pool = rc == 0 && threads > 1 ? thread_pool_create(threads) : NULL;
+    uint64_t t0 = stats_clock();
+    if (rc == 0) {
+        size_t candidates = 0;
+        while (candidates < CRACK_CANDIDATES && best[candidates].coincidences >= 0) ++candidates;
+        s.candidates = best;
+        rc = finish_search(pool, &s, candidates, result);
+    }
+    if (STATS_ON) stats_add_time(STATS_CIPHER, t0);
+    result->rotor_ns = ns;
+    result->plugboard_ns = stats_clock() - t0;
+
+    thread_pool_destroy(pool);
+    free(letters);
+    return rc;
+}
+
+/* The key lines of a key file for the given settings */
+static void write_key_lines(FILE* f, size_t n, int reflector, const unsigned char* rotors, const unsigned char* rings,
+                            const unsigned char plugboard[26]) {
+    fprintf(f, "reflector=%d\n", reflector + 1);
+    fputs("rotors=", f);
+    for (size_t i = 0; i < n; ++i) fprintf(f, "%s%d", i ? "," : "", rotors[i] + 1);
+    /* The slowest rotor's ring changes nothing; it is always A */
+    fputs("\nrings=", f);
+    for (size_t i = 0; i < n; ++i) fprintf(f, "%s%c", i ? "," : "", 'A' + rings[i]);
+    fputc('\n', f);
+    if (plug_pairs(plugboard) > 0) {
+        fputs("plugboard=", f);
+        int first = 1;
+        for (int v = 0; v < 26; ++v) {
+            if (plugboard[v] <= v) continue;
+            fprintf(f, "%s%c%c", first ? "" : ",", 'A' + v, 'A' + plugboard[v]);
+            first = 0;
+        }
+        fputc('\n', f);
+    }
+}
+
+int write_crack_key(FILE* f, const CrackResult* r) {
+    if (!f || !r) return 1;
+    fprintf(f, "# Recovered from %zu letters: index of coincidence %.4f, bigram score %.3f per letter\n",
+            r->letters, r->ioc, r->score);
+    write_key_lines(f, r->rotor_count, r->reflector, r->rotors, r->rings, r->plugboard);
+    return ferror(f) ? 1 : 0;
+}
+
+#define CRIB_NONE 26                    // unscramble(): no letter scrambles to this one
+#define CRIB_SEVERAL 27                 // unscramble(): more than one does
+
+/* The menu of one stop: crib letter i is what ciphertext letter cipher[i] deciphers to */
+typedef struct Bombe {
+    TrialMachine* m;
+    size_t length;
+    const unsigned char* plain;
+    const unsigned char* cipher;
+    const unsigned short* codes;        // slow_code() at each crib letter
+    size_t first;                       // letter index of the first crib letter
+    int involutive;                     // every scrambler is its own inverse
+    uint64_t inverted;                  // scramblers whose inverse is in `inverse`
+    unsigned char inverse[CRIB_MAX_LETTERS][26];
+    unsigned char edges[26][2 * CRIB_MAX_LETTERS];     // 2 * i where a letter is cipher[i], 2 * i + 1 where it is plain[i]
+    unsigned char edge_count[26];
+    int test;                           // the letter with the most edges
+} Bombe;
+
+/* With reflector B and rotors that are true permutations, the rotors at any position
+   (the scrambler) pair letters, and never a letter with itself */
+static int involutive_machine(const Candidate* c, size_t n) {
+    const unsigned char* reflector = c->reflector ? REFLECTOR_C : REFLECTOR_B;
+    for (int v = 0; v < 26; ++v) {
+        if (reflector[v] >= 26 || reflector[v] == v || reflector[reflector[v]] != v) return 0;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t seen = 0;
+        for (int v = 0; v < 26; ++v) {
+            if (ROTOR_WIRINGS[c->rotors[i]][v] >= 26) return 0;
+            seen |= 1u << ROTOR_WIRINGS[c->rotors[i]][v];
+        }
+        if (seen != (1u << 26) - 1) return 0;
+    }
+    return 1;
+}
+
+/* slow_code() at letters [from, from + count) of the message with the given rings */
+static void slow_codes(const TrialMachine* m, const unsigned char* rings, size_t from, size_t count, unsigned short* codes) {
+    size_t n = m->rotor_count;
+    unsigned char positions[CRACK_MAX_ROTORS];
+    memcpy(positions, rings, n);
+    for (size_t t = 0, end = from + count; t < end;) {
+        step_positions(m->notches, n, positions);
+        size_t run = run_length(m, positions, end - t, n);
+        unsigned short code = (unsigned short)slow_code(positions, rings, n);
+        for (size_t k = t > from ? t : from; k < t + run; ++k) codes[k - from] = code;
+        positions[0] = (unsigned char)((positions[0] + run - 1) % 26);
+        t += run;
+    }
+}
+
+static void build_menu(Bombe* b) {
+    memset(b->edge_count, 0, sizeof(b->edge_count));
+    for (size_t i = 0; i < b->length; ++i) {
+        int c = b->cipher[i], p = b->plain[i];
+        b->edges[c][b->edge_count[c]++] = (unsigned char)(2 * i);
+        b->edges[p][b->edge_count[p]++] = (unsigned char)(2 * i + 1);
+    }
+    b->test = 0;
+    for (int v = 1; v < 26; ++v) {
+        if (b->edge_count[v] > b->edge_count[b->test]) b->test = v;
+    }
+    b->inverted = 0;
+}
+
+/* The rotors and reflector alone at crib letter i, without the plugboard */
+static FORCE_INLINE int scramble(Bombe* b, size_t i, int v) {
+    TrialMachine* m = b->m;
+    size_t code = b->codes[i];
+    if (!m->built[code]) build_inner(m, code);
+    int fast = (int)((b->first + i + 1) % 26);
+    return m->backward[0][fast][m->inner[code][m->forward[0][fast][v]]];
+}
+
+/* The letter that scrambles to v at crib letter i, or CRIB_NONE or CRIB_SEVERAL */
+static int unscramble(Bombe* b, size_t i, int v) {
+    if (b->involutive) return scramble(b, i, v);
+    if (!(b->inverted >> i & 1)) {
+        unsigned char* inverse = b->inverse[i];
+        memset(inverse, CRIB_NONE, 26);
+        for (int x = 0; x < 26; ++x) {
+            int y = scramble(b, i, x);
+            inverse[y] = inverse[y] == CRIB_NONE ? (unsigned char)x : CRIB_SEVERAL;
+        }
+        b->inverted |= 1ull << i;
+    }
+    return b->inverse[i][v];
+}
+
+/* Record that letter v is plugged to w. A letter has one partner: returns 0 if v
+   already has another. */
+static FORCE_INLINE int plug(uint32_t* partners, uint32_t* pending, int v, int w) {
+    uint32_t bit = 1u << w;
+    if (partners[v] & bit) return 1;
+    if (partners[v]) return 0;
+    partners[v] = bit;
+    *pending |= 1u << v;
+    return 1;
+}
+
+/*
+ * Assume the test letter is plugged to `partner` and follow what it implies: if v is
+ * plugged to w, w is plugged to v, and across every crib letter i that v is in, the
+ * other letter of the pair is plugged to w scrambled (or unscrambled). Returns 0 at
+ * the first contradiction, or 1 with the implied partners (one bit each, or none).
+ */
+static int test_hypothesis(Bombe* b, int partner, uint32_t partners[26]) {
+    memset(partners, 0, 26 * sizeof(*partners));
+    uint32_t pending = 0;
+    plug(partners, &pending, b->test, partner);
+    while (pending) {
+        int v = __builtin_ctz(pending);
+        pending &= pending - 1;
+        int w = __builtin_ctz(partners[v]);
+        if (!plug(partners, &pending, w, v)) return 0;
+        for (size_t e = 0; e < b->edge_count[v]; ++e) {
+            size_t i = b->edges[v][e] >> 1;
+            if (b->edges[v][e] & 1) {
+                int x = unscramble(b, i, w);
+                if (x == CRIB_NONE) return 0;
+                if (x != CRIB_SEVERAL && !plug(partners, &pending, b->cipher[i], x)) return 0;
+            } else if (!plug(partners, &pending, b->plain[i], scramble(b, i, w))) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+typedef struct CribSearch {
+    const unsigned char* letters;       // the letters stops are scored on
+    size_t len;
+    const unsigned char* plain;         // the crib
+    size_t length;
+    const unsigned char* window;        // ciphertext letters the crib may lie under
+    const size_t* positions;            // their byte offsets
+    const unsigned char* faces_itself;  // per crib offset: a crib letter is over the same letter
+    size_t first;                       // letter index of window[0]
+    size_t offsets;                     // the crib may start at window[0 .. offsets - 1]
+    size_t rotor_count;
+    size_t orders;                      // rotor orders per reflector
+    CribStop* stops;                    // CRIB_STOPS_PER_ORDER per task, best score first
+    uint64_t* found;                    // stops found per task
+    uint64_t* tested;                   // stops tested per task
+    uint64_t* ruled_out;                // stops skipped per task because a crib letter faces itself
+    int failed;                         // a task could not allocate its tables
+} CribSearch;
+
+/* Add a stop to the `count` found so far by a task, keeping the best scores */
+static void keep_stop(CribStop* kept, uint64_t count, const CribStop* stop) {
+    size_t k = count < CRIB_STOPS_PER_ORDER ? (size_t)count : CRIB_STOPS_PER_ORDER;
+    while (k > 0 && stop->score > kept[k - 1].score) --k;
+    if (k == CRIB_STOPS_PER_ORDER) return;
+    size_t last = count < CRIB_STOPS_PER_ORDER ? (size_t)count : CRIB_STOPS_PER_ORDER - 1;
+    memmove(kept + k + 1, kept + k, (last - k) * sizeof(*kept));
+    kept[k] = *stop;
+}
+
+/* Crib search task: all ring settings and crib offsets of one reflector and rotor order */
+static void search_crib(void* arg, size_t task) {
+    CribSearch* s = arg;
+    size_t n = s->rotor_count;
+
+    Candidate c;
+    memset(&c, 0, sizeof(c));
+    c.reflector = (unsigned char)(task / s->orders);
+    rotor_order(task % s->orders, n, c.rotors);
+    for (int v = 0; v < 26; ++v) c.plugboard[v] = (unsigned char)v;
+
+    TrialMachine m;
+    size_t span = s->offsets + s->length - 1;
+    Bombe* b = malloc(sizeof(*b));
+    unsigned short* codes = malloc(span * sizeof(*codes));
+    if (setup_machine(&m, &c, n, s->letters, s->len) != 0 || !b || !codes) {
+        free(codes);
+        free(b);
+        free_machine(&m);
+        s->failed = 1;
+        return;
+    }
+    b->m = &m;
+    b->length = s->length;
+    b->plain = s->plain;
+    b->involutive = involutive_machine(&c, n);
+
+    CribStop* kept = s->stops + task * CRIB_STOPS_PER_ORDER;
+    uint64_t found = 0, tested = 0, skipped = 0;
+    size_t settings = slow_states(n);
+    if (b->involutive) {
+        for (size_t o = 0; o < s->offsets; ++o) skipped += s->faces_itself[o];
+        skipped *= settings;
+    }
+    for (size_t r = 0; r < settings; ++r) {
+        ring_setting(r, n, c.rings);
+        slow_codes(&m, c.rings, s->first, span, codes);
+        for (size_t o = 0; o < s->offsets; ++o) {
+            if (b->involutive && s->faces_itself[o]) continue;
+            uint64_t t0 = stats_clock();
+            b->cipher = s->window + o;
+            b->codes = codes + o;
+            b->first = s->first + o;
+            build_menu(b);
+            ++tested;
+
+            uint32_t survivors = 0;
+            uint32_t partners[26][26];
+            for (int partner = 0; partner < 26; ++partner) {
+                if (test_hypothesis(b, partner, partners[partner])) survivors |= 1u << partner;
+            }
+            uint64_t ns = stats_clock() - t0;
+            for (; survivors; survivors &= survivors - 1) {
+                const uint32_t* p = partners[__builtin_ctz(survivors)];
+                CribStop stop;
+                memset(&stop, 0, sizeof(stop));
+                stop.reflector = c.reflector;
+                memcpy(stop.rotors, c.rotors, sizeof(stop.rotors));
+                memcpy(stop.rings, c.rings, sizeof(stop.rings));
+                for (int v = 0; v < 26; ++v) stop.plugboard[v] = (unsigned char)(p[v] ? __builtin_ctz(p[v]) : v);
+                stop.offset = s->positions[o];
+                set_plugboard(&m, stop.plugboard);
+                stop.score = (double)score_trial(&m, c.rings, SCORE_BIGRAMS) / (100.0 * (double)(s->len - 1));
+                stop.ns = ns;
+                keep_stop(kept, found++, &stop);
+            }
+        }
+    }
+    s->found[task] = found;
+    s->tested[task] = tested;
+    s->ruled_out[task] = skipped;
+    free(codes);
+    free(b);
+    free_machine(&m);
+}
+
+static int by_score(const void* a, const void* b) {
+    double x = ((const CribStop*)a)->score, y = ((const CribStop*)b)->score;
+    return (x < y) - (x > y);
+}
+
+int crack_crib(const char* text, size_t len, const char* crib, size_t crib_at, size_t rotor_count, size_t threads,
+               CribResult* result) {
+    if (!text || !crib || !result || rotor_count < 1 || rotor_count > CRACK_MAX_ROTORS) return 1;
+    memset(result, 0, sizeof(*result));
+
+    /* The crib is plaintext: its spaces were enciphered as X, and the rest never was */
+    unsigned char plain[CRIB_MAX_LETTERS];
+    size_t length = 0;
+    for (const char* p = crib; *p; ++p) {
+        int upper;
+        int idx = cipher_index((unsigned char)*p, &upper);
+        if (idx < 0) continue;
+        if (length == CRIB_MAX_LETTERS) {
+            fprintf(stderr, "Error: the crib is longer than %d letters\n", CRIB_MAX_LETTERS);
+            return 10;
+        }
+        plain[length++] = (unsigned char)idx;
+    }
+    if (length == 0) {
+        fprintf(stderr, "Error: the crib has no letters\n");
+        return 10;
+    }
+
+    /* The letters stops are scored on, and those the crib may lie under with their
+       offsets: the same letters unless the crib is at crib_at */
+    unsigned char* letters = malloc(CRACK_MAX_LETTERS + CRIB_MAX_LETTERS);
+    size_t* positions = malloc(CRACK_MAX_LETTERS * sizeof(*positions));
+    unsigned char* faces_itself = malloc(CRACK_MAX_LETTERS);
+    if (!letters || !positions || !faces_itself) {
+        free(letters);
+        free(positions);
+        free(faces_itself);
+        return 3;
+    }
+    unsigned char* window = crib_at == SIZE_MAX ? letters : letters + CRACK_MAX_LETTERS;
+    size_t count = 0, first = 0, window_len = 0;
+    size_t window_max = crib_at == SIZE_MAX ? CRACK_MAX_LETTERS : length;
+    for (size_t i = 0; i < len && (count < CRACK_MAX_LETTERS || window_len < window_max); ++i) {
+        int upper;
+        int idx = cipher_index((unsigned char)text[i], &upper);
+        if (idx < 0) continue;
+        if (count < CRACK_MAX_LETTERS) letters[count++] = (unsigned char)idx;
+        if (crib_at != SIZE_MAX && i < crib_at) {
+            ++first;
+        } else if (window_len < window_max) {
+            window[window_len] = (unsigned char)idx;
+            positions[window_len++] = i;
+        }
+    }
+    int rc = 0;
+    if (count < 2) {
+        fprintf(stderr, "Error: the ciphertext has too few letters to crack\n");
+        rc = 10;
+    } else if (window_len < length) {
+        fprintf(stderr, "Error: the crib runs past the end of the ciphertext\n");
+        rc = 10;
+    }
+
+    CribSearch s;
+    memset(&s, 0, sizeof(s));
+    s.letters = letters;
+    s.len = count;
+    s.plain = plain;
+    s.length = length;
+    s.window = window;
+    s.positions = positions;
+    s.faces_itself = faces_itself;
+    s.first = first;
+    s.offsets = rc == 0 ? window_len - length + 1 : 0;
+    s.rotor_count = rotor_count;
+    s.orders = 1;
+    for (size_t i = 0; i < rotor_count; ++i) s.orders *= ROTOR_TYPES - i;
+    for (size_t o = 0; o < s.offsets; ++o) {
+        faces_itself[o] = 0;
+        for (size_t i = 0; i < length; ++i) faces_itself[o] |= window[o + i] == plain[i];
+    }
+
+    size_t tasks = 2 * s.orders;
+    ThreadPool* pool = NULL;
+    if (rc == 0) {
+        s.stops = malloc(tasks * CRIB_STOPS_PER_ORDER * sizeof(*s.stops));
+        s.found = calloc(3 * tasks, sizeof(*s.found));
+        s.tested = s.found ? s.found + tasks : NULL;
+        s.ruled_out = s.found ? s.found + 2 * tasks : NULL;
+        if (!s.stops || !s.found) rc = 3;
+        if (threads == 0) threads = thread_pool_cpu_count();
+        pool = threads > 1 ? thread_pool_create(threads) : NULL;
+    }
+
+    uint64_t t0 = stats_clock();
+    if (rc == 0) {
+        run_tasks(pool, tasks, search_crib, &s);
+        if (s.failed) rc = 3;
+    }
+    if (STATS_ON) stats_add_time(STATS_CIPHER, t0);
+    result->ns = stats_clock() - t0;
+
+    /* The best stops of every order, best of all first */
+    if (rc == 0) {
+        size_t kept = 0;
+        for (size_t task = 0; task < tasks; ++task) {
+            size_t k = s.found[task] < CRIB_STOPS_PER_ORDER ? (size_t)s.found[task] : CRIB_STOPS_PER_ORDER;
+            memmove(s.stops + kept, s.stops + task * CRIB_STOPS_PER_ORDER, k * sizeof(*s.stops));
+            kept += k;
+            result->found += s.found[task];
+            result->tested += s.tested[task];
+            result->ruled_out += s.ruled_out[task];
+        }
+        qsort(s.stops, kept, sizeof(*s.stops), by_score);
+        result->rotor_count = rotor_count;
+        result->stops = s.stops;
+        result->stop_count = kept < CRIB_STOPS ? kept : CRIB_STOPS;
+        result->offsets = s.offsets;
+        s.stops = NULL;
+    }
+
+    thread_pool_destroy(pool);
+    free(s.stops);
+    free(s.found);
+    free(faces_itself);
+    free(positions);
+    free(letters);
+    return rc;
+}
+
+int write_crib_stops(FILE* f, const CribResult* r) {
+    if (!f || !r) return 1;
+    for (size_t i = 0; i < r->stop_count; ++i) {
+        const CribStop* stop = &r->stops[i];
+        fprintf(f, "%s# Stop %zu: crib at byte %zu, bigram score %.3f per letter, tested in %.2f us\n", i ? "\n" : "", i + 1,
+                stop->offset, stop->score, (double)stop->ns / 1e3);
+        write_key_lines(f, r->rotor_count, stop->reflector, stop->rotors, stop->rings, stop->plugboard);
+    }
+    return ferror(f) ? 1 : 0;
+}
+
+void free_crib_result(CribResult* r) {
+    if (!r) return;
+    free(r->stops);
+    r->stops = NULL;
+    r->stop_count = 0;
+}
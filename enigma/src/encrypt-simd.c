@@ -0,0 +1,307 @@
+#include "../include/encrypt-simd.h"
+#include "../include/engine.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+/* Bring a state index that ran into the padding back into the cycle */
+static inline size_t wrap_state(const CompiledKey* ck, size_t j) {
+    if (j < ck->state_count) return j;
+    return ck->cycle_start + (j - ck->state_count) % (ck->state_count - ck->cycle_start);
+}
+
+static size_t period_kernel_scalar(const CompiledKey* ck, size_t j, const char* in, char* out, size_t len) {
+    const unsigned char (*states)[26] = (const unsigned char (*)[26])ck->states;
+    size_t count = ck->state_count;
+    size_t cycle_start = ck->cycle_start;
+
+    for (size_t i = 0; i < len; ++i) {
+        int upper;
+        int idx = cipher_index((unsigned char)in[i], &upper);
+        if (idx < 0) {                          // only allow characters
+            out[i] = in[i];
+            continue;
+        }
+
+        /* Step, then plugboard -> rotors -> reflector -> rotors^-1 -> plugboard, fused */
+        if (++j == count) j = cycle_start;
+        out[i] = (char)((upper ? 'A' : 'a') + states[j][idx]);
+    }
+    return j;
+}
+
+/* Letters of a block at the positions set in mask, looked up one by one; the rest
+   of the block is already in out */
+static inline size_t sparse_letters(const CompiledKey* ck, size_t j, unsigned mask, const char* in, char* out) {
+    const unsigned char (*states)[26] = (const unsigned char (*)[26])ck->states;
+    for (; mask; mask &= mask - 1) {
+        int k = __builtin_ctz(mask);
+        int upper = 0;
+        int idx = cipher_index((unsigned char)in[k], &upper);
+        if (++j == ck->state_count) j = ck->cycle_start;
+        out[k] = (char)((upper ? 'A' : 'a') + states[j][idx]);
+    }
+    return j;
+}
+
+static size_t passthrough_scalar(const char* in, size_t len) {
+    size_t i = 0;
+    int upper;
+    while (i < len && cipher_index((unsigned char)in[i], &upper) < 0) ++i;
+    return i;
+}
+
+#ifdef HAVE_X86_KERNELS
+
+/* Blocks with at most this many letters skip the gathers and look them up one by one */
+#define SPARSE_LETTERS 4
+
+/*
+ * All vector kernels work the same way on blocks of 16/32/64 bytes:
+ *  - classify uppercase, lowercase and spaces with unsigned range compares,
+ *  - normalise to a 0-25 index (spaces become X),
+ *  - number the letters of each 16-byte lane with an in-lane prefix sum, so letter k
+ *    of the block uses state j + k + 1 (the padding after the table keeps that in range),
+ *  - look the substitutions up, re-add 'A' or 'a' and blend with the pass-through bytes.
+ */
+
+__attribute__((target("sse4.1")))
+static size_t period_kernel_sse4(const CompiledKey* ck, size_t j, const char* in, char* out, size_t len) {
+    const unsigned char* states = ck->states[0];
+    const __m128i upper_a = _mm_set1_epi8('A'), lower_a = _mm_set1_epi8('a');
+    const __m128i space = _mm_set1_epi8(' '), max_index = _mm_set1_epi8(25), x = _mm_set1_epi8('X' - 'A');
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i ui = _mm_sub_epi8(v, upper_a);
+        __m128i li = _mm_sub_epi8(v, lower_a);
+        __m128i up = _mm_cmpeq_epi8(_mm_min_epu8(ui, max_index), ui);
+        __m128i lo = _mm_cmpeq_epi8(_mm_min_epu8(li, max_index), li);
+        __m128i letters = _mm_or_si128(_mm_or_si128(up, lo), _mm_cmpeq_epi8(v, space));
+        unsigned mask = (unsigned)_mm_movemask_epi8(letters);
+        if (!mask) {
+            if (out != in) _mm_storeu_si128((__m128i*)(out + i), v);
+            continue;
+        }
+
+        /* No byte gather before AVX2: look the letters up one by one */
+        unsigned char idx[16], res[16] = {0};
+        _mm_storeu_si128((__m128i*)idx, _mm_blendv_epi8(_mm_blendv_epi8(x, li, lo), ui, up));
+        const unsigned char* row = states + j * 26;
+        for (unsigned m = mask; m; m &= m - 1) {
+            int k = __builtin_ctz(m);
+            row += 26;
+            res[k] = row[idx[k]];
+        }
+        j = wrap_state(ck, j + (size_t)__builtin_popcount(mask));
+
+        __m128i r = _mm_add_epi8(_mm_loadu_si128((const __m128i*)res), _mm_blendv_epi8(upper_a, lower_a, lo));
+        _mm_storeu_si128((__m128i*)(out + i), _mm_blendv_epi8(v, r, letters));
+    }
+    return period_kernel_scalar(ck, j, in + i, out + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t period_kernel_avx2(const CompiledKey* ck, size_t j, const char* in, char* out, size_t len) {
+    const unsigned char* states = ck->states[0];
+    const __m256i upper_a = _mm256_set1_epi8('A'), lower_a = _mm256_set1_epi8('a');
+    const __m256i space = _mm256_set1_epi8(' '), max_index = _mm256_set1_epi8(25), x = _mm256_set1_epi8('X' - 'A');
+    const __m256i one = _mm256_set1_epi8(1), row_size = _mm256_set1_epi32(26), low_byte = _mm256_set1_epi32(0xFF);
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i ui = _mm256_sub_epi8(v, upper_a);
+        __m256i li = _mm256_sub_epi8(v, lower_a);
+        __m256i up = _mm256_cmpeq_epi8(_mm256_min_epu8(ui, max_index), ui);
+        __m256i lo = _mm256_cmpeq_epi8(_mm256_min_epu8(li, max_index), li);
+        __m256i letters = _mm256_or_si256(_mm256_or_si256(up, lo), _mm256_cmpeq_epi8(v, space));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(letters);
+        if (!mask) {
+            if (out != in) _mm256_storeu_si256((__m256i*)(out + i), v);
+            continue;
+        }
+        if (__builtin_popcount(mask) <= SPARSE_LETTERS) {
+            if (out != in) _mm256_storeu_si256((__m256i*)(out + i), v);
+            j = sparse_letters(ck, j, mask, in + i, out + i);
+            continue;
+        }
+
+        __m256i idx = _mm256_blendv_epi8(_mm256_blendv_epi8(x, li, lo), ui, up);
+        __m256i p = _mm256_and_si256(letters, one);
+        p = _mm256_add_epi8(p, _mm256_slli_si256(p, 1));
+        p = _mm256_add_epi8(p, _mm256_slli_si256(p, 2));
+        p = _mm256_add_epi8(p, _mm256_slli_si256(p, 4));
+        p = _mm256_add_epi8(p, _mm256_slli_si256(p, 8));
+
+        /* Four gathers of eight letters; lane 1 rows start after the letters of lane 0 */
+        __m256i g[4];
+        for (int q = 0; q < 4; ++q) {
+            __m128i p8 = q < 2 ? _mm256_castsi256_si128(p) : _mm256_extracti128_si256(p, 1);
+            __m128i i8 = q < 2 ? _mm256_castsi256_si128(idx) : _mm256_extracti128_si256(idx, 1);
+            if (q & 1) { p8 = _mm_srli_si128(p8, 8); i8 = _mm_srli_si128(i8, 8); }
+            __m256i offsets = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvtepu8_epi32(p8), row_size), _mm256_cvtepu8_epi32(i8));
+            size_t before = q < 2 ? 0 : (size_t)__builtin_popcount(mask & 0xFFFF);
+            const int* base = (const int*)(const void*)(states + (j + before) * 26);
+            g[q] = _mm256_and_si256(_mm256_i32gather_epi32(base, offsets, 1), low_byte);
+        }
+        __m256i r = _mm256_packus_epi16(_mm256_packus_epi32(g[0], g[1]), _mm256_packus_epi32(g[2], g[3]));
+        r = _mm256_permutevar8x32_epi32(r, order);
+        j = wrap_state(ck, j + (size_t)__builtin_popcount(mask));
+
+        r = _mm256_add_epi8(r, _mm256_blendv_epi8(upper_a, lower_a, lo));
+        _mm256_storeu_si256((__m256i*)(out + i), _mm256_blendv_epi8(v, r, letters));
+    }
+    return period_kernel_sse4(ck, j, in + i, out + i, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static size_t period_kernel_avx512(const CompiledKey* ck, size_t j, const char* in, char* out, size_t len) {
+    const unsigned char* states = ck->states[0];
+    const __m512i upper_a = _mm512_set1_epi8('A'), lower_a = _mm512_set1_epi8('a');
+    const __m512i space = _mm512_set1_epi8(' '), alphabet = _mm512_set1_epi8(26), x = _mm512_set1_epi8('X' - 'A');
+    const __m512i one = _mm512_set1_epi8(1), row_size = _mm512_set1_epi32(26);
+
+    size_t i = 0;
+    for (; i + 64 <= len; i += 64) {
+        __m512i v = _mm512_loadu_si512((const void*)(in + i));
+        __m512i ui = _mm512_sub_epi8(v, upper_a);
+        __m512i li = _mm512_sub_epi8(v, lower_a);
+        __mmask64 up = _mm512_cmplt_epu8_mask(ui, alphabet);
+        __mmask64 lo = _mm512_cmplt_epu8_mask(li, alphabet);
+        __mmask64 letters = up | lo | _mm512_cmpeq_epi8_mask(v, space);
+        if (!letters) {
+            if (out != in) _mm512_storeu_si512((void*)(out + i), v);
+            continue;
+        }
+        if (__builtin_popcountll(letters) <= SPARSE_LETTERS) {
+            if (out != in) _mm512_storeu_si512((void*)(out + i), v);
+            for (int half = 0; half < 2; ++half)
+                j = sparse_letters(ck, j, (unsigned)(letters >> (32 * half)), in + i + 32 * half, out + i + 32 * half);
+            continue;
+        }
+
+        __m512i idx = _mm512_mask_blend_epi8(up, _mm512_mask_blend_epi8(lo, x, li), ui);
+        __m512i p = _mm512_maskz_mov_epi8(letters, one);
+        p = _mm512_add_epi8(p, _mm512_bslli_epi128(p, 1));
+        p = _mm512_add_epi8(p, _mm512_bslli_epi128(p, 2));
+        p = _mm512_add_epi8(p, _mm512_bslli_epi128(p, 4));
+        p = _mm512_add_epi8(p, _mm512_bslli_epi128(p, 8));
+
+        /* One 16-letter gather per lane, rows offset by the letters of the lanes before it */
+        __m128i b[4];
+        size_t before = 0;
+        for (int q = 0; q < 4; ++q) {
+            __m512i p32, i32;
+            switch (q) {
+            case 0:  p32 = _mm512_cvtepu8_epi32(_mm512_extracti32x4_epi32(p, 0)); i32 = _mm512_cvtepu8_epi32(_mm512_extracti32x4_epi32(idx, 0)); break;
+            case 1:  p32 = _mm512_cvtepu8_epi32(_mm512_extracti32x4_epi32(p, 1)); i32 = _mm512_cvtepu8_epi32(_mm512_extracti32x4_epi32(idx, 1)); break;
+            case 2:  p32 = _mm512_cvtepu8_epi32(_mm512_extracti32x4_epi32(p, 2)); i32 = _mm512_cvtepu8_epi32(_mm512_extracti32x4_epi32(idx, 2)); break;
+            default: p32 = _mm512_cvtepu8_epi32(_mm512_extracti32x4_epi32(p, 3)); i32 = _mm512_cvtepu8_epi32(_mm512_extracti32x4_epi32(idx, 3)); break;
+            }
+            __m512i offsets = _mm512_add_epi32(_mm512_mullo_epi32(p32, row_size), i32);
+            const void* base = states + (j + before) * 26;
+            b[q] = _mm512_cvtepi32_epi8(_mm512_i32gather_epi32(offsets, base, 1));
+            before += (size_t)__builtin_popcount((unsigned)((letters >> (16 * q)) & 0xFFFF));
+        }
+        __m512i r = _mm512_castsi128_si512(b[0]);
+        r = _mm512_inserti32x4(r, b[1], 1);
+        r = _mm512_inserti32x4(r, b[2], 2);
+        r = _mm512_inserti32x4(r, b[3], 3);
+        j = wrap_state(ck, j + before);
+
+        r = _mm512_add_epi8(r, _mm512_mask_blend_epi8(lo, upper_a, lower_a));
+        _mm512_storeu_si512((void*)(out + i), _mm512_mask_blend_epi8(letters, v, r));
+    }
+    return period_kernel_avx2(ck, j, in + i, out + i, len - i);
+}
+
+/* The pass-through scans classify a block at once and stop at its first letter */
+__attribute__((target("sse4.1")))
+static size_t passthrough_sse4(const char* in, size_t len) {
+    const __m128i case_bit = _mm_set1_epi8(0x20), lower_a = _mm_set1_epi8('a');
+    const __m128i space = _mm_set1_epi8(' '), max_index = _mm_set1_epi8(25);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(in + i));
+        __m128i ci = _mm_sub_epi8(_mm_or_si128(v, case_bit), lower_a);
+        __m128i letters = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(ci, max_index), ci), _mm_cmpeq_epi8(v, space));
+        unsigned mask = (unsigned)_mm_movemask_epi8(letters);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + passthrough_scalar(in + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t passthrough_avx2(const char* in, size_t len) {
+    const __m256i case_bit = _mm256_set1_epi8(0x20), lower_a = _mm256_set1_epi8('a');
+    const __m256i space = _mm256_set1_epi8(' '), max_index = _mm256_set1_epi8(25);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(in + i));
+        __m256i ci = _mm256_sub_epi8(_mm256_or_si256(v, case_bit), lower_a);
+        __m256i letters = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(ci, max_index), ci), _mm256_cmpeq_epi8(v, space));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(letters);
+        if (mask) return i + (size_t)__builtin_ctz(mask);
+    }
+    return i + passthrough_sse4(in + i, len - i);
+}
+
+#endif /* HAVE_X86_KERNELS */
+
+static PassthroughScan passthrough_scan;
+static pthread_once_t passthrough_once = PTHREAD_ONCE_INIT;
+
+static void choose_passthrough_scan(void) {
+    passthrough_scan = passthrough_scalar;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) passthrough_scan = passthrough_avx2;
+    else if (__builtin_cpu_supports("sse4.1")) passthrough_scan = passthrough_sse4;
+#endif
+}
+
+PassthroughScan select_passthrough_scan(void) {
+    pthread_once(&passthrough_once, choose_passthrough_scan);
+    return passthrough_scan;
+}
+
+PeriodKernel find_period_kernel(const char* name) {
+    if (!name) return NULL;
+    if (strcmp(name, "scalar") == 0) return period_kernel_scalar;
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (strcmp(name, "sse4") == 0 && __builtin_cpu_supports("sse4.1")) return period_kernel_sse4;
+    if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) return period_kernel_avx2;
+    if (strcmp(name, "avx512") == 0 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return period_kernel_avx512;
+#endif
+    return NULL;
+}
+
+static PeriodKernel period_kernel;
+static pthread_once_t period_once = PTHREAD_ONCE_INIT;
+
+static void choose_period_kernel(void) {
+    period_kernel = find_period_kernel(getenv("ENIGMA_KERNEL"));
+    if (!period_kernel) period_kernel = find_period_kernel(engine_kernel());
+
+    static const char* const preference[] = { "avx512", "avx2", "sse4" };
+    for (size_t i = 0; !period_kernel && i < sizeof(preference) / sizeof(preference[0]); ++i) {
+        period_kernel = find_period_kernel(preference[i]);
+    }
+    if (!period_kernel) period_kernel = period_kernel_scalar;
+}
+
+PeriodKernel select_period_kernel(void) {
+    pthread_once(&period_once, choose_period_kernel);
+    return period_kernel;
+}
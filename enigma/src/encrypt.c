@@ -1,144 +1,124 @@
 #include "../include/config.h"
 #include "../include/encrypt.h"
+#include "../include/key-compiler.h"
+#include "../include/encrypt-simd.h"
+#include "../include/engine.h"
+#include "../include/parallel.h"
+#include "../include/stats.h"
 
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <stdbool.h>
 
-/* Utility: modulo that handles negative values correctly */
-static inline int mod26(int x) {
-    int r = x % 26;
-    if (r < 0) r += 26;
-    return r;
-}
+/* Stepping path for keys without a period table: the slow rotors are fused into one
+   table that is rebuilt only when they move, the fast rotor comes from entry/exit.
+   Instantiated below for fixed rotor counts so stepping and rebuilds unroll.
+   Runs of pass-through bytes are found by a vector scan and copied at once (or left
+   alone when enciphering in place), so the cost follows the letters, not the bytes. */
+static FORCE_INLINE void encrypt_stepping(const CompiledKey* ck, unsigned char* positions, const char* in, char* out, size_t len, size_t n) {
+    unsigned char inner[26];
+    bool stale = true;
+    PassthroughScan scan = NULL;
 
-/* Apply plugboard transformation (before and after rotor stack) */
-static int apply_plugboard(const Config* config, int val) {
-    if (!config || !config->key || val < 0 || val >= 26) return val;
-    const Plugboard* p = &config->key->plugboard_settings;
-    int mapped = (int)(*p)[val];
-    if (mapped >= 0 && mapped < 26) return mapped;
-    return val;
-}
+    for (size_t i = 0; i < len; ++i) {
+        int upper;
+        int idx = cipher_index((unsigned char)in[i], &upper);   // spaces to X
+        if (idx < 0) {                          // only allow characters
+            /* A lone punctuation mark is cheaper to copy than to scan past */
+            if (i + 1 == len || cipher_index((unsigned char)in[i + 1], &upper) >= 0) {
+                out[i] = in[i];
+                continue;
+            }
+            if (!scan) scan = select_passthrough_scan();
+            size_t run = scan(in + i, len - i);
+            if (out != in) memcpy(out + i, in + i, run);
+            i += run - 1;
+            continue;
+        }
 
-/* 
- * Pass through rotor stack forward (left to right).
- * Each rotor applies its wiring, adjusted for position and ring setting.
- * Position: current rotor position (0-25)
- * Ring setting: offset applied to both entry and exit (0-25)
- */
-static int pass_through_rotors_forward(const Config* config, int val) {
-    if (!config || !config->key || val < 0 || val >= 26) return val;
-    const Key* k = config->key;
-    
-    for (size_t i = 0; i < k->rotor_count; ++i) {
-        const Rotor* rotor = &k->rotors[i];
-        int pos = (int)rotor->position;
-        int ring = (int)k->ring_settings[i];
-        
-        /* Adjust for rotor position and ring setting on entry */
-        int entry = mod26(val + pos - ring);
-        
-        /* Apply rotor's internal wiring */
-        int output = (int)rotor->wiring[entry];
-        
-        /* Adjust for rotor position and ring setting on exit */
-        val = mod26(output - pos + ring);
+        if (step_positions(ck->notches, n, positions) || stale) {
+            compile_inner_table(ck, positions, inner, n);
+            stale = false;
+        }
+        int fast = positions[0];
+        idx = ck->exit[fast][inner[ck->entry[fast][idx]]];
+        out[i] = (char)((upper ? 'A' : 'a') + idx);
     }
-    
-    return val;
 }
 
-/* Pass through reflector (applies symmetric wiring) */
-static int pass_through_reflector(const Config* config, int val) {
-    if (!config || !config->key || !config->key->reflector || val < 0 || val >= 26) 
-        return val;
-    const Reflector* refl = config->key->reflector;
-    return (int)refl->wiring[val];
+static void encrypt_stepping_m3(const CompiledKey* ck, unsigned char* p, const char* in, char* out, size_t len) { encrypt_stepping(ck, p, in, out, len, 3); }
+static void encrypt_stepping_m4(const CompiledKey* ck, unsigned char* p, const char* in, char* out, size_t len) { encrypt_stepping(ck, p, in, out, len, 4); }
+static void encrypt_stepping_generic(const CompiledKey* ck, unsigned char* p, const char* in, char* out, size_t len) { encrypt_stepping(ck, p, in, out, len, ck->rotor_count); }
+
+void encrypt_buffer(const CompiledKey* ck, RotorState* state, const char* in, char* out, size_t len) {
+    if (!ck || !state || !in || !out) return;
+    unsigned char* positions = state->positions;
+    uint64_t t0 = 0;
+    if (STATS_ON) {
+        stats_count_chars(in, len);
+        t0 = stats_clock();
+    }
+
+    /* Keys without rotors always have a (single state) period table */
+    size_t j = lookup_state(ck, positions);
+    if (j != STATE_NONE) {
+        j = select_period_kernel()(ck, j, in, out, len);
+        memcpy(positions, ck->state_positions + j * ck->rotor_count, ck->rotor_count);
+        if (STATS_ON) stats_add_time(STATS_CIPHER, t0);
+        return;
+    }
+
+    /* The plugboard is folded into entry/exit here, so plugged and unplugged keys share a path */
+    switch (ck->variant) {
+    case KEY_VARIANT_M3: case KEY_VARIANT_M3_UNPLUGGED: encrypt_stepping_m3(ck, positions, in, out, len); break;
+    case KEY_VARIANT_M4: case KEY_VARIANT_M4_UNPLUGGED: encrypt_stepping_m4(ck, positions, in, out, len); break;
+    default: encrypt_stepping_generic(ck, positions, in, out, len); break;
+    }
+    if (STATS_ON) stats_add_time(STATS_CIPHER, t0);
 }
 
-/* 
- * Pass through rotor stack backward (right to left).
- * Rotors are traversed in reverse order with inverse wiring.
- */
-static int pass_through_rotors_backward(const Config* config, int val) {
-    if (!config || !config->key || val < 0 || val >= 26) return val;
-    const Key* k = config->key;
-    
-    if (k->rotor_count == 0) return val;
-    
-    for (size_t i = k->rotor_count; i-- > 0;) {
-        const Rotor* rotor = &k->rotors[i];
-        int pos = (int)rotor->position;
-        int ring = (int)k->ring_settings[i];
-        
-        /* Adjust for rotor position and ring setting on entry */
-        int entry = mod26(val + pos - ring);
-        
-        /* Find inverse: which input to wiring[x] gives us entry? */
-        int output = -1;
-        for (int j = 0; j < 26; ++j) {
-            if (rotor->wiring[j] == entry) {
-                output = j;
-                break;
-            }
-        }
-        if (output < 0) output = entry;  // fallback
-        
-        /* Adjust for rotor position and ring setting on exit */
-        val = mod26(output - pos + ring);
+uint64_t count_letters(const char* in, size_t len) {
+    uint64_t count = 0;
+    for (size_t i = 0; i < len; ++i) {
+        int upper;
+        if (cipher_index((unsigned char)in[i], &upper) >= 0) ++count;
     }
-    
-    return val;
+    return count;
+}
+
+int encrypt_seek(const Key* key, RotorState* state, uint64_t letters) {
+    if (!key || !state) return 1;
+    if (!key->compiled) return 2;
+    seek_rotors(key->compiled, state->positions, letters);
+    return 0;
 }
 
 void encrypt(Config* config) {
-    if (!config || !config->input) return;
+    if (!config || !config->input || !config->key || !config->key->compiled) return;
+    const Key* k = config->key;
 
     const char* in = config->input;
-    size_t len = strlen(in);
+    size_t len = config->input_len ? config->input_len : strlen(in);
 
     char* out = config->out_buffer;
     bool allocated = false;
     if (!out) {
-        out = (char*)malloc(len + 1);
+        out = arena_alloc(&config->arena, len + 1);
         if (!out) return;
         allocated = true;
     }
 
-    for (size_t i = 0; i < len; ++i) {
-        char c = in[i];
-        if (c == ' ') c = 'X';                  // spaces to X
-        else if (!isalpha((unsigned char)c)) {  // only allow characters
-            out[i] = c;
-            continue;
-        }
-
-        bool is_upper = isupper((unsigned char)c);
-        int idx = (toupper((unsigned char)c) - 'A');    // convert ASCII to char 0 - 25
-
-
-        idx = apply_plugboard(config, idx);
-
-
-        idx = pass_through_rotors_forward(config, idx);
-
-
-        idx = pass_through_reflector(config, idx);
-
-
-        idx = pass_through_rotors_backward(config, idx);
-
-
-        idx = apply_plugboard(config, idx);
-
-        char outch = (char)('A' + idx);
-        if (!is_upper) outch = (char)tolower((unsigned char)outch);
-        out[i] = outch;
+    ThreadPool* pool = NULL;
+    if (engine_parallel(config->threads, len)) pool = thread_pool_create(config->threads);
+    if (pool) {
+        encrypt_parallel(pool, k->compiled, &config->state, in, out, len);
+        thread_pool_destroy(pool);
+    } else {
+        encrypt_buffer(k->compiled, &config->state, in, out, len);
     }
 
     out[len] = '\0';
+    config->out_len = len;
 
     if (allocated) config->out_buffer = out;
 }
@@ -0,0 +1,314 @@
+#include "../include/engine.h"
+#include "../include/encrypt.h"
+#include "../include/encrypt-simd.h"
+#include "../include/key-parser.h"
+#include "../include/parallel.h"
+#include "../include/stats.h"
+#include "../include/thread-pool.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+/* Period kernels by name, fastest first when the CPU runs them all */
+static const char* const KERNEL_NAMES[] = { "avx512", "avx2", "sse4", "scalar" };
+#define KERNEL_COUNT (sizeof(KERNEL_NAMES) / sizeof(KERNEL_NAMES[0]))
+
+/* Thresholds without a profile, as engine_tune() measured them on an AVX-512 machine
+   with a 2 MB L2 cache. Every rotor makes the period table 26 times larger to build
+   while it saves about the same per letter, so the crossover moves up just as fast. */
+static const uint64_t DEFAULT_PERIOD_MIN_BYTES[PERIOD_TABLE_MAX_ROTORS + 1] = { 0, 512, 8 * 1024, 384 * 1024 };
+
+static EngineProfile profile;
+static pthread_once_t profile_once = PTHREAD_ONCE_INIT;
+static char profile_path[4096];
+static pthread_once_t path_once = PTHREAD_ONCE_INIT;
+
+static void default_profile(EngineProfile* p) {
+    memset(p, 0, sizeof(*p));
+    engine_host(&p->host);
+    memcpy(p->period_min_bytes, DEFAULT_PERIOD_MIN_BYTES, sizeof(p->period_min_bytes));
+    p->parallel_min_bytes = PARALLEL_CHUNK_SIZE;
+}
+
+static void find_profile_path(void) {
+    const char* env = getenv("ENIGMA_PROFILE");
+    if (env) {
+        snprintf(profile_path, sizeof(profile_path), "%s", env);
+        return;
+    }
+#ifdef WIN32
+    const char* home = getenv("USERPROFILE");
+#else
+    const char* home = getenv("HOME");
+#endif
+    if (home && *home) snprintf(profile_path, sizeof(profile_path), "%s/%s", home, ENGINE_PROFILE_NAME);
+}
+
+static void load_profile(void) {
+    pthread_once(&path_once, find_profile_path);
+    default_profile(&profile);
+    if (!profile_path[0]) return;
+
+    EngineProfile loaded;
+    int rc = read_engine_profile(profile_path, &loaded);
+    if (rc == 0) {
+        profile = loaded;
+        profile.tuned = 1;
+    } else if (rc == 12) {
+        fprintf(stderr, "Warning: %s was tuned on another machine, using default engine thresholds (run enigma --tune)\n", profile_path);
+    } else if (rc != -1) {
+        fprintf(stderr, "Warning: %s is not an engine profile, using default engine thresholds\n", profile_path);
+    }
+}
+
+const EngineProfile* engine_profile(void) {
+    pthread_once(&profile_once, load_profile);
+    return &profile;
+}
+
+void engine_load(void) {
+    engine_profile();
+    select_period_kernel();
+}
+
+const char* engine_profile_path(void) {
+    pthread_once(&path_once, find_profile_path);
+    return profile_path[0] ? profile_path : NULL;
+}
+
+void engine_host(EngineHost* host) {
+    memset(host, 0, sizeof(*host));
+    for (size_t i = 0; i < KERNEL_COUNT; ++i) {
+        if (!find_period_kernel(KERNEL_NAMES[i])) continue;
+        size_t used = strlen(host->features);
+        snprintf(host->features + used, sizeof(host->features) - used, "%s%s", used ? "," : "", KERNEL_NAMES[i]);
+    }
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+    long cache = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    host->cache_bytes = cache > 0 ? (size_t)cache : 0;
+#endif
+    host->cpus = thread_pool_cpu_count();
+}
+
+unsigned engine_compile_flags(size_t rotor_count, uint64_t bytes) {
+    /* Keys without rotors always get their single state; 4 rotors never get a table */
+    if (bytes == ENGINE_SIZE_UNKNOWN || rotor_count == 0 || rotor_count > PERIOD_TABLE_MAX_ROTORS) return 0;
+    return bytes < engine_profile()->period_min_bytes[rotor_count] ? COMPILE_NO_PERIOD_TABLE : 0;
+}
+
+int engine_parallel(size_t threads, size_t len) {
+    return threads > 1 && len > engine_profile()->parallel_min_bytes;
+}
+
+const char* engine_kernel(void) {
+    const EngineProfile* p = engine_profile();
+    return p->kernel[0] ? p->kernel : NULL;
+}
+
+/* A threshold of the profile: a byte count, or "never" */
+static int parse_threshold(const char* s, uint64_t* out) {
+    if (strcmp(s, "never") == 0) { *out = UINT64_MAX; return 0; }
+    char* end = NULL;
+    errno = 0;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (!end || end == s || *end || errno || s[0] == '-') return 1;
+    *out = (uint64_t)v;
+    return 0;
+}
+
+static char* trim(char* s) {
+    while (*s == ' ' || *s == '\t') ++s;
+    char* e = s + strlen(s);
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r' || e[-1] == '\n')) *--e = '\0';
+    return s;
+}
+
+int read_engine_profile(const char* path, EngineProfile* p) {
+    FILE* f = fopen(path, "r");
+    if (!f) return -1;
+    default_profile(p);
+    EngineHost tuned_on;
+    memset(&tuned_on, 0, sizeof(tuned_on));
+
+    /* Same key=value lines as key files; unknown keys are left for later versions */
+    char line[256];
+    uint64_t version = 0, v;
+    int bad = 0;
+    while (fgets(line, sizeof(line), f)) {
+        char* s = trim(line);
+        if (*s == '\0' || *s == '#') continue;
+        char* eq = strchr(s, '=');
+        if (!eq) { bad = 1; break; }
+        *eq = '\0';
+        char* key = trim(s);
+        char* val = trim(eq + 1);
+        if (strcasecmp(key, "version") == 0) bad |= parse_threshold(val, &version);
+        else if (strcasecmp(key, "features") == 0) snprintf(tuned_on.features, sizeof(tuned_on.features), "%s", val);
+        else if (strcasecmp(key, "cache") == 0) { bad |= parse_threshold(val, &v); tuned_on.cache_bytes = (size_t)v; }
+        else if (strcasecmp(key, "cpus") == 0) { bad |= parse_threshold(val, &v); tuned_on.cpus = (size_t)v; }
+        else if (strcasecmp(key, "kernel") == 0) snprintf(p->kernel, sizeof(p->kernel), "%s", val);
+        else if (strcasecmp(key, "parallel") == 0) { bad |= parse_threshold(val, &v); p->parallel_min_bytes = v > SIZE_MAX ? SIZE_MAX : (size_t)v; }
+        else if (strncasecmp(key, "period", 6) == 0 && key[6] >= '1' && key[6] <= '0' + PERIOD_TABLE_MAX_ROTORS && !key[7])
+            bad |= parse_threshold(val, &p->period_min_bytes[key[6] - '0']);
+    }
+    fclose(f);
+    if (bad || version != ENGINE_PROFILE_VERSION) return 11;
+    if (strcmp(tuned_on.features, p->host.features) != 0 || tuned_on.cache_bytes != p->host.cache_bytes || tuned_on.cpus != p->host.cpus) return 12;
+    return 0;
+}
+
+static void write_threshold(FILE* f, const char* key, uint64_t v) {
+    if (v == UINT64_MAX) fprintf(f, "%s=never\n", key);
+    else fprintf(f, "%s=%llu\n", key, (unsigned long long)v);
+}
+
+int write_engine_profile(FILE* f, const EngineProfile* p) {
+    fprintf(f, "# enigma engine profile, written by enigma --tune\n");
+    fprintf(f, "version=%d\n", ENGINE_PROFILE_VERSION);
+    fprintf(f, "# host the thresholds were measured on\n");
+    fprintf(f, "features=%s\ncache=%zu\ncpus=%zu\n", p->host.features, p->host.cache_bytes, p->host.cpus);
+    fprintf(f, "# period kernel, and messages of at least periodN bytes get a period table with N rotors\n");
+    fprintf(f, "kernel=%s\n", p->kernel);
+    for (size_t n = 1; n <= PERIOD_TABLE_MAX_ROTORS; ++n) {
+        char key[16];
+        snprintf(key, sizeof(key), "period%zu", n);
+        write_threshold(f, key, p->period_min_bytes[n]);
+    }
+    fprintf(f, "# with -j, messages of more than this many bytes are split across threads\n");
+    write_threshold(f, "parallel", p->parallel_min_bytes);
+    return ferror(f) ? 2 : 0;
+}
+
+/* Keys tuned with, by rotor count: standard rotors, plugged as is usual */
+static const char* const TUNE_ROTORS[PERIOD_TABLE_MAX_ROTORS + 1] = { NULL, "2", "2,5", "2,5,8" };
+static const char* const TUNE_RINGS[PERIOD_TABLE_MAX_ROTORS + 1] = { NULL, "C", "C,Q", "C,Q,K" };
+#define TUNE_PLUGBOARD "AB,CD,EF,GH,IJ,KL"
+
+/* Runs of each measurement: the fastest counts, the others are noise */
+#define TUNE_REPEATS 7
+
+/* Text enciphered per run: at least this, and larger than the L2 cache, so that the
+   period table competes with the message for the cache as it does in real use */
+#define TUNE_MIN_BYTES (1 << 20)
+
+/* Fastest of TUNE_REPEATS runs of a compile, in ns */
+static uint64_t time_compile(const Key* k, unsigned flags) {
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < TUNE_REPEATS; ++r) {
+        uint64_t t0 = stats_clock();
+        CompiledKey* ck = compile_key_flags_in(NULL, k, flags);
+        uint64_t t = stats_clock() - t0;
+        if (!ck) return UINT64_MAX;
+        free_compiled_key(ck);
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+/* Fastest of TUNE_REPEATS runs of the stepping path (kernel NULL) or a period kernel, in ns */
+static uint64_t time_cipher(const CompiledKey* ck, PeriodKernel kernel, const RotorState* start, const char* in, char* out, size_t len) {
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < TUNE_REPEATS; ++r) {
+        RotorState state = *start;
+        uint64_t t0 = stats_clock();
+        if (kernel) kernel(ck, lookup_state(ck, state.positions), in, out, len);
+        else encrypt_buffer(ck, &state, in, out, len);
+        uint64_t t = stats_clock() - t0;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+static void idle_task(void* arg, size_t index) {
+    (void)arg;
+    (void)index;
+}
+
+/* Fastest of TUNE_REPEATS pools of 2 threads started, run once and stopped, in ns */
+static uint64_t time_pool(void) {
+    uint64_t best = UINT64_MAX;
+    for (int r = 0; r < TUNE_REPEATS; ++r) {
+        uint64_t t0 = stats_clock();
+        ThreadPool* pool = thread_pool_create(2);
+        if (!pool) return UINT64_MAX;
+        thread_pool_run(pool, 2, idle_task, NULL);
+        thread_pool_destroy(pool);
+        uint64_t t = stats_clock() - t0;
+        if (t < best) best = t;
+    }
+    return best;
+}
+
+int engine_tune(EngineProfile* p, FILE* report) {
+    default_profile(p);
+    size_t len = p->host.cache_bytes * 4 > TUNE_MIN_BYTES ? p->host.cache_bytes * 4 : TUNE_MIN_BYTES;
+    char* in = malloc(len);
+    char* out = malloc(len);
+    if (!in || !out) { free(in); free(out); return 3; }
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < len; ++i) {
+        seed = seed * 6364136223846793005ull + 1442695040888963407ull;
+        in[i] = (char)('A' + (seed >> 33) % 26);
+    }
+    if (report) fprintf(report, "Host: kernels %s, L2 cache %zu KB, %zu processors; %zu KB of text per run\n",
+                        p->host.features, p->host.cache_bytes / 1024, p->host.cpus, len / 1024);
+
+    /* Kernels on the largest period table, which is where they differ most */
+    int rc = 0;
+    double period_ns[PERIOD_TABLE_MAX_ROTORS + 1] = { 0 };
+    uint64_t best_kernel = UINT64_MAX;
+    for (size_t n = PERIOD_TABLE_MAX_ROTORS; n >= 1 && rc == 0; --n) {
+        Key* k = parse_key_components_quick("1", TUNE_ROTORS[n], TUNE_RINGS[n], TUNE_PLUGBOARD);
+        CompiledKey* full = k ? compile_key_flags_in(NULL, k, 0) : NULL;
+        if (!full) { free_key(k); rc = 3; break; }
+
+        PeriodKernel kernel = NULL;
+        if (n == PERIOD_TABLE_MAX_ROTORS) {
+            for (size_t i = 0; i < KERNEL_COUNT; ++i) {
+                PeriodKernel candidate = find_period_kernel(KERNEL_NAMES[i]);
+                if (!candidate) continue;
+                uint64_t t = time_cipher(full, candidate, &k->start, in, out, len);
+                if (report) fprintf(report, "Kernel %-6s  %6.3f ns/byte\n", KERNEL_NAMES[i], (double)t / (double)len);
+                if (t < best_kernel) {
+                    best_kernel = t;
+                    snprintf(p->kernel, sizeof(p->kernel), "%s", KERNEL_NAMES[i]);
+                }
+            }
+        }
+        kernel = find_period_kernel(p->kernel);
+
+        /* The table pays off once the time it saves per byte has made up for building it */
+        uint64_t build = time_compile(k, 0), quick = time_compile(k, COMPILE_NO_PERIOD_TABLE);
+        uint64_t stepping = time_cipher(k->compiled, NULL, &k->start, in, out, len);
+        uint64_t period = time_cipher(full, kernel, &k->start, in, out, len);
+        double saved = ((double)stepping - (double)period) / (double)len;
+        period_ns[n] = (double)period / (double)len;
+        p->period_min_bytes[n] = saved > 0 && build > quick ? (uint64_t)((double)(build - quick) / saved) + 1 : build > quick ? UINT64_MAX : 0;
+        if (report) {
+            fprintf(report, "%zu rotor%s: key %8.1f us with period table, %6.1f us without; %6.3f ns/byte against %6.3f: ",
+                    n, n == 1 ? " " : "s", (double)build / 1e3, (double)quick / 1e3, period_ns[n], (double)stepping / (double)len);
+            if (p->period_min_bytes[n] == UINT64_MAX) fprintf(report, "never pays off\n");
+            else fprintf(report, "pays off from %llu bytes\n", (unsigned long long)p->period_min_bytes[n]);
+        }
+        free_compiled_key(full);
+        free_key(k);
+    }
+
+    /* Splitting saves at least half the time with 2 threads or more: that has to cover the pool */
+    if (rc == 0) {
+        uint64_t pool = time_pool();
+        double per_byte = period_ns[PERIOD_TABLE_MAX_ROTORS];
+        double crossover = per_byte > 0 && pool != UINT64_MAX ? 2.0 * (double)pool / per_byte : (double)SIZE_MAX;
+        p->parallel_min_bytes = crossover > (double)PARALLEL_CHUNK_SIZE ? (crossover < (double)SIZE_MAX ? (size_t)crossover : SIZE_MAX) : PARALLEL_CHUNK_SIZE;
+        if (report) fprintf(report, "Thread pool: %.1f us to start and stop: split from %zu KB\n", (double)pool / 1e3, p->parallel_min_bytes / 1024);
+    }
+
+    free(in);
+    free(out);
+    return rc;
+}
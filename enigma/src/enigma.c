@@ -0,0 +1,142 @@
+#include "../include/enigma.h"
+#include "../include/config.h"
+#include "../include/encrypt.h"
+#include "../include/key-compiler.h"
+#include "../include/key-image.h"
+#include "../include/key-parser.h"
+#include "../include/multi.h"
+#include "../include/stats.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* The public types stand for the internal ones: an EnigmaKey is a Key, and an
+   EnigmaStream holds the positions of a RotorState, copied in and out per call */
+_Static_assert(ENIGMA_MAX_ROTORS == MAX_ROTORS, "EnigmaStream must hold every rotor");
+
+static const Key* key_of(const EnigmaKey* key) {
+    return (const Key*)key;
+}
+
+struct EnigmaContext {
+    EnigmaKey* key;                     // opened key, owned by the context
+    EnigmaStream stream;                // rotor state of the current message
+};
+
+EnigmaKey* enigma_key_open_file(const char* path) {
+    return (EnigmaKey*)load_key_file(path);
+}
+
+EnigmaKey* enigma_key_open(const char* reflector, const char* rotors, const char* rings, const char* plugboard) {
+    return (EnigmaKey*)parse_key_components(reflector, rotors, rings, plugboard);
+}
+
+EnigmaKey* enigma_key_open_quick(const char* reflector, const char* rotors, const char* rings, const char* plugboard) {
+    return (EnigmaKey*)parse_key_components_quick(reflector, rotors, rings, plugboard);
+}
+
+void enigma_key_close(EnigmaKey* key) {
+    free_key((Key*)key);
+}
+
+void enigma_stream_init(const EnigmaKey* key, EnigmaStream* stream) {
+    if (!key || !stream) return;
+    memcpy(stream->positions, key_of(key)->start.positions, sizeof(stream->positions));
+}
+
+int enigma_stream_process(const EnigmaKey* key, EnigmaStream* stream, const char* in, size_t len, char* out) {
+    if (!key || !stream || (len && (!in || !out))) return 1;
+    RotorState state;
+    memcpy(state.positions, stream->positions, sizeof(state.positions));
+    encrypt_buffer(key_of(key)->compiled, &state, in, out, len);
+    memcpy(stream->positions, state.positions, sizeof(stream->positions));
+    return 0;
+}
+
+/* Jobs are handed to encrypt_multi this many at a time */
+#define MANY_BATCH 256
+
+int enigma_process_many(const EnigmaJob* jobs, size_t count) {
+    if (!jobs && count) return 1;
+    for (size_t i = 0; i < count; ++i) {
+        const EnigmaJob* job = &jobs[i];
+        if (!job->key || !key_of(job->key)->compiled || !job->stream || (job->len && (!job->in || !job->out))) return 1;
+    }
+
+    MultiJob batch[MANY_BATCH];
+    RotorState states[MANY_BATCH];
+    for (size_t done = 0; done < count;) {
+        size_t n = count - done < MANY_BATCH ? count - done : MANY_BATCH;
+        for (size_t i = 0; i < n; ++i) {
+            const EnigmaJob* job = &jobs[done + i];
+            memcpy(states[i].positions, job->stream->positions, sizeof(states[i].positions));
+            batch[i] = (MultiJob){ key_of(job->key)->compiled, &states[i], job->in, job->out, job->len };
+        }
+        encrypt_multi(batch, n);
+        for (size_t i = 0; i < n; ++i) {
+            memcpy(jobs[done + i].stream->positions, states[i].positions, sizeof(states[i].positions));
+        }
+        done += n;
+    }
+    return 0;
+}
+
+void enigma_stream_seek(const EnigmaKey* key, EnigmaStream* stream, uint64_t letters) {
+    if (!key || !stream) return;
+    RotorState state = key_of(key)->start;
+    encrypt_seek(key_of(key), &state, letters);
+    memcpy(stream->positions, state.positions, sizeof(stream->positions));
+}
+
+static EnigmaContext* open_context(EnigmaKey* key) {
+    EnigmaContext* ctx = key ? malloc(sizeof(*ctx)) : NULL;
+    if (!ctx) { enigma_key_close(key); return NULL; }
+    ctx->key = key;
+    enigma_stream_init(key, &ctx->stream);
+    return ctx;
+}
+
+EnigmaContext* enigma_open_key_file(const char* path) {
+    return open_context(enigma_key_open_file(path));
+}
+
+EnigmaContext* enigma_open_key(const char* reflector, const char* rotors, const char* rings, const char* plugboard) {
+    return open_context(enigma_key_open(reflector, rotors, rings, plugboard));
+}
+
+int enigma_process(EnigmaContext* ctx, const char* in, size_t len, char* out) {
+    if (!ctx) return 1;
+    return enigma_stream_process(ctx->key, &ctx->stream, in, len, out);
+}
+
+void enigma_seek(EnigmaContext* ctx, uint64_t letters) {
+    if (!ctx) return;
+    enigma_stream_seek(ctx->key, &ctx->stream, letters);
+}
+
+void enigma_reset(EnigmaContext* ctx) {
+    if (!ctx) return;
+    enigma_stream_init(ctx->key, &ctx->stream);
+}
+
+void enigma_close(EnigmaContext* ctx) {
+    if (!ctx) return;
+    enigma_key_close(ctx->key);
+    free(ctx);
+}
+
+void enigma_stats_enable(int on) {
+    stats_enable(on);
+}
+
+void enigma_stats_reset(void) {
+    stats_reset();
+}
+
+void enigma_stats_get(EnigmaStats* stats) {
+    stats_get(stats);
+}
+
+void enigma_stats_report(FILE* f, int json) {
+    stats_report(f, json ? STATS_JSON : STATS_TEXT);
+}
@@ -0,0 +1,343 @@
+#include "../include/key-compiler.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Utility: modulo that handles negative values correctly */
+static inline int mod26(int x) {
+    int r = x % 26;
+    if (r < 0) r += 26;
+    return r;
+}
+
+void invert_wiring(const unsigned char wiring[26], unsigned char inverse[26]) {
+    for (int e = 0; e < 26; ++e) inverse[e] = (unsigned char)e;
+    for (int j = 25; j >= 0; --j) {
+        if (wiring[j] < 26) inverse[wiring[j]] = (unsigned char)j;
+    }
+}
+
+static ShiftedRotors shifted;
+static pthread_once_t shifted_once = PTHREAD_ONCE_INIT;
+
+static void build_shifted_rotors(void) {
+    for (int t = 0; t < ROTOR_TYPES; ++t) {
+        unsigned char inverse[26];
+        invert_wiring(ROTOR_WIRINGS[t], inverse);
+        for (int o = 0; o < SHIFTED_ROWS; ++o) {
+            for (int v = 0; v < 26; ++v) {
+                int entry = (v + o) % 26;
+                shifted.forward[t][o][v] = (unsigned char)mod26((int)ROTOR_WIRINGS[t][entry] - o);
+                shifted.backward[t][o][v] = (unsigned char)mod26((int)inverse[entry] - o);
+            }
+        }
+    }
+    memcpy(shifted.reflectors[0], REFLECTOR_B, 26);
+    memcpy(shifted.reflectors[1], REFLECTOR_C, 26);
+    for (int v = 0; v < 26; ++v) shifted.reflectors[2][v] = (unsigned char)v;
+}
+
+const ShiftedRotors* shifted_rotors(void) {
+    pthread_once(&shifted_once, build_shifted_rotors);
+    return &shifted;
+}
+
+/* Type (0-7) of a rotor wired as a standard one, or -1 */
+static int standard_rotor(const Rotor* rotor) {
+    for (int t = 0; t < ROTOR_TYPES; ++t) {
+        if (memcmp(rotor->wiring, ROTOR_WIRINGS[t], 26) == 0) return t;
+    }
+    return -1;
+}
+
+/* Row of the shared table for a reflector wired as a standard one (or missing), or -1 */
+static int standard_reflector(const Reflector* reflector) {
+    if (!reflector) return 2;
+    if (memcmp(reflector->wiring, REFLECTOR_B, 26) == 0) return 0;
+    if (memcmp(reflector->wiring, REFLECTOR_C, 26) == 0) return 1;
+    return -1;
+}
+
+static size_t encode_positions(const unsigned char* p, size_t n) {
+    size_t code = 0;
+    for (size_t i = n; i-- > 0;) code = code * 26 + p[i];
+    return code;
+}
+
+/*
+ * Follow the stepping sequence from start until a state repeats. Writes every state
+ * visited to seq (n bytes each) and its number to index; returns the number of states
+ * and the index of the first state of the cycle in *cycle_start.
+ */
+static size_t trace_period(const unsigned char* notches, size_t n, const unsigned char* start,
+                           unsigned char* seq, unsigned short* index, size_t* cycle_start) {
+    unsigned char p[MAX_ROTORS];
+    memcpy(p, start, n);
+    size_t count = 0;
+    for (;;) {
+        size_t code = encode_positions(p, n);
+        if (index[code] != STATE_NONE) { *cycle_start = index[code]; return count; }
+        index[code] = (unsigned short)count;
+        memcpy(seq + count * n, p, n);
+        ++count;
+        step_positions(notches, n, p);
+    }
+}
+
+/* compile_state_table() body; with n and plugged constant the rotor loops unroll and
+   an unplugged key skips both plugboard lookups */
+static FORCE_INLINE void fuse_state(const CompiledKey* ck, const unsigned char* positions, unsigned char out[26],
+                                    size_t n, int plugged) {
+    for (int c = 0; c < 26; ++c) {
+        int v = plugged ? ck->plugboard[c] : c;
+        for (size_t i = 0; i < n; ++i) v = ck->forward[i][positions[i]][v];
+        v = ck->reflector[v];
+        for (size_t i = n; i-- > 0;) v = ck->backward[i][positions[i]][v];
+        out[c] = plugged ? ck->plugboard[v] : (unsigned char)v;
+    }
+}
+
+static void fuse_state_m3(const CompiledKey* ck, const unsigned char* p, unsigned char out[26]) { fuse_state(ck, p, out, 3, 1); }
+static void fuse_state_m3_unplugged(const CompiledKey* ck, const unsigned char* p, unsigned char out[26]) { fuse_state(ck, p, out, 3, 0); }
+static void fuse_state_m4(const CompiledKey* ck, const unsigned char* p, unsigned char out[26]) { fuse_state(ck, p, out, 4, 1); }
+static void fuse_state_m4_unplugged(const CompiledKey* ck, const unsigned char* p, unsigned char out[26]) { fuse_state(ck, p, out, 4, 0); }
+
+static void fuse_state_generic(const CompiledKey* ck, const unsigned char* p, unsigned char out[26]) { fuse_state(ck, p, out, ck->rotor_count, 1); }
+
+typedef void (*FuseState)(const CompiledKey* ck, const unsigned char* positions, unsigned char out[26]);
+
+static FuseState select_fuse_state(KeyVariant variant) {
+    switch (variant) {
+    case KEY_VARIANT_M3: return fuse_state_m3;
+    case KEY_VARIANT_M3_UNPLUGGED: return fuse_state_m3_unplugged;
+    case KEY_VARIANT_M4: return fuse_state_m4;
+    case KEY_VARIANT_M4_UNPLUGGED: return fuse_state_m4_unplugged;
+    default: return fuse_state_generic;
+    }
+}
+
+KeyVariant select_key_variant(size_t n, const unsigned char plugboard[26]) {
+    int plugged = 0;
+    for (int v = 0; v < 26; ++v) plugged |= plugboard[v] != v;
+    if (n == 3) return plugged ? KEY_VARIANT_M3 : KEY_VARIANT_M3_UNPLUGGED;
+    if (n == 4) return plugged ? KEY_VARIANT_M4 : KEY_VARIANT_M4_UNPLUGGED;
+    return KEY_VARIANT_GENERIC;
+}
+
+struct CompiledKey* compile_key(const struct Key* k) {
+    return compile_key_in(NULL, k);
+}
+
+struct CompiledKey* compile_key_in(Arena* arena, const struct Key* k) {
+    return compile_key_flags_in(arena, k, 0);
+}
+
+struct CompiledKey* compile_key_flags_in(Arena* arena, const struct Key* k, unsigned flags) {
+    if (!k || k->rotor_count > MAX_ROTORS) return NULL;
+    size_t n = k->rotor_count;
+
+    unsigned char notches[MAX_ROTORS];
+    unsigned char start[MAX_ROTORS];
+    for (size_t i = 0; i < n; ++i) {
+        notches[i] = (unsigned char)(k->rotors[i].notch % 26);
+        start[i] = (unsigned char)(k->start.positions[i] % 26);
+    }
+
+    /* Trace the stepping period first so the tables can share one allocation */
+    size_t space = 0, count = 0, cycle_start = 0;
+    unsigned short* index = NULL;
+    unsigned char* seq = NULL;
+    if (n <= PERIOD_TABLE_MAX_ROTORS && (n == 0 || !(flags & COMPILE_NO_PERIOD_TABLE))) {
+        space = 1;
+        for (size_t i = 0; i < n; ++i) space *= 26;
+        index = malloc(space * sizeof(*index));
+        seq = malloc(space * (n ? n : 1));
+        if (!index || !seq) { free(index); free(seq); return NULL; }
+        memset(index, 0xFF, space * sizeof(*index));
+        count = trace_period(notches, n, start, seq, index, &cycle_start);
+    }
+
+    /* Standard rotors and reflectors use the shared tables; others get their own */
+    const ShiftedRotors* table = shifted_rotors();
+    int types[MAX_ROTORS];
+    size_t custom = 0;
+    for (size_t i = 0; i < n; ++i) custom += (types[i] = standard_rotor(&k->rotors[i])) < 0;
+    int reflector = standard_reflector(k->reflector);
+
+    size_t index_bytes = space * sizeof(*index);
+    size_t rotor_tables = custom * sizeof(unsigned char[26][26]);
+    size_t reflector_bytes = reflector < 0 ? 26 : 0;
+    size_t fast_tables = n ? sizeof(unsigned char[26][26]) : 0;
+    size_t state_bytes = count ? (count + STATE_PADDING) * sizeof(unsigned char[26]) + sizeof(uint32_t) : 0;
+
+    /* One allocation: struct, state index, custom rotor tables, fast rotor tables, notches,
+       custom reflector, states */
+    size_t bytes = sizeof(CompiledKey) + index_bytes + 2 * rotor_tables + 2 * fast_tables + n + reflector_bytes + state_bytes + count * n;
+    CompiledKey* ck = arena ? arena_alloc(arena, bytes) : malloc(bytes);
+    if (!ck) { free(index); free(seq); return NULL; }
+    unsigned char* blob = (unsigned char*)(ck + 1);
+    unsigned char (*forward)[26][26], (*backward)[26][26];
+    ck->rotor_count = n;
+    ck->state_index = index_bytes ? (unsigned short*)blob : NULL;       blob += index_bytes;
+    forward = (unsigned char (*)[26][26])blob;                          blob += rotor_tables;
+    backward = (unsigned char (*)[26][26])blob;                         blob += rotor_tables;
+    ck->entry = (unsigned char (*)[26])blob;                            blob += fast_tables;
+    ck->exit = (unsigned char (*)[26])blob;                             blob += fast_tables;
+    ck->notches = blob;                                                 blob += n;
+    unsigned char* own_reflector = blob;                                blob += reflector_bytes;
+    ck->states = count ? (unsigned char (*)[26])blob : NULL;            blob += state_bytes;
+    ck->state_positions = count ? blob : NULL;
+    ck->state_count = count;
+    ck->cycle_start = cycle_start;
+    memcpy(ck->notches, notches, n);
+
+    for (int v = 0; v < 26; ++v) {
+        int mapped = k->plugboard_settings[v];
+        ck->plugboard[v] = (unsigned char)(mapped < 26 ? mapped : v);
+    }
+    if (reflector < 0) memcpy(own_reflector, k->reflector->wiring, 26);
+    ck->reflector = reflector < 0 ? own_reflector : table->reflectors[reflector];
+    ck->variant = select_key_variant(n, ck->plugboard);
+
+    for (size_t i = 0, c = 0; i < n; ++i) {
+        int ring = k->ring_settings ? (int)k->ring_settings[i] % 26 : 0;
+        if (types[i] >= 0) {
+            /* Position p is offset p - ring: rows from 26 - ring on */
+            ck->forward[i] = table->forward[types[i]] + (26 - ring) % 26;
+            ck->backward[i] = table->backward[types[i]] + (26 - ring) % 26;
+            continue;
+        }
+        const Rotor* rotor = &k->rotors[i];
+        unsigned char inverse[26];
+        invert_wiring(rotor->wiring, inverse);
+
+        /* Fold position and ring setting into the entry and exit offsets */
+        for (int pos = 0; pos < 26; ++pos) {
+            for (int v = 0; v < 26; ++v) {
+                int e = mod26(v + pos - ring);
+                forward[c][pos][v] = (unsigned char)mod26((int)rotor->wiring[e] - pos + ring);
+                backward[c][pos][v] = (unsigned char)mod26((int)inverse[e] - pos + ring);
+            }
+        }
+        ck->forward[i] = (const unsigned char (*)[26])forward[c];
+        ck->backward[i] = (const unsigned char (*)[26])backward[c];
+        ++c;
+    }
+
+    /* The fast rotor changes every letter: fuse it with the plugboard on both sides */
+    for (int pos = 0; n && pos < 26; ++pos) {
+        for (int v = 0; v < 26; ++v) {
+            ck->entry[pos][v] = ck->forward[0][pos][ck->plugboard[v]];
+            ck->exit[pos][v] = ck->plugboard[ck->backward[0][pos][v]];
+        }
+    }
+
+    if (count) {
+        memcpy(ck->state_index, index, index_bytes);
+        memcpy(ck->state_positions, seq, count * n);
+        FuseState fuse = select_fuse_state(ck->variant);
+        for (size_t j = 0; j < count; ++j) fuse(ck, seq + j * n, ck->states[j]);
+        for (size_t j = count; j < count + STATE_PADDING; ++j) {
+            size_t wrapped = cycle_start + (j - count) % (count - cycle_start);
+            memcpy(ck->states[j], ck->states[wrapped], sizeof(ck->states[j]));
+        }
+    }
+    free(index);
+    free(seq);
+    return ck;
+}
+
+void compile_state_table(const struct CompiledKey* ck, const unsigned char* positions, unsigned char out[26]) {
+    select_fuse_state(ck->variant)(ck, positions, out);
+}
+
+int step_rotors(const struct CompiledKey* ck, unsigned char* positions) {
+    return step_positions(ck->notches, ck->rotor_count, positions);
+}
+
+/*
+ * Key presses (numbered from 0) at which a pawl pushes the rotor on its left:
+ * an optional isolated first push at `lead`, then one every `period` presses
+ * starting at `first`. Pushes are always at least two presses apart.
+ */
+typedef struct PushSchedule {
+    int has_lead;
+    uint64_t lead;
+    uint64_t first;
+    uint64_t period;
+} PushSchedule;
+
+/* Number of pushes among the first `presses` key presses */
+static uint64_t count_pushes(const PushSchedule* s, uint64_t presses) {
+    uint64_t count = (s->has_lead && s->lead < presses) ? 1 : 0;
+    if (s->first < presses) count += (presses - 1 - s->first) / s->period + 1;
+    return count;
+}
+
+/* Key press of the m-th push (m >= 1) */
+static uint64_t nth_push(const PushSchedule* s, uint64_t m) {
+    if (s->has_lead) return m == 1 ? s->lead : s->first + (m - 2) * s->period;
+    return s->first + (m - 1) * s->period;
+}
+
+/*
+ * Schedule of the pawl to the left of a rotor that starts at `position`, has its
+ * notch at `notch` and is pushed according to `in`. The rotor sits at its notch on
+ * the press after a push brings it there (or on press 0 if it starts there), steps
+ * by itself on that press and then needs 25 more pushes to come round again.
+ */
+static PushSchedule next_schedule(const PushSchedule* in, int position, int notch) {
+    PushSchedule out = { 0, 0, 0, in->period * 25 };
+    if (position == notch) {
+        /* Press 0 moves the rotor off its notch; a push on the same press is absorbed */
+        PushSchedule later = *in;
+        if (later.has_lead && later.lead == 0) later.has_lead = 0;
+        else if (!later.has_lead && later.first == 0) later.first = later.period;
+        out.has_lead = 1;
+        out.lead = 0;
+        out.first = nth_push(&later, 25) + 1;
+    } else {
+        uint64_t m = (uint64_t)((notch - position + 26) % 26);
+        if (in->has_lead && m == 1) {
+            out.has_lead = 1;
+            out.lead = in->lead + 1;
+            out.first = nth_push(in, 26) + 1;
+        } else {
+            out.first = nth_push(in, m) + 1;
+        }
+    }
+    return out;
+}
+
+void seek_rotors(const struct CompiledKey* ck, unsigned char* positions, uint64_t letters) {
+    size_t n = ck->rotor_count;
+    if (n == 0 || letters == 0) return;
+
+    /* Rotor 0 steps on every press; its pawl pushes rotor 1 whenever it sits at its notch */
+    PushSchedule pushes = { 0, 0, (uint64_t)((ck->notches[0] - positions[0] + 26) % 26), 26 };
+    positions[0] = (unsigned char)((positions[0] + letters % 26) % 26);
+
+    for (size_t i = 1; i < n; ++i) {
+        uint64_t steps = count_pushes(&pushes, letters);
+        if (i + 1 < n) {
+            /* Rotor i also steps whenever it pushes rotor i + 1 (double-step) */
+            int position = positions[i];
+            PushSchedule next = next_schedule(&pushes, position, ck->notches[i]);
+            int pushed_at_0 = pushes.has_lead ? pushes.lead == 0 : pushes.first == 0;
+            steps += count_pushes(&next, letters);
+            if (position == ck->notches[i] && pushed_at_0) --steps;
+            pushes = next;
+        }
+        positions[i] = (unsigned char)((positions[i] + steps % 26) % 26);
+    }
+}
+
+size_t lookup_state(const struct CompiledKey* ck, const unsigned char* positions) {
+    if (!ck->state_count) return STATE_NONE;
+    return ck->state_index[encode_positions(positions, ck->rotor_count)];
+}
+
+void free_compiled_key(struct CompiledKey* ck) {
+    free(ck);
+}
@@ -0,0 +1,319 @@
+#include "../include/key-image.h"
+#include "../include/arena.h"
+#include "../include/engine.h"
+#include "../include/key-compiler.h"
+#include "../include/key-parser.h"
+#include "../include/stats.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Loaded keys only hold the small parts outside the mapping */
+#define IMAGE_KEY_ARENA_SIZE 4096
+
+static size_t align_image(size_t n) {
+    return (n + KEY_IMAGE_ALIGN - 1) & ~(size_t)(KEY_IMAGE_ALIGN - 1);
+}
+
+/* Word-at-a-time FNV-style hash; fast enough to check a whole period table on load */
+static uint64_t image_checksum(const unsigned char* p, size_t len, uint64_t h) {
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 1099511628211ull;
+        h ^= h >> 29;
+    }
+    for (; len; ++p, --len) h = (h ^ *p) * 1099511628211ull;
+    return h;
+}
+
+static uint64_t checksum_image(const unsigned char* image, size_t size) {
+    KeyImageHeader header;
+    memcpy(&header, image, sizeof(header));
+    header.checksum = 0;
+    uint64_t h = image_checksum((const unsigned char*)&header, sizeof(header), 14695981039346656037ull);
+    return image_checksum(image + sizeof(header), size - sizeof(header), h);
+}
+
+static size_t state_space(size_t n) {
+    size_t space = 1;
+    for (size_t i = 0; i < n; ++i) space *= 26;
+    return space;
+}
+
+int write_key_image(const Key* k, const char* path) {
+    if (!k || !k->compiled || !path) return 1;
+    const CompiledKey* ck = k->compiled;
+    size_t n = ck->rotor_count;
+
+    KeyImageHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, KEY_IMAGE_MAGIC, sizeof(h.magic));
+    h.version = KEY_IMAGE_VERSION;
+    h.byte_order = KEY_IMAGE_BYTE_ORDER;
+    h.rotor_count = (uint32_t)n;
+    h.state_count = ck->state_count;
+    h.cycle_start = ck->cycle_start;
+    memcpy(h.start, k->start.positions, sizeof(h.start));
+    for (size_t i = 0; i < n; ++i) {
+        h.rings[i] = k->ring_settings ? k->ring_settings[i] : 0;
+        h.notches[i] = ck->notches[i];
+        memcpy(h.wiring[i], k->rotors[i].wiring, 26);
+    }
+    memcpy(h.reflector, ck->reflector, 26);
+    memcpy(h.plugboard, k->plugboard_settings, 26);
+
+    /* Table layout: each table starts on a KEY_IMAGE_ALIGN boundary */
+    size_t rotor_tables = n * sizeof(unsigned char[26][26]);
+    size_t fast_tables = n ? sizeof(unsigned char[26][26]) : 0;
+    size_t state_bytes = ck->state_count ? (ck->state_count + STATE_PADDING) * sizeof(unsigned char[26]) + sizeof(uint32_t) : 0;
+    size_t index_bytes = ck->state_count ? state_space(n) * sizeof(unsigned short) : 0;
+    struct { uint64_t* offset; const void* data; size_t bytes; } tables[] = {
+        { &h.forward, NULL, rotor_tables },            // rotor by rotor, below
+        { &h.backward, NULL, rotor_tables },
+        { &h.entry, ck->entry, fast_tables },
+        { &h.exit, ck->exit, fast_tables },
+        { &h.states, ck->states, state_bytes },
+        { &h.state_positions, ck->state_positions, ck->state_count * n },
+        { &h.state_index, ck->state_index, index_bytes },
+    };
+    size_t table_count = sizeof(tables) / sizeof(tables[0]);
+    size_t size = align_image(sizeof(h));
+    for (size_t t = 0; t < table_count; ++t) {
+        if (!tables[t].bytes) continue;
+        *tables[t].offset = size;
+        size = align_image(size + tables[t].bytes);
+    }
+    if (ck->state_count) h.flags |= KEY_IMAGE_HAS_STATES;
+    h.size = size;
+
+    unsigned char* image = calloc(1, size);
+    if (!image) return 2;
+    memcpy(image, &h, sizeof(h));
+    for (size_t t = 0; t < table_count; ++t) {
+        if (tables[t].bytes && tables[t].data) memcpy(image + *tables[t].offset, tables[t].data, tables[t].bytes);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        memcpy(image + h.forward + i * sizeof(unsigned char[26][26]), ck->forward[i], sizeof(unsigned char[26][26]));
+        memcpy(image + h.backward + i * sizeof(unsigned char[26][26]), ck->backward[i], sizeof(unsigned char[26][26]));
+    }
+    h.checksum = checksum_image(image, size);
+    memcpy(image, &h, sizeof(h));
+
+    int rc = 0;
+    FILE* f = fopen(path, "wb");
+    if (!f) { perror(path); rc = 3; }
+    else {
+        if (fwrite(image, 1, size, f) != size) { perror(path); rc = 3; }
+        if (fclose(f) != 0 && !rc) { perror(path); rc = 3; }
+    }
+    free(image);
+    return rc;
+}
+
+/* Table [offset, offset + bytes) lies inside the image (and is present if required) */
+static int table_fits(uint64_t offset, size_t bytes, size_t size) {
+    if (!bytes) return 1;
+    return offset >= sizeof(KeyImageHeader) && offset <= size && bytes <= size - offset;
+}
+
+static int all_below(const unsigned char* p, size_t len, unsigned limit) {
+    for (size_t i = 0; i < len; ++i) if (p[i] >= limit) return 0;
+    return 1;
+}
+
+/*
+ * Check the header, the checksum and that every table the cipher indexes with stays
+ * in bounds: rotor tables and state positions hold letters, the state index holds
+ * state numbers. Returns 0 if the image can be used as is.
+ */
+static int validate_image(const unsigned char* image, size_t size, const char* path) {
+    KeyImageHeader h;
+    if (size < sizeof(h)) { fprintf(stderr, "Error: %s: truncated compiled key\n", path); return 1; }
+    memcpy(&h, image, sizeof(h));
+    if (memcmp(h.magic, KEY_IMAGE_MAGIC, sizeof(h.magic)) != 0) { fprintf(stderr, "Error: %s: not a compiled key\n", path); return 1; }
+    if (h.version != KEY_IMAGE_VERSION) { fprintf(stderr, "Error: %s: unsupported compiled key version %u\n", path, (unsigned)h.version); return 1; }
+    if (h.byte_order != KEY_IMAGE_BYTE_ORDER) { fprintf(stderr, "Error: %s: compiled key has the wrong byte order\n", path); return 1; }
+    if (h.size != size) { fprintf(stderr, "Error: %s: compiled key size mismatch\n", path); return 1; }
+    if (checksum_image(image, size) != h.checksum) { fprintf(stderr, "Error: %s: compiled key checksum mismatch\n", path); return 1; }
+
+    size_t n = h.rotor_count;
+    int has_states = (h.flags & KEY_IMAGE_HAS_STATES) != 0;
+    if (n > MAX_ROTORS || (has_states && n > PERIOD_TABLE_MAX_ROTORS)) goto corrupt;
+    size_t rotor_tables = n * sizeof(unsigned char[26][26]);
+    size_t fast_tables = n ? sizeof(unsigned char[26][26]) : 0;
+    size_t space = state_space(n);
+    if (has_states && (h.state_count == 0 || h.state_count > space || h.cycle_start >= h.state_count)) goto corrupt;
+    if (!has_states && h.state_count) goto corrupt;
+    size_t count = (size_t)h.state_count;
+    size_t state_bytes = count ? (count + STATE_PADDING) * sizeof(unsigned char[26]) + sizeof(uint32_t) : 0;
+
+    if (!table_fits(h.forward, rotor_tables, size) || !table_fits(h.backward, rotor_tables, size) ||
+        !table_fits(h.entry, fast_tables, size) || !table_fits(h.exit, fast_tables, size) ||
+        !table_fits(h.states, state_bytes, size) || !table_fits(h.state_positions, count * n, size) ||
+        !table_fits(h.state_index, count ? space * sizeof(unsigned short) : 0, size) ||
+        (h.state_index & 1)) goto corrupt;
+
+    if (!all_below(h.notches, n, 26) || !all_below(h.start, n, 26) || !all_below(h.reflector, 26, 26)) goto corrupt;
+    if (n && (!all_below(image + h.forward, rotor_tables, 26) || !all_below(image + h.backward, rotor_tables, 26) ||
+              !all_below(image + h.entry, fast_tables, 26) || !all_below(image + h.exit, fast_tables, 26))) goto corrupt;
+    if (count) {
+        if (!all_below(image + h.state_positions, count * n, 26)) goto corrupt;
+        const unsigned short* index = (const unsigned short*)(image + h.state_index);
+        for (size_t i = 0; i < space; ++i) {
+            if (index[i] != STATE_NONE && index[i] >= count) goto corrupt;
+        }
+    }
+    return 0;
+
+corrupt:
+    fprintf(stderr, "Error: %s: corrupt compiled key\n", path);
+    return 1;
+}
+
+/* Build a Key whose compiled tables point into a validated image */
+static struct Key* key_from_image(const unsigned char* image) {
+    KeyImageHeader h;
+    memcpy(&h, image, sizeof(h));
+    size_t n = h.rotor_count;
+
+    Arena arena;
+    arena_init(&arena, IMAGE_KEY_ARENA_SIZE);
+    Key* k = arena_calloc(&arena, 1, sizeof(*k));
+    CompiledKey* ck = k ? arena_calloc(&arena, 1, sizeof(*ck)) : NULL;
+    if (ck) {
+        k->reflector = arena_alloc(&arena, sizeof(*k->reflector));
+        k->rotors = n ? arena_alloc(&arena, n * sizeof(*k->rotors)) : NULL;
+        k->ring_settings = n ? arena_alloc(&arena, n * sizeof(*k->ring_settings)) : NULL;
+    }
+    if (!ck || !k->reflector || (n && (!k->rotors || !k->ring_settings))) {
+        arena_free(&arena);
+        return NULL;
+    }
+
+    k->rotor_count = n;
+    memcpy(k->reflector->wiring, h.reflector, 26);
+    memcpy(k->plugboard_settings, h.plugboard, 26);
+    memcpy(k->start.positions, h.start, sizeof(h.start));
+    for (size_t i = 0; i < n; ++i) {
+        memcpy(k->rotors[i].wiring, h.wiring[i], 26);
+        k->rotors[i].notch = h.notches[i];
+        k->ring_settings[i] = h.rings[i];
+    }
+
+    ck->rotor_count = n;
+    for (int v = 0; v < 26; ++v) {
+        int mapped = h.plugboard[v];
+        ck->plugboard[v] = (unsigned char)(mapped < 26 ? mapped : v);
+    }
+    ck->variant = select_key_variant(n, ck->plugboard);
+
+    /* The tables are only read, so the const of the mapping is dropped here alone */
+    unsigned char* base = (unsigned char*)(uintptr_t)image;
+    ck->notches = base + offsetof(KeyImageHeader, notches);
+    ck->reflector = base + offsetof(KeyImageHeader, reflector);
+    for (size_t i = 0; i < n; ++i) {
+        ck->forward[i] = (const unsigned char (*)[26])(base + h.forward + i * sizeof(unsigned char[26][26]));
+        ck->backward[i] = (const unsigned char (*)[26])(base + h.backward + i * sizeof(unsigned char[26][26]));
+    }
+    ck->entry = n ? (unsigned char (*)[26])(base + h.entry) : NULL;
+    ck->exit = n ? (unsigned char (*)[26])(base + h.exit) : NULL;
+    ck->state_count = (size_t)h.state_count;
+    ck->cycle_start = (size_t)h.cycle_start;
+    ck->states = h.state_count ? (unsigned char (*)[26])(base + h.states) : NULL;
+    ck->state_positions = h.state_count ? base + h.state_positions : NULL;
+    ck->state_index = h.state_count ? (unsigned short*)(base + h.state_index) : NULL;
+
+    k->compiled = ck;
+    k->arena = arena;
+    return k;
+}
+
+#ifdef WIN32
+
+/* No mmap here: read the image into the key's own arena instead */
+static struct Key* open_key_image(const char* path) {
+    FILE* f = path ? fopen(path, "rb") : NULL;
+    if (!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long sz = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    unsigned char* image = sz > 0 ? malloc((size_t)sz) : NULL;
+    if (!image || fread(image, 1, (size_t)sz, f) != (size_t)sz || validate_image(image, (size_t)sz, path) != 0) {
+        free(image);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+
+    struct Key* k = key_from_image(image);
+    if (!k) { free(image); return NULL; }
+    k->image = image;
+    k->image_size = (size_t)sz;
+    return k;
+}
+
+void release_key_image(void* image, size_t size) {
+    (void)size;
+    free(image);
+}
+
+#else
+
+static struct Key* open_key_image(const char* path) {
+    int fd = path ? open(path, O_RDONLY) : -1;
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) { close(fd); return NULL; }
+    size_t size = (size_t)st.st_size;
+
+    /* One mapping for the whole key; the descriptor is not needed once it exists */
+    void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) { perror("mmap"); return NULL; }
+    madvise(map, size, MADV_WILLNEED);
+
+    struct Key* k = validate_image(map, size, path) == 0 ? key_from_image(map) : NULL;
+    if (!k) { munmap(map, size); return NULL; }
+    k->image = map;
+    k->image_size = size;
+    return k;
+}
+
+void release_key_image(void* image, size_t size) {
+    munmap(image, size);
+}
+
+#endif
+
+struct Key* load_key_image(const char* path) {
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
+    struct Key* k = open_key_image(path);
+    if (k) engine_load();
+    if (STATS_ON) stats_add_time(STATS_KEY, t0);
+    return k;
+}
+
+struct Key* load_key_file(const char* path) {
+    return load_key_file_for(path, ENGINE_SIZE_UNKNOWN);
+}
+
+struct Key* load_key_file_for(const char* path, uint64_t bytes) {
+    if (!path) return NULL;
+    FILE* f = fopen(path, "rb");
+    if (!f) return NULL;
+    char magic[sizeof(((KeyImageHeader*)0)->magic)];
+    size_t got = fread(magic, 1, sizeof(magic), f);
+    fclose(f);
+    if (got == sizeof(magic) && memcmp(magic, KEY_IMAGE_MAGIC, sizeof(magic)) == 0) return load_key_image(path);
+    return parse_key_file_for(path, bytes);
+}
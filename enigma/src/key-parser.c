@@ -1,4 +1,9 @@
 #include "../include/key-parser.h"
+#include "../include/arena.h"
+#include "../include/engine.h"
+#include "../include/key-compiler.h"
+#include "../include/key-image.h"
+#include "../include/stats.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -6,7 +11,7 @@
 #include <ctype.h>
 
 /* Standard Enigma rotor wirings (I-VIII) and their notch positions */
-static const unsigned char ROTOR_WIRINGS[8][26] = {
+const unsigned char ROTOR_WIRINGS[ROTOR_TYPES][26] = {
     /* Rotor I:   */   {4, 10, 12, 3, 8, 0, 14, 4, 13, 1, 5, 2, 4, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 25},
     /* Rotor II:  */   {0, 9, 3, 10, 18, 8, 17, 20, 23, 1, 11, 7, 22, 19, 12, 2, 16, 6, 15, 25, 5, 21, 14, 13, 4, 24},
     /* Rotor III: */   {1, 17, 6, 18, 0, 12, 23, 20, 13, 7, 11, 4, 9, 10, 25, 2, 22, 19, 14, 5, 21, 8, 16, 3, 15, 24},
@@ -18,7 +23,7 @@ static const unsigned char ROTOR_WIRINGS[8][26] = {
 };
 
 /* Notch positions for rotors I-VIII (at which position the next rotor steps) */
-static const unsigned char ROTOR_NOTCHES[8] = {
+const unsigned char ROTOR_NOTCHES[ROTOR_TYPES] = {
     16,  /* Rotor I notch at Q (position 16) */
     4,   /* Rotor II notch at E (position 4) */
     21,  /* Rotor III notch at V (position 21) */
@@ -30,8 +35,13 @@ static const unsigned char ROTOR_NOTCHES[8] = {
 };
 
 /* Standard Enigma reflectors (B and C) */
-static const unsigned char REFLECTOR_B[26] = {24, 17, 20, 7, 16, 18, 11, 3, 15, 23, 13, 6, 14, 10, 12, 8, 4, 1, 5, 25, 2, 22, 21, 9, 0, 19};
-static const unsigned char REFLECTOR_C[26] = {5, 21, 1, 22, 8, 17, 19, 12, 2, 13, 14, 4, 15, 9, 11, 6, 16, 7, 10, 25, 20, 3, 18, 0, 24, 23};
+const unsigned char REFLECTOR_B[26] = {24, 17, 20, 7, 16, 18, 11, 3, 15, 23, 13, 6, 14, 10, 12, 8, 4, 1, 5, 25, 2, 22, 21, 9, 0, 19};
+const unsigned char REFLECTOR_C[26] = {5, 21, 1, 22, 8, 17, 19, 12, 2, 13, 14, 4, 15, 9, 11, 6, 16, 7, 10, 25, 20, 3, 18, 0, 24, 23};
+
+/* Arena block for a key: the key, its parse scratch space and the tables of a key
+   without a period table (about 2 KB) fit. A period table (~530 KB for 3 rotors) is
+   larger than a block, so it gets a block of exactly its own size. */
+#define KEY_ARENA_SIZE 4096
 
 static int letter_to_index(const char* tok) {
     if (!tok || !tok[0]) return -1;
@@ -53,9 +63,19 @@ static char* trim(char* s) {
     return s;
 }
 
-struct Key* parse_key_components(const char* reflector_str, const char* rotors_str, const char* rings_str, const char* plugboard_str) {
-    struct Key* k = calloc(1, sizeof(*k));
-    if (!k) return NULL;
+/*
+ * Parse key components into k and allocate its tables from arena. The strings are
+ * copied to arena scratch space for tokenizing; everything allocated after `scratch`
+ * (including the strings themselves if they live in the arena) is released before
+ * the key's own data is allocated, so that data ends up contiguous. The period table
+ * is left out with COMPILE_NO_PERIOD_TABLE in compile_flags, or when the engine profile
+ * says it does not pay off for `bytes` bytes of messages. Returns 0 on success.
+ */
+static int parse_key_in(Arena* arena, ArenaMark scratch, struct Key* k, unsigned compile_flags, uint64_t bytes,
+                        const char* reflector_str, const char* rotors_str, const char* rings_str, const char* plugboard_str) {
+    Reflector reflector;
+    Rotor rotors[MAX_ROTORS];
+    RingSetting rings[MAX_ROTORS] = {0};
 
     /* Initialize default plugboard: identity mapping (A->A, B->B, etc.) */
     for (int i = 0; i < 26; ++i) k->plugboard_settings[i] = (unsigned char)i;
@@ -65,23 +85,18 @@ struct Key* parse_key_components(const char* reflector_str, const char* rotors_s
         int reflector_idx = letter_to_index(reflector_str);
         if (reflector_idx < 0 || reflector_idx >= 2) { 
             fprintf(stderr, "Error: reflector must be 1 (B) or 2 (C), got: %s\n", reflector_str);
-            free(k); 
-            return NULL; 
+            return 1; 
         }
-        k->reflector = malloc(sizeof(*k->reflector));
-        if (!k->reflector) { free(k); return NULL; }
         
         /* Copy appropriate reflector wiring */
         if (reflector_idx == 0) {  /* B */
-            memcpy(k->reflector->wiring, REFLECTOR_B, sizeof(REFLECTOR_B));
+            memcpy(reflector.wiring, REFLECTOR_B, sizeof(REFLECTOR_B));
         } else {  /* C */
-            memcpy(k->reflector->wiring, REFLECTOR_C, sizeof(REFLECTOR_C));
+            memcpy(reflector.wiring, REFLECTOR_C, sizeof(REFLECTOR_C));
         }
     } else {
         /* Default to reflector B */
-        k->reflector = malloc(sizeof(*k->reflector));
-        if (!k->reflector) { free(k); return NULL; }
-        memcpy(k->reflector->wiring, REFLECTOR_B, sizeof(REFLECTOR_B));
+        memcpy(reflector.wiring, REFLECTOR_B, sizeof(REFLECTOR_B));
     }
 
     /* Parse rotor specifications */
@@ -89,13 +104,14 @@ struct Key* parse_key_components(const char* reflector_str, const char* rotors_s
         /* Count comma-separated values */
         size_t count = 1;
         for (const char* p = rotors_str; *p; ++p) if (*p == ',') ++count;
-        
-        k->rotors = calloc(count, sizeof(*k->rotors));
-        if (!k->rotors) { free_key(k); return NULL; }
+        if (count > MAX_ROTORS) {
+            fprintf(stderr, "Error: at most %d rotors are supported, got: %zu\n", MAX_ROTORS, count);
+            return 1;
+        }
         k->rotor_count = count;
         
-        char* tmp = strdup(rotors_str);
-        if (!tmp) { free_key(k); return NULL; }
+        char* tmp = arena_strdup(arena, rotors_str);
+        if (!tmp) return 1;
         
         char* saveptr = NULL;
         char* tok = strtok_r(tmp, ",", &saveptr);
@@ -104,23 +120,22 @@ struct Key* parse_key_components(const char* reflector_str, const char* rotors_s
         while (tok && idxw < count) {
             tok = trim(tok);
             int rotor_num = letter_to_index(tok);
-            if (rotor_num < 0 || rotor_num >= 8) {
+            if (rotor_num < 0 || rotor_num >= ROTOR_TYPES) {
                 fprintf(stderr, "Error: rotor must be 1-8, got: %s\n", tok);
-                free(tmp); 
-                free_key(k); 
-                return NULL;
+                return 1;
             }
             
             /* Initialize rotor with wiring and notch */
-            Rotor* rotor = &k->rotors[idxw];
+            Rotor* rotor = &rotors[idxw];
             memcpy(rotor->wiring, ROTOR_WIRINGS[rotor_num], sizeof(rotor->wiring));
             rotor->notch = ROTOR_NOTCHES[rotor_num];
-            rotor->position = 0;  /* Default message key position (will be set by ring settings) */
+            k->start.positions[idxw] = 0;  /* Default message key position (will be set by ring settings) */
             
             idxw++;
             tok = strtok_r(NULL, ",", &saveptr);
         }
-        free(tmp);
+        /* Missing values (e.g. "1,,2") leave zeroed rotors */
+        for (; idxw < count; ++idxw) memset(&rotors[idxw], 0, sizeof(rotors[idxw]));
     }
 
     /* Parse ring settings (and message keys if provided) */
@@ -130,15 +145,11 @@ struct Key* parse_key_components(const char* reflector_str, const char* rotors_s
         
         if (k->rotor_count && count != k->rotor_count) {
             fprintf(stderr, "Error: ring settings count (%zu) != rotor count (%zu)\n", count, k->rotor_count);
-            free_key(k); 
-            return NULL;
+            return 1;
         }
         
-        k->ring_settings = calloc(count, sizeof(*(k->ring_settings)));
-        if (!k->ring_settings) { free_key(k); return NULL; }
-        
-        char* tmp = strdup(rings_str);
-        if (!tmp) { free_key(k); return NULL; }
+        char* tmp = arena_strdup(arena, rings_str);
+        if (!tmp) return 1;
         
         char* saveptr = NULL;
         char* tok = strtok_r(tmp, ",", &saveptr);
@@ -149,35 +160,24 @@ struct Key* parse_key_components(const char* reflector_str, const char* rotors_s
             int v = letter_to_index(tok);
             if (v < 0 || v >= 26) {
                 fprintf(stderr, "Error: ring setting must be A-Z, got: %s\n", tok);
-                free(tmp); 
-                free_key(k); 
-                return NULL;
+                return 1;
             }
-            k->ring_settings[idxr] = (RingSetting)v;
             
             /* Set rotor message key position from ring setting */
             if (idxr < k->rotor_count) {
-                k->rotors[idxr].position = (unsigned char)v;
+                rings[idxr] = (RingSetting)v;
+                k->start.positions[idxr] = (unsigned char)v;
             }
             
             idxr++;
             tok = strtok_r(NULL, ",", &saveptr);
         }
-        free(tmp);
-    } else if (k->rotor_count > 0) {
-        /* Allocate default ring settings if rotors are specified but rings aren't */
-        k->ring_settings = calloc(k->rotor_count, sizeof(*(k->ring_settings)));
-        if (!k->ring_settings) { free_key(k); return NULL; }
-        for (size_t i = 0; i < k->rotor_count; ++i) {
-            k->ring_settings[i] = 0;
-            k->rotors[i].position = 0;
-        }
     }
 
     /* Parse plugboard swaps */
     if (plugboard_str) {
-        char* tmp = strdup(plugboard_str);
-        if (!tmp) { free_key(k); return NULL; }
+        char* tmp = arena_strdup(arena, plugboard_str);
+        if (!tmp) return 1;
         
         char* saveptr = NULL;
         char* tok = strtok_r(tmp, ",", &saveptr);
@@ -192,9 +192,7 @@ struct Key* parse_key_components(const char* reflector_str, const char* rotors_s
             
             if (!isalpha((unsigned char)a) || !isalpha((unsigned char)b)) { 
                 fprintf(stderr, "Error: plugboard pairs must be letters, got: %s\n", t);
-                free(tmp); 
-                free_key(k); 
-                return NULL; 
+                return 1; 
             }
             
             int ia = toupper((unsigned char)a) - 'A';
@@ -206,16 +204,49 @@ struct Key* parse_key_components(const char* reflector_str, const char* rotors_s
             
             tok = strtok_r(NULL, ",", &saveptr);
         }
-        free(tmp);
     }
 
+    /* Scratch is done with: lay out the key's data back to back */
+    arena_rewind(arena, scratch);
+    size_t n = k->rotor_count;
+    k->reflector = arena_alloc(arena, sizeof(*k->reflector));
+    k->rotors = n ? arena_alloc(arena, n * sizeof(*k->rotors)) : NULL;
+    k->ring_settings = n ? arena_alloc(arena, n * sizeof(*k->ring_settings)) : NULL;
+    if (!k->reflector || (n && (!k->rotors || !k->ring_settings))) return 1;
+    *k->reflector = reflector;
+    if (n) memcpy(k->rotors, rotors, n * sizeof(*k->rotors));
+    if (n) memcpy(k->ring_settings, rings, n * sizeof(*k->ring_settings));
+
+    /* Derive the cipher tables once so encryption is a lookup per character; the
+       engine settings are fixed now too, so enciphering never has to load them */
+    engine_load();
+    k->compiled = compile_key_flags_in(arena, k, compile_flags | engine_compile_flags(n, bytes));
+    return k->compiled ? 0 : 1;
+}
+
+static struct Key* build_key(unsigned compile_flags, uint64_t bytes, const char* reflector_str, const char* rotors_str, const char* rings_str, const char* plugboard_str) {
+    Arena arena;
+    arena_init(&arena, KEY_ARENA_SIZE);
+    struct Key* k = arena_calloc(&arena, 1, sizeof(*k));
+    if (!k || parse_key_in(&arena, arena_mark(&arena), k, compile_flags, bytes, reflector_str, rotors_str, rings_str, plugboard_str) != 0) {
+        arena_free(&arena);
+        return NULL;
+    }
+    k->arena = arena;
     return k;
 }
 
-struct Key* parse_key_file(const char* path) {
+static struct Key* read_key_file(const char* path, uint64_t bytes) {
     if (!path) return NULL;
     FILE* f = fopen(path, "r");
     if (!f) return NULL;
+
+    Arena arena;
+    arena_init(&arena, KEY_ARENA_SIZE);
+    struct Key* k = arena_calloc(&arena, 1, sizeof(*k));
+    if (!k) { fclose(f); return NULL; }
+    ArenaMark scratch = arena_mark(&arena);
+
     char line[512];
     char* reflector = NULL;
     char* rotors = NULL;
@@ -232,21 +263,53 @@ struct Key* parse_key_file(const char* path) {
         char* val = trim(eq + 1);
         // remove trailing newline
         char* nl = strchr(val,'\n'); if (nl) *nl = '\0';
-        if (strcasecmp(key, "reflector") == 0) reflector = strdup(val);
-        else if (strcasecmp(key, "rotors") == 0) rotors = strdup(val);
-        else if (strcasecmp(key, "rings") == 0) rings = strdup(val);
-        else if (strcasecmp(key, "plugboard") == 0) plugboard = strdup(val);
+        if (strcasecmp(key, "reflector") == 0) reflector = arena_strdup(&arena, val);
+        else if (strcasecmp(key, "rotors") == 0) rotors = arena_strdup(&arena, val);
+        else if (strcasecmp(key, "rings") == 0) rings = arena_strdup(&arena, val);
+        else if (strcasecmp(key, "plugboard") == 0) plugboard = arena_strdup(&arena, val);
     }
     fclose(f);
-    struct Key* k = parse_key_components(reflector, rotors, rings, plugboard);
-    free(reflector); free(rotors); free(rings); free(plugboard);
+    if (parse_key_in(&arena, scratch, k, 0, bytes, reflector, rotors, rings, plugboard) != 0) {
+        arena_free(&arena);
+        return NULL;
+    }
+    k->arena = arena;
+    return k;
+}
+
+struct Key* parse_key_components(const char* reflector_str, const char* rotors_str, const char* rings_str, const char* plugboard_str) {
+    return parse_key_components_for(reflector_str, rotors_str, rings_str, plugboard_str, ENGINE_SIZE_UNKNOWN);
+}
+
+struct Key* parse_key_components_for(const char* reflector_str, const char* rotors_str, const char* rings_str, const char* plugboard_str, uint64_t bytes) {
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
+    struct Key* k = build_key(0, bytes, reflector_str, rotors_str, rings_str, plugboard_str);
+    if (STATS_ON) stats_add_time(STATS_KEY, t0);
+    return k;
+}
+
+struct Key* parse_key_components_quick(const char* reflector_str, const char* rotors_str, const char* rings_str, const char* plugboard_str) {
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
+    struct Key* k = build_key(COMPILE_NO_PERIOD_TABLE, ENGINE_SIZE_UNKNOWN, reflector_str, rotors_str, rings_str, plugboard_str);
+    if (STATS_ON) stats_add_time(STATS_KEY, t0);
+    return k;
+}
+
+struct Key* parse_key_file(const char* path) {
+    return parse_key_file_for(path, ENGINE_SIZE_UNKNOWN);
+}
+
+struct Key* parse_key_file_for(const char* path, uint64_t bytes) {
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
+    struct Key* k = read_key_file(path, bytes);
+    if (STATS_ON) stats_add_time(STATS_KEY, t0);
     return k;
 }
 
 void free_key(struct Key* k) {
     if (!k) return;
-    if (k->reflector) free(k->reflector);
-    if (k->rotors) free(k->rotors);
-    if (k->ring_settings) free(k->ring_settings);
-    free(k);
+    if (k->image) release_key_image(k->image, k->image_size);
+    /* The key lives in its own arena: free through a copy, the original goes with it */
+    Arena arena = k->arena;
+    arena_free(&arena);
 }
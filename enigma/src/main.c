@@ -2,10 +2,181 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include "../include/batch.h"
 #include "../include/config.h"
+#include "../include/container.h"
+#include "../include/crack.h"
 #include "../include/encrypt.h"
+#include "../include/engine.h"
+#include "../include/key-image.h"
+#include "../include/stream.h"
+#include "../include/mmap-io.h"
+#include "../include/server.h"
+#include "../include/stats.h"
+
+/* Stream input to output chunk by chunk; "-" stands for stdin/stdout */
+static int run_stream(Config* cfg, const char* outpath) {
+    /* Opening the output would truncate the input before it is read: transform it in place */
+    if (same_file_path(cfg->input_path, outpath)) {
+        int r = encrypt_mapped(cfg, outpath);
+        if (r == MAPPED_UNSUPPORTED) {
+            fprintf(stderr, "Error: cannot write the result over the input file %s here, choose another -o\n", outpath);
+            return 2;
+        }
+        if (r == 0) printf("Wrote result to %s\n", outpath);
+        return r;
+    }
+
+    int from_stdin = strcmp(cfg->input_path, "-") == 0;
+    int to_stdout = strcmp(outpath, "-") == 0;
+#ifdef WIN32
+    if (from_stdin) _setmode(_fileno(stdin), _O_BINARY);
+    if (to_stdout) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    FILE* fin = from_stdin ? stdin : fopen(cfg->input_path, "rb");
+    if (!fin) { perror("fopen"); return 4; }
+    FILE* fout = to_stdout ? stdout : fopen(outpath, "wb");
+    if (!fout) { perror("fopen"); if (!from_stdin) fclose(fin); return 2; }
+
+    int r = encrypt_stream(cfg, fin, fout);
+
+    if (!from_stdin) fclose(fin);
+    if (!to_stdout && fclose(fout) != 0) { perror("fclose"); r = r ? r : 2; }
+    if (r == 0 && !to_stdout) printf("Wrote result to %s\n", outpath);
+    return r;
+}
+
+/* Write an indexed container, or (decrypting) read the --range of one; "-" is stdout */
+static int run_indexed(Config* cfg, const char* outpath, int do_encrypt) {
+    if (same_file_path(cfg->input_path, outpath)) {
+        fprintf(stderr, "Error: the output %s is the input file, choose another -o\n", outpath);
+        return 2;
+    }
+
+    int from_stdin = strcmp(cfg->input_path, "-") == 0;
+    int to_stdout = strcmp(outpath, "-") == 0;
+#ifdef WIN32
+    if (from_stdin) _setmode(_fileno(stdin), _O_BINARY);
+    if (to_stdout) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    FILE* fout = to_stdout ? stdout : fopen(outpath, "wb");
+    if (!fout) { perror("fopen"); return 2; }
+
+    int r;
+    if (do_encrypt) {
+        FILE* fin = from_stdin ? stdin : fopen(cfg->input_path, "rb");
+        if (!fin) {
+            perror("fopen");
+            r = 4;
+        } else {
+            r = write_container(cfg, fin, fout, cfg->block_size);
+            if (!from_stdin) fclose(fin);
+        }
+    } else {
+        r = read_container(cfg, cfg->input_path, cfg->range_begin, cfg->range_end, fout);
+    }
+
+    if (!to_stdout && fclose(fout) != 0) { perror("fclose"); r = r ? r : 2; }
+    if (r == 0 && !to_stdout) printf("Wrote result to %s\n", outpath);
+    return r;
+}
+
+/* One part of a sharded rotor search: its progress goes to the work directory */
+static int run_shard(Config* cfg) {
+    CrackCheckpoint progress;
+    int r = crack_shard(cfg->input, cfg->input_len, cfg->crack_rotors, cfg->shard, cfg->shards, cfg->work_dir, cfg->threads, &progress);
+    if (r != 0) return r;
+    double s = (double)progress.ns / 1e9;
+    fprintf(stderr, "Shard %zu of %zu done: %llu trials in %.2f s (%.2f M trials/s), saved in %s\n", cfg->shard, cfg->shards,
+            (unsigned long long)progress.trials, s, s > 0 ? (double)progress.trials / s / 1e6 : 0.0, cfg->work_dir);
+    return 0;
+}
+
+/* Search for the key of the loaded ciphertext and write it as a key file; "-" or no
+   output file is stdout. The search's progress goes to stderr. */
+static int run_crack(Config* cfg) {
+    const char* outpath = cfg->output_path ? cfg->output_path : "-";
+    int to_stdout = strcmp(outpath, "-") == 0;
+    if (cfg->shards && !cfg->merge) return run_shard(cfg);
+
+    CrackResult result;
+    int r = cfg->merge ? crack_merge(cfg->input, cfg->input_len, cfg->crack_rotors, cfg->shards, cfg->work_dir, cfg->threads, &result)
+                       : crack_key(cfg->input, cfg->input_len, cfg->crack_rotors, cfg->threads, &result);
+    if (r != 0) return r;
+    double rotor_s = (double)result.rotor_ns / 1e9;
+    fprintf(stderr, "Rotor search: %llu trials in %.2f s (%.2f M trials/s), plugboard search: %.2f s\n",
+            (unsigned long long)result.trials, rotor_s, rotor_s > 0 ? (double)result.trials / rotor_s / 1e6 : 0.0,
+            (double)result.plugboard_ns / 1e9);
+
+    FILE* fout = to_stdout ? stdout : fopen(outpath, "w");
+    if (!fout) { perror("fopen"); return 2; }
+    r = write_crack_key(fout, &result) != 0 ? 2 : 0;
+    if (!to_stdout && fclose(fout) != 0) { perror("fclose"); r = 2; }
+    if (r == 0 && !to_stdout) printf("Wrote key to %s\n", outpath);
+    return r;
+}
+
+static int run_crib(Config* cfg) {
+    const char* outpath = cfg->output_path ? cfg->output_path : "-";
+    int to_stdout = strcmp(outpath, "-") == 0;
+
+    CribResult result;
+    int r = crack_crib(cfg->input, cfg->input_len, cfg->crib, cfg->crib_at, cfg->crack_rotors, cfg->threads, &result);
+    if (r != 0) return r;
+    double s = (double)result.ns / 1e9;
+    fprintf(stderr, "Crib search: %llu stops at %llu crib offsets (%llu more ruled out) in %.2f s (%.2f M stops/s), %llu survived\n",
+            (unsigned long long)result.tested, (unsigned long long)result.offsets, (unsigned long long)result.ruled_out, s,
+            s > 0 ? (double)result.tested / s / 1e6 : 0.0, (unsigned long long)result.found);
+    if (result.stop_count == 0) {
+        fprintf(stderr, "No stop survived: the crib does not fit these rotors there\n");
+        free_crib_result(&result);
+        return 0;
+    }
+
+    FILE* fout = to_stdout ? stdout : fopen(outpath, "w");
+    if (!fout) { perror("fopen"); free_crib_result(&result); return 2; }
+    r = write_crib_stops(fout, &result) != 0 ? 2 : 0;
+    if (!to_stdout && fclose(fout) != 0) { perror("fclose"); r = 2; }
+    if (r == 0 && !to_stdout) printf("Wrote %zu stops to %s\n", result.stop_count, outpath);
+    free_crib_result(&result);
+    return r;
+}
+
+/* Measure this machine's engine thresholds and save them where later runs load them
+   (-o, or the default profile path); the measurements go to stderr */
+static int run_tune(Config* cfg) {
+    const char* path = cfg->output_path ? cfg->output_path : engine_profile_path();
+    if (!path) {
+        fprintf(stderr, "Error: no home directory to keep the engine profile in, give a file with -o\n");
+        return 2;
+    }
+    int to_stdout = strcmp(path, "-") == 0;
+
+    EngineProfile profile;
+    int r = engine_tune(&profile, stderr);
+    if (r != 0) return r;
+
+    FILE* fout = to_stdout ? stdout : fopen(path, "w");
+    if (!fout) { perror(path); return 2; }
+    r = write_engine_profile(fout, &profile) != 0 ? 2 : 0;
+    if (!to_stdout && fclose(fout) != 0) { perror("fclose"); r = 2; }
+    if (r == 0 && !to_stdout) printf("Wrote engine profile to %s\n", path);
+    return r;
+}
 
-// TODO: arena allocator
+/* Report --stats and release the configuration; returns r */
+static int finish(Config* cfg, int r) {
+    stats_report(stderr, (StatsFormat)cfg->stats);
+    free_config(cfg);
+    return r;
+}
 
 int main(int argc, char* argv[]) {
     Config cfg;
@@ -14,22 +185,72 @@ int main(int argc, char* argv[]) {
     if (r == -2) return 0;  // help
     if (r != 0) return r;
 
+    if (cfg.tune) {
+        r = run_tune(&cfg);
+        return finish(&cfg, r);
+    }
+
+    if (cfg.batch_path) {
+        r = run_batch(cfg.batch_path, cfg.threads);
+        return finish(&cfg, r);
+    }
+
+    if (cfg.serve_path) {
+        r = run_server(cfg.serve_path, cfg.threads);
+        return finish(&cfg, r);
+    }
+
+    if (cfg.crack) {
+        r = cfg.crib ? run_crib(&cfg) : run_crack(&cfg);
+        return finish(&cfg, r);
+    }
+
+    if (cfg.image_path) {
+        r = write_key_image(cfg.key, cfg.image_path);
+        if (r == 0) printf("Wrote compiled key to %s\n", cfg.image_path);
+        return finish(&cfg, r);
+    }
+
+    const char* outpath = cfg.output_path ? cfg.output_path : (do_encrypt ? "output.enc" : "output.dec");
+
+    if (cfg.indexed) {
+        r = run_indexed(&cfg, outpath, do_encrypt);
+        return finish(&cfg, r);
+    }
+
+    if (cfg.io_mode == IO_MMAP) {
+        r = encrypt_mapped(&cfg, outpath);
+        if (r == MAPPED_UNSUPPORTED) {
+            r = run_stream(&cfg, outpath);     // pipes and devices cannot be mapped
+        } else if (r == 0 && strcmp(outpath, "-") != 0) {
+            printf("Wrote result to %s\n", outpath);
+        }
+        return finish(&cfg, r);
+    }
+
+    if (cfg.io_mode == IO_STREAM) {
+        r = run_stream(&cfg, outpath);
+        return finish(&cfg, r);
+    }
+
+    cfg.out_buffer = cfg.input;            // encipher in place, the plaintext is not needed afterwards
     encrypt(&cfg);
 
     if (!cfg.out_buffer) {
         fprintf(stderr, "No output produced\n");
-        free_config(&cfg);
-        return 1;
+        return finish(&cfg, 1);
     }
 
-    const char* outpath = cfg.output_path ? cfg.output_path : (do_encrypt ? "output.enc" : "output.dec");
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
     FILE* fout = fopen(outpath, "wb");
-    if (!fout) { perror("fopen"); free_config(&cfg); return 2; }
-    fwrite(cfg.out_buffer, 1, strlen(cfg.out_buffer), fout);
+    if (!fout) { perror("fopen"); return finish(&cfg, 2); }
+    fwrite(cfg.out_buffer, 1, cfg.out_len, fout);
     fclose(fout);
+    if (STATS_ON) {
+        stats_add_time(STATS_WRITE, t0);
+        stats_add_bytes(0, cfg.out_len);
+    }
 
     printf("Wrote result to %s\n", outpath);
-
-    free_config(&cfg);
-    return 0;
+    return finish(&cfg, 0);
 }
@@ -0,0 +1,140 @@
+#include "../include/mmap-io.h"
+
+#ifdef WIN32
+
+int encrypt_mapped(Config* config, const char* output_path) {
+    (void)config; (void)output_path;
+    return MAPPED_UNSUPPORTED;
+}
+
+#else
+
+#include "../include/encrypt.h"
+#include "../include/engine.h"
+#include "../include/key-compiler.h"
+#include "../include/parallel.h"
+#include "../include/stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Access hints: one sequential pass, huge pages where the kernel offers them */
+static void advise_sequential(void* addr, size_t len) {
+    madvise(addr, len, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    madvise(addr, len, MADV_HUGEPAGE);
+#endif
+}
+
+static void encipher_mapping(Config* config, const char* in, char* out, size_t len) {
+    const Key* k = config->key;
+    ThreadPool* pool = engine_parallel(config->threads, len) ? thread_pool_create(config->threads) : NULL;
+    if (pool) encrypt_parallel(pool, k->compiled, &config->state, in, out, len);
+    else encrypt_buffer(k->compiled, &config->state, in, out, len);
+    thread_pool_destroy(pool);
+    /* Reading and writing happen in page faults on the mappings, inside the cipher time */
+    if (STATS_ON) stats_add_bytes(len, len);
+}
+
+static int write_all(int fd, const char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Copy-on-write mapping of the input, enciphered in place and written to out_fd
+   (stdout, or an output that cannot be mapped such as a device or a pipe) */
+static int encrypt_to_fd(Config* config, int fd, size_t len, int out_fd) {
+    char* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) { perror("mmap"); return 5; }
+    advise_sequential(map, len);
+    encipher_mapping(config, map, map, len);
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
+    int rc = write_all(out_fd, map, len) == 0 ? 0 : 4;
+    if (STATS_ON) stats_add_time(STATS_WRITE, t0);
+    if (rc) perror("write");
+    munmap(map, len);
+    return rc;
+}
+
+/* Shared writable mapping of the input file itself */
+static int encrypt_file_in_place(Config* config, const char* path, size_t len) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) { perror("open"); return 2; }
+    char* map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) { perror("mmap"); return 5; }
+    advise_sequential(map, len);
+    encipher_mapping(config, map, map, len);
+    munmap(map, len);
+    return 0;
+}
+
+static int encrypt_to_file(Config* config, const char* in, const char* output_path, size_t len) {
+    int fd = open(output_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) { perror("open"); return 2; }
+    if (ftruncate(fd, (off_t)len) != 0) { perror("ftruncate"); close(fd); return 4; }
+    if (len == 0) { close(fd); return 0; }
+
+    char* out = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (out == MAP_FAILED) { perror("mmap"); return 5; }
+    advise_sequential(out, len);
+    encipher_mapping(config, in, out, len);
+    munmap(out, len);
+    return 0;
+}
+
+int encrypt_mapped(Config* config, const char* output_path) {
+    if (!config || !config->key || !config->input_path || !output_path) return 1;
+
+    const Key* k = config->key;
+    if (!k->compiled) return 3;
+
+    int fd = open(config->input_path, O_RDONLY);
+    if (fd < 0) { perror("open"); return 4; }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return MAPPED_UNSUPPORTED;
+    }
+    size_t len = (size_t)st.st_size;
+
+    int rc;
+    struct stat ost;
+    if (strcmp(output_path, "-") == 0) {
+        rc = len ? encrypt_to_fd(config, fd, len, STDOUT_FILENO) : 0;
+    } else if (stat(output_path, &ost) == 0 && ost.st_dev == st.st_dev && ost.st_ino == st.st_ino) {
+        rc = len ? encrypt_file_in_place(config, config->input_path, len) : 0;
+    } else if (stat(output_path, &ost) == 0 && !S_ISREG(ost.st_mode)) {
+        /* Devices and pipes cannot be sized and mapped: write to them */
+        int out_fd = open(output_path, O_WRONLY);
+        if (out_fd < 0) { perror("open"); close(fd); return 2; }
+        rc = len ? encrypt_to_fd(config, fd, len, out_fd) : 0;
+        if (close(out_fd) != 0 && rc == 0) { perror("close"); rc = 4; }
+    } else if (len == 0) {
+        rc = encrypt_to_file(config, NULL, output_path, 0);
+    } else {
+        char* in = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (in == MAP_FAILED) { perror("mmap"); close(fd); return 5; }
+        advise_sequential(in, len);
+        rc = encrypt_to_file(config, in, output_path, len);
+        munmap(in, len);
+    }
+    close(fd);
+    return rc;
+}
+
+#endif /* WIN32 */
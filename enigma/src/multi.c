@@ -0,0 +1,471 @@
+#include "../include/multi.h"
+#include "../include/encrypt-simd.h"
+#include "../include/key-compiler.h"
+#include "../include/stats.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_LANES 1
+#include <immintrin.h>
+#endif
+
+/* Lane classes: jobs whose rotor state is in their key's period table, or
+   stepping jobs grouped by rotor count (1 to MAX_ROTORS) */
+#define LANE_PERIOD 0
+#define LANE_CLASSES (MAX_ROTORS + 1)
+
+/* Period jobs this long are vectorised better within the message (encrypt-simd.h) */
+#define LANE_PERIOD_MAX_LEN 128
+
+/*
+ * The messages in flight, structure-of-arrays: entry l of every array belongs to
+ * lane l. All lanes of a group share a class, so they run the same code on their
+ * own tables. Idle lanes (no job left) read zero bytes, which never step.
+ */
+typedef struct LaneGroup {
+    const MultiJob* jobs;
+    size_t count;
+    size_t next;                        // next job to look at for this class
+    int cls;
+    size_t n;                           // rotor count of stepping lanes
+    PeriodKernel kernel;                // for a period job left on its own
+    void (*build_inner)(struct LaneGroup* g, int l);
+
+    const MultiJob* job[MULTI_LANES];   // NULL when idle
+    const CompiledKey* key[MULTI_LANES];
+    const char* in[MULTI_LANES];
+    char* out[MULTI_LANES];
+    size_t left[MULTI_LANES];
+
+    /* Period lanes: state index before the next letter, and where the table wraps */
+    uint32_t j[MULTI_LANES];
+    uint32_t state_count[MULTI_LANES];
+    uint32_t cycle_start[MULTI_LANES];
+
+    /* Stepping lanes: rotor positions and notches, rotor r of lane l at [r][l],
+       and the fused slow rotors of each lane (see compile_inner_table) */
+    uint32_t pos[MAX_ROTORS][MULTI_LANES];
+    uint32_t notch[MAX_ROTORS][MULTI_LANES];
+    unsigned char inner[MULTI_LANES][32];
+
+    char idle_in[4];
+    char idle_out[4];
+} LaneGroup;
+
+static int job_class(const MultiJob* job) {
+    if (!job->key || !job->state || !job->len || !job->in || !job->out) return -1;
+    if (lookup_state(job->key, job->state->positions) != STATE_NONE) return LANE_PERIOD;
+    return (int)job->key->rotor_count;
+}
+
+/* Rebuild lane l's inner table from its positions */
+static void build_inner_scalar(LaneGroup* g, int l) {
+    unsigned char p[MAX_ROTORS];
+    for (size_t r = 0; r < g->n; ++r) p[r] = (unsigned char)g->pos[r][l];
+    compile_inner_table(g->key[l], p, g->inner[l], g->n);
+}
+
+/* Put the next job of the group's class on lane l; returns 0 (lane idle) if none is left */
+static int load_lane(LaneGroup* g, int l) {
+    while (g->next < g->count && job_class(&g->jobs[g->next]) != g->cls) ++g->next;
+    if (g->next == g->count) {
+        /* Keep the last key so that the lane's lookups stay inside valid tables */
+        g->job[l] = NULL;
+        g->in[l] = g->idle_in;
+        g->out[l] = g->idle_out;
+        g->left[l] = 0;
+        return 0;
+    }
+
+    const MultiJob* job = &g->jobs[g->next++];
+    const CompiledKey* ck = job->key;
+    g->job[l] = job;
+    g->key[l] = ck;
+    g->in[l] = job->in;
+    g->out[l] = job->out;
+    g->left[l] = job->len;
+    if (g->cls == LANE_PERIOD) {
+        g->j[l] = (uint32_t)lookup_state(ck, job->state->positions);
+        g->state_count[l] = (uint32_t)ck->state_count;
+        g->cycle_start[l] = (uint32_t)ck->cycle_start;
+    } else {
+        for (size_t r = 0; r < g->n; ++r) {
+            g->pos[r][l] = job->state->positions[r];
+            g->notch[r][l] = ck->notches[r];
+        }
+        g->build_inner(g, l);
+    }
+    return 1;
+}
+
+/* Write the rotor state of lane l's finished job back */
+static void retire_lane(LaneGroup* g, int l) {
+    const CompiledKey* ck = g->key[l];
+    unsigned char* positions = g->job[l]->state->positions;
+    if (g->cls == LANE_PERIOD) memcpy(positions, ck->state_positions + (size_t)g->j[l] * ck->rotor_count, ck->rotor_count);
+    else for (size_t r = 0; r < g->n; ++r) positions[r] = (unsigned char)g->pos[r][l];
+}
+
+/* Encipher the next len bytes of lane l on its own */
+static void run_lane(LaneGroup* g, int l, size_t len) {
+    const CompiledKey* ck = g->key[l];
+    const char* in = g->in[l];
+    char* out = g->out[l];
+
+    if (g->cls == LANE_PERIOD) {
+        g->j[l] = (uint32_t)g->kernel(ck, g->j[l], in, out, len);
+    } else {
+        size_t n = g->n;
+        unsigned char p[MAX_ROTORS];
+        for (size_t r = 0; r < n; ++r) p[r] = (unsigned char)g->pos[r][l];
+        const unsigned char* inner = g->inner[l];
+        for (size_t i = 0; i < len; ++i) {
+            int upper;
+            int idx = cipher_index((unsigned char)in[i], &upper);
+            if (idx < 0) {
+                out[i] = in[i];
+                continue;
+            }
+            if (step_positions(ck->notches, n, p)) {
+                for (size_t r = 0; r < n; ++r) g->pos[r][l] = p[r];
+                g->build_inner(g, l);
+            }
+            int fast = p[0];
+            out[i] = (char)((upper ? 'A' : 'a') + ck->exit[fast][inner[ck->entry[fast][idx]]]);
+        }
+        for (size_t r = 0; r < n; ++r) g->pos[r][l] = p[r];
+    }
+    g->in[l] += len;
+    g->out[l] += len;
+    g->left[l] -= len;
+}
+
+/* One lane at a time: no vector unit to spread the jobs over, but still none of the
+   per-call work of encrypt_buffer() */
+static void run_lanes_scalar(LaneGroup* g) {
+    while (load_lane(g, 0)) {
+        run_lane(g, 0, g->left[0]);
+        retire_lane(g, 0);
+    }
+}
+
+#ifdef HAVE_X86_LANES
+
+/*
+ * Four bytes of every lane per tick: one gather fetches them from the eight messages,
+ * then each byte is classified, stepped and looked up in 32-bit lanes and the results
+ * are stored back four bytes per message. Table lookups gather the 32-bit word that
+ * ends at the wanted byte (every table has other data of its key in front of it), so
+ * nothing is read past a table's end. Addresses are 64-bit offsets from the group.
+ */
+
+/* 64-bit offset of p - 3 from the group, for gathering the byte at p */
+static inline int64_t lane_offset(const LaneGroup* g, const void* p) {
+    return (int64_t)((intptr_t)p - (intptr_t)g) - 3;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i gather_bytes(const LaneGroup* g, __m256i lo, __m256i hi, __m256i offsets) {
+    __m256i a = _mm256_add_epi64(lo, _mm256_cvtepi32_epi64(_mm256_castsi256_si128(offsets)));
+    __m256i b = _mm256_add_epi64(hi, _mm256_cvtepi32_epi64(_mm256_extracti128_si256(offsets, 1)));
+    const int* base = (const int*)(const void*)g;
+    __m128i ga = _mm256_i64gather_epi32(base, a, 1);
+    __m128i gb = _mm256_i64gather_epi32(base, b, 1);
+    return _mm256_srli_epi32(_mm256_inserti128_si256(_mm256_castsi128_si256(ga), gb, 1), 24);
+}
+
+/* Offsets of table[l] for lanes 0-3 (lo) and 4-7 (hi) */
+__attribute__((target("avx2")))
+static inline void lane_tables(const LaneGroup* g, const unsigned char* const table[MULTI_LANES], __m256i* lo, __m256i* hi) {
+    int64_t o[MULTI_LANES];
+    for (int l = 0; l < MULTI_LANES; ++l) o[l] = lane_offset(g, table[l]);
+    *lo = _mm256_loadu_si256((const __m256i*)(const void*)o);
+    *hi = _mm256_loadu_si256((const __m256i*)(const void*)(o + 4));
+}
+
+/* Look all 32 bytes of v (each 0-25) up in a 26-byte row with two in-lane shuffles:
+   bytes 0-15 of the row for v < 16, bytes 10-25 for the rest, so nothing past the
+   row is read */
+__attribute__((target("avx2")))
+static inline __m256i lookup_row(const unsigned char* row, __m256i v) {
+    __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(const void*)row));
+    __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(const void*)(row + 10)));
+    __m256i high = _mm256_cmpgt_epi8(v, _mm256_set1_epi8(15));
+    return _mm256_blendv_epi8(_mm256_shuffle_epi8(lo, v), _mm256_shuffle_epi8(hi, _mm256_sub_epi8(v, _mm256_set1_epi8(10))), high);
+}
+
+/* build_inner_scalar with the 26 letters in one vector: a shuffle per rotor instead
+   of 26 loads */
+__attribute__((target("avx2")))
+static void build_inner_avx2(LaneGroup* g, int l) {
+    const CompiledKey* ck = g->key[l];
+    size_t n = g->n;
+    __m256i v = _mm256_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+                                 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 0, 0, 0, 0, 0, 0);
+    for (size_t r = 1; r < n; ++r) v = lookup_row(ck->forward[r][g->pos[r][l]], v);
+    v = lookup_row(ck->reflector, v);
+    for (size_t r = n; r-- > 1;) v = lookup_row(ck->backward[r][g->pos[r][l]], v);
+    _mm256_storeu_si256((__m256i*)(void*)g->inner[l], v);
+}
+
+/* Byte k of every lane's quad: the byte, its letter index (spaces as X), the
+   letter mask and the lowercase mask */
+typedef struct LaneBytes {
+    __m256i byte, idx, letter, lower;
+} LaneBytes;
+
+__attribute__((target("avx2")))
+static inline LaneBytes classify(__m256i quad, int k) {
+    const __m256i max_index = _mm256_set1_epi32(25);
+    LaneBytes b;
+    b.byte = _mm256_and_si256(_mm256_srli_epi32(quad, 8 * k), _mm256_set1_epi32(0xFF));
+    __m256i ui = _mm256_sub_epi32(b.byte, _mm256_set1_epi32('A'));
+    __m256i li = _mm256_sub_epi32(b.byte, _mm256_set1_epi32('a'));
+    __m256i up = _mm256_cmpeq_epi32(_mm256_min_epu32(ui, max_index), ui);
+    b.lower = _mm256_cmpeq_epi32(_mm256_min_epu32(li, max_index), li);
+    b.letter = _mm256_or_si256(_mm256_or_si256(up, b.lower), _mm256_cmpeq_epi32(b.byte, _mm256_set1_epi32(' ')));
+    b.idx = _mm256_blendv_epi8(_mm256_blendv_epi8(_mm256_set1_epi32('X' - 'A'), li, b.lower), ui, up);
+    return b;
+}
+
+/* The enciphered byte where there is a letter, the original byte elsewhere */
+__attribute__((target("avx2")))
+static inline __m256i finish_byte(const LaneBytes* b, __m256i v) {
+    __m256i r = _mm256_add_epi32(v, _mm256_blendv_epi8(_mm256_set1_epi32('A'), _mm256_set1_epi32('a'), b->lower));
+    return _mm256_blendv_epi8(b->byte, r, b->letter);
+}
+
+/* Moves through the messages four bytes per tick; idle lanes stay on their zero quad */
+typedef struct LaneCursor {
+    __m256i in_lo, in_hi, step_lo, step_hi;
+    char* out[MULTI_LANES];
+    size_t step[MULTI_LANES];
+} LaneCursor;
+
+__attribute__((target("avx2")))
+static inline void cursor_init(const LaneGroup* g, LaneCursor* c) {
+    int64_t in[MULTI_LANES], step[MULTI_LANES];
+    for (int l = 0; l < MULTI_LANES; ++l) {
+        in[l] = lane_offset(g, g->in[l]) + 3;
+        step[l] = g->job[l] ? 4 : 0;
+        c->out[l] = g->out[l];
+        c->step[l] = (size_t)step[l];
+    }
+    c->in_lo = _mm256_loadu_si256((const __m256i*)(const void*)in);
+    c->in_hi = _mm256_loadu_si256((const __m256i*)(const void*)(in + 4));
+    c->step_lo = _mm256_loadu_si256((const __m256i*)(const void*)step);
+    c->step_hi = _mm256_loadu_si256((const __m256i*)(const void*)(step + 4));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i cursor_load(const LaneGroup* g, const LaneCursor* c) {
+    const int* base = (const int*)(const void*)g;
+    __m128i a = _mm256_i64gather_epi32(base, c->in_lo, 1);
+    __m128i b = _mm256_i64gather_epi32(base, c->in_hi, 1);
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1);
+}
+
+__attribute__((target("avx2")))
+static inline void cursor_store(LaneCursor* c, __m256i quad) {
+    uint32_t q[MULTI_LANES];
+    _mm256_storeu_si256((__m256i*)(void*)q, quad);
+    for (int l = 0; l < MULTI_LANES; ++l) {
+        memcpy(c->out[l], &q[l], 4);
+        c->out[l] += c->step[l];
+    }
+    c->in_lo = _mm256_add_epi64(c->in_lo, c->step_lo);
+    c->in_hi = _mm256_add_epi64(c->in_hi, c->step_hi);
+}
+
+/* Period lanes: step the state index, then one lookup in the lane's period table */
+__attribute__((target("avx2")))
+static void ticks_period(LaneGroup* g, size_t ticks) {
+    const unsigned char* states[MULTI_LANES];
+    for (int l = 0; l < MULTI_LANES; ++l) states[l] = g->key[l]->states[0];
+    __m256i states_lo, states_hi;
+    lane_tables(g, states, &states_lo, &states_hi);
+    const __m256i count = _mm256_loadu_si256((const __m256i*)(const void*)g->state_count);
+    const __m256i cycle_start = _mm256_loadu_si256((const __m256i*)(const void*)g->cycle_start);
+    const __m256i row_size = _mm256_set1_epi32(26);
+    __m256i j = _mm256_loadu_si256((const __m256i*)(const void*)g->j);
+
+    LaneCursor c;
+    cursor_init(g, &c);
+    for (size_t t = 0; t < ticks; ++t) {
+        __m256i quad = cursor_load(g, &c), result = _mm256_setzero_si256();
+        for (int k = 0; k < 4; ++k) {
+            LaneBytes b = classify(quad, k);
+            j = _mm256_sub_epi32(j, b.letter);
+            j = _mm256_blendv_epi8(j, cycle_start, _mm256_cmpeq_epi32(j, count));
+            __m256i v = gather_bytes(g, states_lo, states_hi, _mm256_add_epi32(_mm256_mullo_epi32(j, row_size), b.idx));
+            result = _mm256_or_si256(result, _mm256_slli_epi32(finish_byte(&b, v), 8 * k));
+        }
+        cursor_store(&c, result);
+    }
+    _mm256_storeu_si256((__m256i*)(void*)g->j, j);
+}
+
+/*
+ * Stepping lanes: the pawls of every lane compared at once, the fast rotor through
+ * the lane's entry and exit tables, the slow rotors through its inner table. Slow
+ * rotors move on about one letter in 26; only then are positions written back and
+ * the inner tables of the lanes concerned rebuilt.
+ */
+__attribute__((target("avx2")))
+static void ticks_stepping(LaneGroup* g, size_t ticks) {
+    const size_t n = g->n;
+    const unsigned char* entries[MULTI_LANES];
+    const unsigned char* exits[MULTI_LANES];
+    for (int l = 0; l < MULTI_LANES; ++l) {
+        entries[l] = g->key[l]->entry[0];
+        exits[l] = g->key[l]->exit[0];
+    }
+    __m256i entry_lo, entry_hi, exit_lo, exit_hi;
+    lane_tables(g, entries, &entry_lo, &entry_hi);
+    lane_tables(g, exits, &exit_lo, &exit_hi);
+    const int* inner = (const int*)(const void*)(g->inner[0] - 3);
+    const __m256i inner_rows = _mm256_setr_epi32(0, 32, 64, 96, 128, 160, 192, 224);
+    const __m256i row_size = _mm256_set1_epi32(26), wrap = _mm256_set1_epi32(26);
+    __m256i pos0 = _mm256_loadu_si256((const __m256i*)(const void*)g->pos[0]);
+    const __m256i notch0 = _mm256_loadu_si256((const __m256i*)(const void*)g->notch[0]);
+
+    LaneCursor c;
+    cursor_init(g, &c);
+    for (size_t t = 0; t < ticks; ++t) {
+        __m256i quad = cursor_load(g, &c), result = _mm256_setzero_si256();
+        for (int k = 0; k < 4; ++k) {
+            LaneBytes b = classify(quad, k);
+
+            /* Pawl r + 1 engages where rotor r sits at its notch (positions before the press) */
+            __m256i moved = _mm256_setzero_si256();
+            if (n > 1) {
+                moved = _mm256_and_si256(_mm256_cmpeq_epi32(pos0, notch0), b.letter);
+                for (size_t r = 1; r + 1 < n; ++r) {
+                    __m256i p = _mm256_loadu_si256((const __m256i*)(const void*)g->pos[r]);
+                    __m256i notch = _mm256_loadu_si256((const __m256i*)(const void*)g->notch[r]);
+                    moved = _mm256_or_si256(moved, _mm256_and_si256(_mm256_cmpeq_epi32(p, notch), b.letter));
+                }
+            }
+            if (!_mm256_testz_si256(moved, moved)) {
+                __m256i prev = _mm256_and_si256(_mm256_cmpeq_epi32(pos0, notch0), b.letter);
+                for (size_t r = 1; r < n; ++r) {
+                    __m256i p = _mm256_loadu_si256((const __m256i*)(const void*)g->pos[r]);
+                    __m256i at = _mm256_setzero_si256();
+                    if (r + 1 < n) {
+                        __m256i notch = _mm256_loadu_si256((const __m256i*)(const void*)g->notch[r]);
+                        at = _mm256_and_si256(_mm256_cmpeq_epi32(p, notch), b.letter);
+                    }
+                    p = _mm256_sub_epi32(p, _mm256_or_si256(at, prev));
+                    p = _mm256_andnot_si256(_mm256_cmpeq_epi32(p, wrap), p);
+                    _mm256_storeu_si256((__m256i*)(void*)g->pos[r], p);
+                    prev = at;
+                }
+                unsigned lanes = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(moved));
+                for (; lanes; lanes &= lanes - 1) build_inner_avx2(g, __builtin_ctz(lanes));
+            }
+            pos0 = _mm256_sub_epi32(pos0, b.letter);
+            pos0 = _mm256_andnot_si256(_mm256_cmpeq_epi32(pos0, wrap), pos0);
+
+            __m256i row = _mm256_mullo_epi32(pos0, row_size);
+            __m256i v = gather_bytes(g, entry_lo, entry_hi, _mm256_add_epi32(row, b.idx));
+            v = _mm256_srli_epi32(_mm256_i32gather_epi32(inner, _mm256_add_epi32(inner_rows, v), 1), 24);
+            v = gather_bytes(g, exit_lo, exit_hi, _mm256_add_epi32(row, v));
+            result = _mm256_or_si256(result, _mm256_slli_epi32(finish_byte(&b, v), 8 * k));
+        }
+        cursor_store(&c, result);
+    }
+    _mm256_storeu_si256((__m256i*)(void*)g->pos[0], pos0);
+}
+
+/* load_lane, running long period jobs straight away with the kernel for one message */
+static int fill_lane(LaneGroup* g, int l) {
+    while (load_lane(g, l)) {
+        if (g->cls != LANE_PERIOD || g->left[l] < LANE_PERIOD_MAX_LEN) return 1;
+        run_lane(g, l, g->left[l]);
+        retire_lane(g, l);
+    }
+    return 0;
+}
+
+__attribute__((target("avx2")))
+static void run_lanes_avx2(LaneGroup* g) {
+    int active = 0;
+    for (int l = 0; l < MULTI_LANES; ++l) active += fill_lane(g, l);
+
+    while (active > 1) {
+        /* Run every lane until the first one has less than a quad left */
+        size_t ticks = SIZE_MAX;
+        for (int l = 0; l < MULTI_LANES; ++l) if (g->job[l] && g->left[l] / 4 < ticks) ticks = g->left[l] / 4;
+        if (ticks) {
+            if (g->cls == LANE_PERIOD) ticks_period(g, ticks);
+            else ticks_stepping(g, ticks);
+            for (int l = 0; l < MULTI_LANES; ++l) {
+                if (!g->job[l]) continue;
+                g->in[l] += 4 * ticks;
+                g->out[l] += 4 * ticks;
+                g->left[l] -= 4 * ticks;
+            }
+        }
+        /* Finish the tails and take the next jobs */
+        for (int l = 0; l < MULTI_LANES; ++l) {
+            if (!g->job[l] || g->left[l] >= 4) continue;
+            run_lane(g, l, g->left[l]);
+            retire_lane(g, l);
+            active -= !fill_lane(g, l);
+        }
+    }
+
+    /* A single message left is better off with the kernels for one message */
+    for (int l = 0; l < MULTI_LANES; ++l) {
+        if (!g->job[l]) continue;
+        do {
+            run_lane(g, l, g->left[l]);
+            retire_lane(g, l);
+        } while (load_lane(g, l));
+    }
+}
+
+#endif /* HAVE_X86_LANES */
+
+void encrypt_multi(const MultiJob* jobs, size_t count) {
+    if (!jobs) return;
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
+
+    unsigned classes = 0;
+    for (size_t i = 0; i < count; ++i) {
+        int cls = job_class(&jobs[i]);
+        if (cls < 0) continue;
+        classes |= 1u << cls;
+        if (STATS_ON) stats_count_chars(jobs[i].in, jobs[i].len);
+    }
+
+    void (*run)(LaneGroup*) = run_lanes_scalar;
+    void (*build)(LaneGroup*, int) = build_inner_scalar;
+#ifdef HAVE_X86_LANES
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        run = run_lanes_avx2;
+        build = build_inner_avx2;
+    }
+#endif
+    PeriodKernel kernel = select_period_kernel();
+
+    for (int cls = 0; cls < LANE_CLASSES; ++cls) {
+        if (!(classes & (1u << cls))) continue;
+        LaneGroup g;
+        memset(&g, 0, sizeof(g));
+        g.jobs = jobs;
+        g.count = count;
+        g.cls = cls;
+        g.n = cls == LANE_PERIOD ? 0 : (size_t)cls;
+        g.kernel = kernel;
+        g.build_inner = build;
+        /* Idle lanes look up in the first job's tables */
+        while (job_class(&jobs[g.next]) != cls) ++g.next;
+        for (int l = 0; l < MULTI_LANES; ++l) g.key[l] = jobs[g.next].key;
+        run(&g);
+    }
+    if (STATS_ON) stats_add_time(STATS_CIPHER, t0);
+}
@@ -0,0 +1,59 @@
+#include "../include/parallel.h"
+#include "../include/encrypt.h"
+#include "../include/key-compiler.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ParallelJob {
+    const CompiledKey* ck;
+    const RotorState* start;            // rotor state before the first chunk
+    const char* in;
+    char* out;
+    size_t len;
+    uint64_t* letters;                  // letters per chunk, then letters before each chunk
+} ParallelJob;
+
+static void count_chunk(void* arg, size_t chunk) {
+    ParallelJob* job = arg;
+    size_t begin = chunk * PARALLEL_CHUNK_SIZE;
+    size_t size = job->len - begin < PARALLEL_CHUNK_SIZE ? job->len - begin : PARALLEL_CHUNK_SIZE;
+    job->letters[chunk] = count_letters(job->in + begin, size);
+}
+
+static void encrypt_chunk(void* arg, size_t chunk) {
+    ParallelJob* job = arg;
+    size_t begin = chunk * PARALLEL_CHUNK_SIZE;
+    size_t size = job->len - begin < PARALLEL_CHUNK_SIZE ? job->len - begin : PARALLEL_CHUNK_SIZE;
+
+    RotorState state = *job->start;
+    seek_rotors(job->ck, state.positions, job->letters[chunk]);
+    encrypt_buffer(job->ck, &state, job->in + begin, job->out + begin, size);
+}
+
+void encrypt_parallel(ThreadPool* pool, const CompiledKey* ck, RotorState* state, const char* in, char* out, size_t len) {
+    if (!ck || !state || !in || !out) return;
+    size_t chunks = (len + PARALLEL_CHUNK_SIZE - 1) / PARALLEL_CHUNK_SIZE;
+    uint64_t* letters = chunks > 1 && pool ? malloc(chunks * sizeof(*letters)) : NULL;
+    if (!letters) {
+        encrypt_buffer(ck, state, in, out, len);
+        return;
+    }
+
+    ParallelJob job = { ck, state, in, out, len, letters };
+
+    /* Pass 1: letters per chunk; turn them into the count of letters before each chunk */
+    thread_pool_run(pool, chunks, count_chunk, &job);
+    uint64_t total = 0;
+    for (size_t c = 0; c < chunks; ++c) {
+        uint64_t n = letters[c];
+        letters[c] = total;
+        total += n;
+    }
+
+    /* Pass 2: every chunk from its own start state */
+    thread_pool_run(pool, chunks, encrypt_chunk, &job);
+
+    seek_rotors(ck, state->positions, total);
+    free(letters);
+}
@@ -0,0 +1,511 @@
+#include "../include/server.h"
+
+#if !defined(__linux__)
+
+#include <stdio.h>
+
+int run_server(const char* socket_path, size_t threads) {
+    (void)socket_path; (void)threads;
+    fprintf(stderr, "Error: --serve needs epoll, which this platform does not have\n");
+    return 1;
+}
+
+#else
+
+#include "../include/config.h"
+#include "../include/encrypt.h"
+#include "../include/key-image.h"
+#include "../include/key-parser.h"
+#include "../include/thread-pool.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+/* Receive buffers above this size are released once their response is written */
+#define KEEP_BUFFER_SIZE (1024 * 1024)
+
+#define CACHE_BUCKETS 256
+#define MAX_EVENTS 64
+
+/* A compiled key and the file state it was loaded from */
+typedef struct CachedKey {
+    char* path;
+    struct timespec mtime;
+    off_t size;
+    ino_t ino;
+    dev_t dev;
+    Key* key;                           // NULL until loaded, or if loading failed
+    int retired;                        // no longer in the cache, freed after the round
+    struct CachedKey* prev;             // LRU list, most recently used first
+    struct CachedKey* next;
+    struct CachedKey* chain;            // next entry in the same hash bucket
+} CachedKey;
+
+typedef struct KeyCache {
+    CachedKey* buckets[CACHE_BUCKETS];
+    CachedKey* head;
+    CachedKey* tail;
+    size_t count;
+} KeyCache;
+
+typedef struct Connection {
+    int fd;
+    char* buf;                          // the current frame as received; enciphered in place
+    size_t cap;
+    size_t len;
+    size_t data_offset;                 // start of the message in buf once the header is known
+    size_t frame;                       // total frame bytes once the header is known, else 0
+    int busy;                           // a complete frame is being served or answered
+    int closing;                        // close once the response is written
+    CachedKey* key;                     // key of the current frame
+    ServeResponse response;
+    size_t sent;                        // response bytes (header and data) written so far
+    struct Connection* prev;            // all open connections
+    struct Connection* next;
+} Connection;
+
+typedef struct Server {
+    int epoll_fd;
+    int listen_fd;
+    ThreadPool* pool;
+    KeyCache cache;
+    Connection* connections;
+    Connection** ready;                 // connections with a complete frame this round
+    size_t ready_count;
+    size_t ready_cap;
+    CachedKey** loading;                // cache entries to load this round
+    size_t loading_count;
+    size_t loading_cap;
+    CachedKey* retired;                 // entries dropped this round, freed after it (linked by next)
+} Server;
+
+static volatile sig_atomic_t stop_requested;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static size_t hash_path(const char* s) {
+    uint64_t h = 14695981039346656037ull;   // FNV-1a
+    while (*s) { h ^= (unsigned char)*s++; h *= 1099511628211ull; }
+    return (size_t)(h % CACHE_BUCKETS);
+}
+
+static int push_pointer(void*** array, size_t* count, size_t* cap, void* p) {
+    if (*count == *cap) {
+        size_t grown = *cap ? *cap * 2 : 16;
+        void** a = realloc(*array, grown * sizeof(*a));
+        if (!a) return 1;
+        *array = a;
+        *cap = grown;
+    }
+    (*array)[(*count)++] = p;
+    return 0;
+}
+
+/* ---- key cache ---- */
+
+static void lru_unlink(KeyCache* c, CachedKey* e) {
+    if (e->prev) e->prev->next = e->next; else c->head = e->next;
+    if (e->next) e->next->prev = e->prev; else c->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push_front(KeyCache* c, CachedKey* e) {
+    e->prev = NULL;
+    e->next = c->head;
+    if (c->head) c->head->prev = e; else c->tail = e;
+    c->head = e;
+}
+
+/* Take e out of the cache; it is freed after the current round */
+static void retire_key(Server* s, CachedKey* e) {
+    if (e->retired) return;
+    e->retired = 1;
+    CachedKey** link = &s->cache.buckets[hash_path(e->path)];
+    while (*link != e) link = &(*link)->chain;
+    *link = e->chain;
+    lru_unlink(&s->cache, e);
+    s->cache.count--;
+    e->next = s->retired;
+    s->retired = e;
+}
+
+static void free_cached_key(CachedKey* e) {
+    free_key(e->key);
+    free(e->path);
+    free(e);
+}
+
+static int same_file(const CachedKey* e, const struct stat* st) {
+    return e->mtime.tv_sec == st->st_mtim.tv_sec && e->mtime.tv_nsec == st->st_mtim.tv_nsec &&
+           e->size == st->st_size && e->ino == st->st_ino && e->dev == st->st_dev;
+}
+
+/* Cache entry for the key file at path, queued for loading if it is new or has
+   changed on disk. NULL if the file does not exist. */
+static CachedKey* resolve_key(Server* s, const char* path) {
+    struct stat st;
+    if (stat(path, &st) != 0) return NULL;
+
+    size_t bucket = hash_path(path);
+    CachedKey* e = s->cache.buckets[bucket];
+    while (e && strcmp(e->path, path) != 0) e = e->chain;
+    if (e && !same_file(e, &st)) { retire_key(s, e); e = NULL; }
+    if (e) {
+        lru_unlink(&s->cache, e);
+        lru_push_front(&s->cache, e);
+        return e;
+    }
+
+    e = calloc(1, sizeof(*e));
+    if (!e) return NULL;
+    e->path = strdup(path);
+    if (!e->path || push_pointer((void***)&s->loading, &s->loading_count, &s->loading_cap, e)) {
+        free(e->path);
+        free(e);
+        return NULL;
+    }
+    e->mtime = st.st_mtim;
+    e->size = st.st_size;
+    e->ino = st.st_ino;
+    e->dev = st.st_dev;
+    e->chain = s->cache.buckets[bucket];
+    s->cache.buckets[bucket] = e;
+    lru_push_front(&s->cache, e);
+    s->cache.count++;
+    return e;
+}
+
+/* ---- connections ---- */
+
+static void close_connection(Server* s, Connection* c) {
+    epoll_ctl(s->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    if (c->prev) c->prev->next = c->next; else s->connections = c->next;
+    if (c->next) c->next->prev = c->prev;
+    free(c->buf);
+    free(c);
+}
+
+static int watch(Server* s, Connection* c, uint32_t events) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.ptr = c;
+    return epoll_ctl(s->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+}
+
+static void accept_connections(Server* s) {
+    for (;;) {
+        int fd = accept(s->listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        Connection* c = calloc(1, sizeof(*c));
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.ptr = c;
+        if (!c || epoll_ctl(s->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->next = s->connections;
+        if (c->next) c->next->prev = c;
+        s->connections = c;
+    }
+}
+
+/* Answer a malformed request and drop the connection after the answer */
+static void reject(Connection* c) {
+    c->response.magic = SERVE_RESPONSE_MAGIC;
+    c->response.status = SERVE_BAD_REQUEST;
+    c->response.data_len = 0;
+    c->closing = 1;
+}
+
+/*
+ * Read the current frame, never past its end: a pipelined next request stays in the
+ * socket until this one is answered. Returns 1 once the frame is complete (or has
+ * been rejected), 0 if more data is needed, -1 if the connection is gone.
+ */
+static int receive_frame(Connection* c) {
+    for (;;) {
+        size_t need = c->frame ? c->frame : sizeof(ServeRequest);
+        if (c->len == need) {
+            if (c->frame) return 1;
+            ServeRequest req;
+            memcpy(&req, c->buf, sizeof(req));
+            if (req.magic != SERVE_REQUEST_MAGIC || req.key_len == 0 || req.key_len > SERVE_MAX_KEY_PATH ||
+                req.data_len > SERVE_MAX_MESSAGE) {
+                reject(c);
+                return 1;
+            }
+            c->data_offset = sizeof(req) + req.key_len;
+            c->frame = c->data_offset + (size_t)req.data_len;
+            continue;
+        }
+        if (c->cap < need) {
+            char* buf = realloc(c->buf, need);
+            if (!buf) return -1;
+            c->buf = buf;
+            c->cap = need;
+        }
+        ssize_t n = read(c->fd, c->buf + c->len, need - c->len);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        c->len += (size_t)n;
+    }
+}
+
+/* Write as much of the response as the socket takes: 1 when done, 0 to wait, -1 on error */
+static int send_response(Connection* c) {
+    size_t header = sizeof(c->response);
+    size_t data_len = (size_t)c->response.data_len;
+    const char* data = c->buf + c->data_offset;
+    while (c->sent < header + data_len) {
+        struct iovec iov[2];
+        int count = 0;
+        if (c->sent < header) {
+            iov[count].iov_base = (char*)&c->response + c->sent;
+            iov[count].iov_len = header - c->sent;
+            ++count;
+        }
+        size_t done = c->sent > header ? c->sent - header : 0;
+        if (data_len > done) {
+            iov[count].iov_base = (char*)data + done;
+            iov[count].iov_len = data_len - done;
+            ++count;
+        }
+        ssize_t n = writev(c->fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return 0;
+            return -1;
+        }
+        c->sent += (size_t)n;
+    }
+    return 1;
+}
+
+/* Response written: get ready for the next frame on the connection */
+static void finish_response(Server* s, Connection* c) {
+    if (c->closing) { close_connection(s, c); return; }
+    c->busy = 0;
+    c->len = 0;
+    c->frame = 0;
+    c->sent = 0;
+    c->key = NULL;
+    if (c->cap > KEEP_BUFFER_SIZE) {
+        free(c->buf);
+        c->buf = NULL;
+        c->cap = 0;
+    }
+    if (watch(s, c, EPOLLIN) != 0) close_connection(s, c);
+}
+
+static void start_response(Server* s, Connection* c) {
+    int r = send_response(c);
+    if (r < 0) close_connection(s, c);
+    else if (r > 0) finish_response(s, c);
+    else if (watch(s, c, EPOLLOUT) != 0) close_connection(s, c);
+}
+
+static void handle_event(Server* s, Connection* c, uint32_t events) {
+    if (c->busy) {
+        /* Waiting to write the rest of a response */
+        if (events & (EPOLLERR | EPOLLHUP)) { close_connection(s, c); return; }
+        if (events & EPOLLOUT) start_response(s, c);
+        return;
+    }
+    int r = receive_frame(c);
+    if (r < 0) { close_connection(s, c); return; }
+    if (r == 0) return;
+    c->busy = 1;
+    if (c->closing || push_pointer((void***)&s->ready, &s->ready_count, &s->ready_cap, c)) {
+        reject(c);
+        start_response(s, c);
+    }
+}
+
+/* ---- serving ---- */
+
+static void load_task(void* arg, size_t index) {
+    CachedKey* e = ((Server*)arg)->loading[index];
+    e->key = load_key_file(e->path);
+    if (e->key && !e->key->compiled) { free_key(e->key); e->key = NULL; }
+}
+
+static void cipher_task(void* arg, size_t index) {
+    Connection* c = ((Server*)arg)->ready[index];
+    ServeRequest req;
+    memcpy(&req, c->buf, sizeof(req));
+    c->response.magic = SERVE_RESPONSE_MAGIC;
+    c->response.status = SERVE_BAD_KEY;
+    c->response.data_len = 0;
+    if (!c->key || !c->key->key) return;
+
+    const Key* k = c->key->key;
+    RotorState state = k->start;
+    if (req.offset) encrypt_seek(k, &state, req.offset);
+    char* data = c->buf + c->data_offset;
+    encrypt_buffer(k->compiled, &state, data, data, (size_t)req.data_len);
+    c->response.status = SERVE_OK;
+    c->response.data_len = req.data_len;
+}
+
+/*
+ * Serve every complete frame of this round: look up the keys, load the missing ones
+ * and encipher all messages on the pool, then trim the cache and send the answers.
+ * The cache is only touched here, on the event loop thread.
+ */
+static void serve_ready(Server* s) {
+    char path[SERVE_MAX_KEY_PATH + 1];
+    for (size_t i = 0; i < s->ready_count; ++i) {
+        Connection* c = s->ready[i];
+        ServeRequest req;
+        memcpy(&req, c->buf, sizeof(req));
+        memcpy(path, c->buf + sizeof(req), req.key_len);
+        path[req.key_len] = '\0';
+        c->key = resolve_key(s, path);
+    }
+
+    thread_pool_run(s->pool, s->loading_count, load_task, s);
+    thread_pool_run(s->pool, s->ready_count, cipher_task, s);
+
+    /* Failed loads are not cached, so a fixed key file is picked up by the next request */
+    for (size_t i = 0; i < s->loading_count; ++i) {
+        if (!s->loading[i]->key) retire_key(s, s->loading[i]);
+    }
+    while (s->cache.count > SERVE_KEY_CACHE) retire_key(s, s->cache.tail);
+    while (s->retired) {
+        CachedKey* e = s->retired;
+        s->retired = e->next;
+        free_cached_key(e);
+    }
+    s->loading_count = 0;
+
+    for (size_t i = 0; i < s->ready_count; ++i) start_response(s, s->ready[i]);
+    s->ready_count = 0;
+}
+
+static int open_socket(const char* path) {
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* Replace a socket left behind by an earlier server, but nothing else */
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            fprintf(stderr, "Error: %s exists and is not a socket\n", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) { perror("socket"); return -1; }
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int run_server(const char* socket_path, size_t threads) {
+    if (!socket_path) return 1;
+    Server s;
+    memset(&s, 0, sizeof(s));
+    s.listen_fd = open_socket(socket_path);
+    if (s.listen_fd < 0) return 2;
+    s.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    s.pool = thread_pool_create(threads);
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;                 // the listening socket
+    if (s.epoll_fd < 0 || !s.pool || epoll_ctl(s.epoll_fd, EPOLL_CTL_ADD, s.listen_fd, &ev) != 0) {
+        perror("epoll");
+        if (s.epoll_fd >= 0) close(s.epoll_fd);
+        thread_pool_destroy(s.pool);
+        close(s.listen_fd);
+        unlink(socket_path);
+        return 3;
+    }
+
+    /* No SA_RESTART: a signal interrupts epoll_wait so the loop sees the stop request */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);           // clients that hang up show up as write errors
+    stop_requested = 0;
+
+    printf("Serving on %s with %zu threads\n", socket_path, thread_pool_size(s.pool));
+    fflush(stdout);
+
+    struct epoll_event events[MAX_EVENTS];
+    int rc = 0;
+    while (!stop_requested) {
+        int n = epoll_wait(s.epoll_fd, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            rc = 4;
+            break;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (!events[i].data.ptr) accept_connections(&s);
+            else handle_event(&s, events[i].data.ptr, events[i].events);
+        }
+        if (s.ready_count) serve_ready(&s);
+    }
+
+    while (s.connections) close_connection(&s, s.connections);
+    while (s.cache.head) retire_key(&s, s.cache.head);
+    while (s.retired) {
+        CachedKey* e = s.retired;
+        s.retired = e->next;
+        free_cached_key(e);
+    }
+    free(s.ready);
+    free(s.loading);
+    thread_pool_destroy(s.pool);
+    close(s.epoll_fd);
+    close(s.listen_fd);
+    unlink(socket_path);
+    return rc;
+}
+
+#endif
@@ -0,0 +1,52 @@
+#include "../include/spsc-queue.h"
+
+#define SLOT_MASK (SPSC_QUEUE_SLOTS - 1)
+
+int spsc_queue_init(SpscQueue* q) {
+    if (!q) return 1;
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->sleeping, 0);
+    if (pthread_mutex_init(&q->lock, NULL) != 0) return 1;
+    if (pthread_cond_init(&q->wake, NULL) != 0) { pthread_mutex_destroy(&q->lock); return 1; }
+    return 0;
+}
+
+void spsc_queue_destroy(SpscQueue* q) {
+    if (!q) return;
+    pthread_cond_destroy(&q->wake);
+    pthread_mutex_destroy(&q->lock);
+}
+
+int spsc_queue_push(SpscQueue* q, void* item) {
+    size_t tail = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    if (tail - atomic_load_explicit(&q->head, memory_order_acquire) == SPSC_QUEUE_SLOTS) return 1;
+    q->slots[tail & SLOT_MASK] = item;
+
+    /* Sequentially consistent against the consumer's store to sleeping: either it
+       sees the new tail before it waits, or we see it sleeping and wake it */
+    atomic_store(&q->tail, tail + 1);
+    if (atomic_load(&q->sleeping)) {
+        pthread_mutex_lock(&q->lock);
+        pthread_cond_signal(&q->wake);
+        pthread_mutex_unlock(&q->lock);
+    }
+    return 0;
+}
+
+void* spsc_queue_pop(SpscQueue* q) {
+    size_t head = atomic_load_explicit(&q->head, memory_order_relaxed);
+    int spin = 0;
+    while (atomic_load_explicit(&q->tail, memory_order_acquire) == head) {
+        if (++spin < SPSC_QUEUE_SPIN) continue;
+        pthread_mutex_lock(&q->lock);
+        atomic_store(&q->sleeping, 1);
+        while (atomic_load(&q->tail) == head) pthread_cond_wait(&q->wake, &q->lock);
+        atomic_store(&q->sleeping, 0);
+        pthread_mutex_unlock(&q->lock);
+        break;
+    }
+    void* item = q->slots[head & SLOT_MASK];
+    atomic_store_explicit(&q->head, head + 1, memory_order_release);
+    return item;
+}
@@ -0,0 +1,101 @@
+#include "../include/stats.h"
+
+#include <stdatomic.h>
+#include <time.h>
+
+int stats_active;
+
+static atomic_uint_fast64_t phase_ns[STATS_PHASES];
+static atomic_uint_fast64_t bytes_read;
+static atomic_uint_fast64_t bytes_written;
+static atomic_uint_fast64_t letters;
+static atomic_uint_fast64_t spaces;
+static atomic_uint_fast64_t passthrough;
+static uint64_t started;
+
+static const char* PHASE_NAMES[STATS_PHASES] = { "read", "key", "cipher", "write" };
+
+uint64_t stats_clock(void) {
+    struct timespec ts;
+#ifdef WIN32
+    timespec_get(&ts, TIME_UTC);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+void stats_reset(void) {
+    for (int i = 0; i < STATS_PHASES; ++i) atomic_store(&phase_ns[i], 0);
+    atomic_store(&bytes_read, 0);
+    atomic_store(&bytes_written, 0);
+    atomic_store(&letters, 0);
+    atomic_store(&spaces, 0);
+    atomic_store(&passthrough, 0);
+    started = stats_clock();
+}
+
+void stats_enable(int on) {
+    if (on) stats_reset();
+    stats_active = on != 0;
+}
+
+void stats_get(EnigmaStats* out) {
+    if (!out) return;
+    for (int i = 0; i < STATS_PHASES; ++i) out->ns[i] = atomic_load(&phase_ns[i]);
+    out->wall_ns = started ? stats_clock() - started : 0;
+    out->bytes_read = atomic_load(&bytes_read);
+    out->bytes_written = atomic_load(&bytes_written);
+    out->letters = atomic_load(&letters);
+    out->spaces = atomic_load(&spaces);
+    out->passthrough = atomic_load(&passthrough);
+}
+
+void stats_add_time(StatsPhase phase, uint64_t start) {
+    atomic_fetch_add_explicit(&phase_ns[phase], stats_clock() - start, memory_order_relaxed);
+}
+
+void stats_add_bytes(uint64_t read, uint64_t written) {
+    if (read) atomic_fetch_add_explicit(&bytes_read, read, memory_order_relaxed);
+    if (written) atomic_fetch_add_explicit(&bytes_written, written, memory_order_relaxed);
+}
+
+void stats_count_chars(const char* in, size_t len) {
+    uint64_t alpha = 0, blank = 0;
+    for (size_t i = 0; i < len; ++i) {
+        unsigned char c = (unsigned char)in[i];
+        alpha += (unsigned char)((c | 0x20) - 'a') < 26;
+        blank += c == ' ';
+    }
+    atomic_fetch_add_explicit(&letters, alpha, memory_order_relaxed);
+    atomic_fetch_add_explicit(&spaces, blank, memory_order_relaxed);
+    atomic_fetch_add_explicit(&passthrough, len - alpha - blank, memory_order_relaxed);
+}
+
+void stats_report(FILE* f, StatsFormat format) {
+    if (!f || format == STATS_OFF) return;
+    EnigmaStats s;
+    stats_get(&s);
+
+    if (format == STATS_JSON) {
+        fprintf(f, "{\"wall_ns\": %llu", (unsigned long long)s.wall_ns);
+        for (int i = 0; i < STATS_PHASES; ++i) fprintf(f, ", \"%s_ns\": %llu", PHASE_NAMES[i], (unsigned long long)s.ns[i]);
+        fprintf(f, ", \"bytes_read\": %llu, \"bytes_written\": %llu, \"letters\": %llu, \"spaces\": %llu, \"passthrough\": %llu}\n",
+                (unsigned long long)s.bytes_read, (unsigned long long)s.bytes_written, (unsigned long long)s.letters,
+                (unsigned long long)s.spaces, (unsigned long long)s.passthrough);
+        return;
+    }
+
+    fprintf(f, "Statistics (wall %.3f ms):\n", s.wall_ns / 1e6);
+    for (int i = 0; i < STATS_PHASES; ++i) {
+        fprintf(f, "  %-8s %12.3f ms", PHASE_NAMES[i], s.ns[i] / 1e6);
+        if (i == STATS_READ && s.bytes_read) fprintf(f, "  %llu bytes", (unsigned long long)s.bytes_read);
+        if (i == STATS_WRITE && s.bytes_written) fprintf(f, "  %llu bytes", (unsigned long long)s.bytes_written);
+        if (i == STATS_CIPHER) fprintf(f, "  (thread time)");
+        fputc('\n', f);
+    }
+    fprintf(f, "  %llu letters, %llu spaces as X, %llu passed through\n",
+            (unsigned long long)s.letters, (unsigned long long)s.spaces, (unsigned long long)s.passthrough);
+    uint64_t io = s.ns[STATS_READ] + s.ns[STATS_WRITE];
+    if (io || s.ns[STATS_CIPHER]) fprintf(f, "  mostly %s\n", io > s.ns[STATS_CIPHER] ? "I/O" : "cipher");
+}
@@ -0,0 +1,251 @@
+#include "../include/stream.h"
+#include "../include/encrypt.h"
+#include "../include/key-compiler.h"
+#include "../include/parallel.h"
+#include "../include/spsc-queue.h"
+#include "../include/stats.h"
+#include "../include/uring.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* A chunk on its way through the pipeline; len 0 marks the end of the input */
+typedef struct StreamChunk {
+    char* data;
+    size_t len;
+} StreamChunk;
+
+/*
+ * Reader, cipher and writer stages, each on its own thread, passing chunks along
+ * free -> read -> done -> free. The cipher stage runs on the calling thread.
+ */
+typedef struct Pipeline {
+    FILE* in;
+    FILE* out;
+    size_t chunk_size;
+    StreamChunk chunks[STREAM_DEPTH];
+    SpscQueue free_chunks;              // writer -> reader
+    SpscQueue read_chunks;              // reader -> cipher
+    SpscQueue done_chunks;              // cipher -> writer
+    atomic_int stop;                    // the writer failed: the reader ends the input early
+    int read_error;                     // each set by its own stage, read after the join
+    int write_error;
+} Pipeline;
+
+static void* reader_stage(void* arg) {
+    Pipeline* p = arg;
+    for (;;) {
+        StreamChunk* c = spsc_queue_pop(&p->free_chunks);
+        uint64_t t0 = STATS_ON ? stats_clock() : 0;
+        size_t len = atomic_load(&p->stop) ? 0 : fread(c->data, 1, p->chunk_size, p->in);
+        if (STATS_ON) {
+            stats_add_time(STATS_READ, t0);
+            stats_add_bytes(len, 0);
+        }
+        c->len = len;
+        spsc_queue_push(&p->read_chunks, c);
+        if (len == 0) break;
+    }
+    if (ferror(p->in)) { perror("fread"); p->read_error = 1; }
+    return NULL;
+}
+
+static void* writer_stage(void* arg) {
+    Pipeline* p = arg;
+    for (;;) {
+        StreamChunk* c = spsc_queue_pop(&p->done_chunks);
+        if (c->len == 0) break;
+        /* After a failure keep taking chunks, so that the other stages can finish */
+        uint64_t t0 = STATS_ON ? stats_clock() : 0;
+        if (!p->write_error && fwrite(c->data, 1, c->len, p->out) != c->len) {
+            perror("fwrite");
+            p->write_error = 1;
+            atomic_store(&p->stop, 1);
+        }
+        if (STATS_ON) {
+            stats_add_time(STATS_WRITE, t0);
+            stats_add_bytes(0, c->len);
+        }
+        spsc_queue_push(&p->free_chunks, c);
+    }
+    return NULL;
+}
+
+static int run_pipeline(Pipeline* p, ThreadPool* pool, const CompiledKey* ck, RotorState* state) {
+    int queues = 0;
+    if (spsc_queue_init(&p->free_chunks) == 0) ++queues;
+    if (queues == 1 && spsc_queue_init(&p->read_chunks) == 0) ++queues;
+    if (queues == 2 && spsc_queue_init(&p->done_chunks) == 0) ++queues;
+
+    int rc = 3;
+    if (queues == 3) {
+        for (size_t i = 0; i < STREAM_DEPTH; ++i) spsc_queue_push(&p->free_chunks, &p->chunks[i]);
+
+        pthread_t reader, writer;
+        int have_reader = pthread_create(&reader, NULL, reader_stage, p) == 0;
+        int have_writer = have_reader && pthread_create(&writer, NULL, writer_stage, p) == 0;
+        if (have_writer) {
+            for (;;) {
+                /* Once pushed, a chunk may come back refilled: keep its length */
+                StreamChunk* c = spsc_queue_pop(&p->read_chunks);
+                size_t len = c->len;
+                /* Enciphered in place; the rotor state carries over to the next chunk */
+                if (pool) encrypt_parallel(pool, ck, state, c->data, c->data, len);
+                else encrypt_buffer(ck, state, c->data, c->data, len);
+                spsc_queue_push(&p->done_chunks, c);
+                if (len == 0) break;
+            }
+            pthread_join(writer, NULL);
+            rc = p->write_error ? 4 : 0;
+        } else if (have_reader) {
+            /* No writer: stop the reader and take its chunks until it ends the input */
+            atomic_store(&p->stop, 1);
+            for (;;) {
+                StreamChunk* c = spsc_queue_pop(&p->read_chunks);
+                if (c->len == 0) break;
+                spsc_queue_push(&p->free_chunks, c);
+            }
+        }
+        if (have_reader) pthread_join(reader, NULL);
+        if (rc == 0 && p->read_error) rc = 5;
+    }
+
+    if (queues > 2) spsc_queue_destroy(&p->done_chunks);
+    if (queues > 1) spsc_queue_destroy(&p->read_chunks);
+    if (queues > 0) spsc_queue_destroy(&p->free_chunks);
+    return rc;
+}
+
+#define URING_READ 0
+#define URING_WRITE 1
+
+/* Outstanding requests of the io_uring engine: at most one read and one write */
+typedef struct UringStream {
+    Uring* ring;
+    int in;
+    int out;
+    int busy[2];                        // a request of this kind is in flight
+    int done[2];                        // its completion has arrived
+    int result[2];
+} UringStream;
+
+/* Wait for the request of kind `tag` to complete and return its result. Time spent
+   waiting counts as reading or writing: the cipher is stalled on it. */
+static int await_uring(UringStream* u, int tag) {
+    uint64_t t0 = STATS_ON ? stats_clock() : 0;
+    while (!u->done[tag]) {
+        uint64_t t;
+        int res;
+        if (uring_wait(u->ring, &t, &res) != 0) return -EIO;
+        u->done[t] = 1;
+        u->result[t] = res;
+    }
+    u->done[tag] = 0;
+    u->busy[tag] = 0;
+    if (STATS_ON) {
+        stats_add_time(tag == URING_WRITE ? STATS_WRITE : STATS_READ, t0);
+        if (u->result[tag] > 0) stats_add_bytes(tag == URING_READ ? (uint64_t)u->result[tag] : 0, tag == URING_WRITE ? (uint64_t)u->result[tag] : 0);
+    }
+    return u->result[tag];
+}
+
+static int submit_uring(UringStream* u, int tag, char* buf, size_t len) {
+    int fd = tag == URING_WRITE ? u->out : u->in;
+    if (uring_submit(u->ring, tag == URING_WRITE, fd, buf, (unsigned)len, URING_CURRENT_POSITION, (uint64_t)tag) != 0) return 1;
+    u->busy[tag] = 1;
+    return 0;
+}
+
+/* Wait for the write in flight to finish, resubmitting the rest after short writes */
+static int finish_write(UringStream* u, char* buf, size_t len) {
+    size_t written = 0;
+    for (;;) {
+        int res = await_uring(u, URING_WRITE);
+        if (res <= 0) {
+            errno = res < 0 ? -res : EIO;
+            perror("write");
+            return 1;
+        }
+        written += (size_t)res;
+        if (written == len) return 0;
+        if (submit_uring(u, URING_WRITE, buf + written, len - written) != 0) return 1;
+    }
+}
+
+/*
+ * The same three stages on one thread: while a chunk is enciphered, the next one is
+ * being read and the previous one written by the kernel. Returns -1 if io_uring is
+ * not available (or cannot read this input), before anything was read.
+ */
+static int run_uring(Pipeline* p, ThreadPool* pool, const CompiledKey* ck, RotorState* state) {
+    UringStream u;
+    memset(&u, 0, sizeof(u));
+    u.ring = uring_open(4);
+    if (!u.ring) return -1;
+    u.in = fileno(p->in);
+    u.out = fileno(p->out);
+
+    int rc = 0;
+    char* pending = NULL;               // chunk being written
+    size_t pending_len = 0;
+    if (submit_uring(&u, URING_READ, p->chunks[0].data, p->chunk_size) != 0) rc = -1;
+    for (size_t i = 0; rc == 0; ++i) {
+        int got = await_uring(&u, URING_READ);
+        if (i == 0 && (got == -EINVAL || got == -EOPNOTSUPP)) { rc = -1; break; }
+        if (got < 0) { errno = -got; perror("read"); rc = 5; break; }
+        if (got == 0) break;
+
+        /* The next buffer's write finished before the previous chunk's was submitted */
+        char* cur = p->chunks[i % STREAM_DEPTH].data;
+        if (submit_uring(&u, URING_READ, p->chunks[(i + 1) % STREAM_DEPTH].data, p->chunk_size) != 0) { rc = 5; break; }
+
+        if (pool) encrypt_parallel(pool, ck, state, cur, cur, (size_t)got);
+        else encrypt_buffer(ck, state, cur, cur, (size_t)got);
+
+        if (pending && finish_write(&u, pending, pending_len) != 0) { rc = 4; break; }
+        pending = cur;
+        pending_len = (size_t)got;
+        if (submit_uring(&u, URING_WRITE, cur, pending_len) != 0) { rc = 4; break; }
+    }
+    if (rc == 0 && u.busy[URING_WRITE] && finish_write(&u, pending, pending_len) != 0) rc = 4;
+
+    /* Buffers must not be freed under requests still in flight */
+    if (u.busy[URING_READ]) await_uring(&u, URING_READ);
+    if (u.busy[URING_WRITE]) await_uring(&u, URING_WRITE);
+    uring_close(u.ring);
+    return rc;
+}
+
+int encrypt_stream(Config* config, FILE* in, FILE* out) {
+    if (!config || !config->key || !in || !out) return 1;
+
+    const Key* k = config->key;
+    if (!k->compiled) return 2;
+
+    /* Several threads only pay off with a parallel chunk each */
+    ThreadPool* pool = config->threads > 1 ? thread_pool_create(config->threads) : NULL;
+    Pipeline pipeline;
+    memset(&pipeline, 0, sizeof(pipeline));
+    Pipeline* p = &pipeline;
+    p->in = in;
+    p->out = out;
+    p->chunk_size = pool ? thread_pool_size(pool) * PARALLEL_CHUNK_SIZE : STREAM_CHUNK_SIZE;
+    int rc = 0;
+    for (size_t i = 0; i < STREAM_DEPTH; ++i) {
+        p->chunks[i].data = malloc(p->chunk_size);
+        if (!p->chunks[i].data) rc = 3;
+    }
+
+    if (rc == 0) {
+        /* io_uring writes past stdio, so nothing may be left in its buffer */
+        rc = fflush(out) == 0 ? run_uring(p, pool, k->compiled, &config->state) : 4;
+        if (rc == -1) rc = run_pipeline(p, pool, k->compiled, &config->state);
+    }
+    if (rc == 0 && fflush(out) != 0) { perror("fflush"); rc = 4; }
+
+    for (size_t i = 0; i < STREAM_DEPTH; ++i) free(p->chunks[i].data);
+    thread_pool_destroy(pool);
+    return rc;
+}
@@ -0,0 +1,177 @@
+#include "../include/thread-pool.h"
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/* Indices [next, end) still to be run by one thread; others may steal from the end */
+typedef struct WorkRange {
+    pthread_mutex_t lock;
+    size_t next;
+    size_t end;
+} WorkRange;
+
+struct ThreadPool {
+    size_t threads;                     // threads running tasks, including the caller
+    pthread_t* workers;                 // threads - 1 background workers
+    WorkRange* ranges;                  // one per thread, ranges[0] belongs to the caller
+    pthread_mutex_t lock;
+    pthread_cond_t start;               // signalled when a new run begins (or on shutdown)
+    pthread_cond_t done;                // signalled when the last worker finishes a run
+    unsigned long generation;           // incremented for every run
+    size_t active;                      // workers still busy with the current run
+    int stop;
+    ThreadPoolTask task;
+    void* arg;
+};
+
+typedef struct WorkerStart {
+    ThreadPool* pool;
+    size_t self;
+} WorkerStart;
+
+/* Take the next index of range `self`, or steal the upper half of another range */
+static int next_task(ThreadPool* pool, size_t self, size_t* index) {
+    WorkRange* own = &pool->ranges[self];
+    pthread_mutex_lock(&own->lock);
+    if (own->next < own->end) {
+        *index = own->next++;
+        pthread_mutex_unlock(&own->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&own->lock);
+
+    for (size_t k = 1; k < pool->threads; ++k) {
+        WorkRange* victim = &pool->ranges[(self + k) % pool->threads];
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->end - victim->next;
+        if (left == 0) { pthread_mutex_unlock(&victim->lock); continue; }
+        size_t lo = victim->end - (left + 1) / 2;
+        size_t hi = victim->end;
+        victim->end = lo;
+        pthread_mutex_unlock(&victim->lock);
+
+        /* Run the first stolen index now, publish the rest for further stealing */
+        pthread_mutex_lock(&own->lock);
+        own->next = lo + 1;
+        own->end = hi;
+        pthread_mutex_unlock(&own->lock);
+        *index = lo;
+        return 1;
+    }
+    return 0;
+}
+
+static void run_tasks(ThreadPool* pool, size_t self) {
+    size_t index;
+    while (next_task(pool, self, &index)) pool->task(pool->arg, index);
+}
+
+static void* worker_main(void* p) {
+    WorkerStart* ws = p;
+    ThreadPool* pool = ws->pool;
+    size_t self = ws->self;
+    free(ws);
+
+    unsigned long seen = 0;
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->stop && pool->generation == seen) pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) { pthread_mutex_unlock(&pool->lock); return NULL; }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_tasks(pool, self);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->active == 0) pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+ThreadPool* thread_pool_create(size_t threads) {
+    if (threads == 0) threads = 1;
+    ThreadPool* pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pool->workers = calloc(threads, sizeof(*pool->workers));
+    pool->ranges = calloc(threads, sizeof(*pool->ranges));
+    if (!pool->workers || !pool->ranges) {
+        free(pool->workers); free(pool->ranges); free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    for (size_t i = 0; i < threads; ++i) pthread_mutex_init(&pool->ranges[i].lock, NULL);
+
+    /* Start workers one by one; the pool simply gets smaller if a thread cannot be created */
+    pool->threads = 1;
+    for (size_t i = 1; i < threads; ++i) {
+        WorkerStart* ws = malloc(sizeof(*ws));
+        if (!ws) break;
+        ws->pool = pool;
+        ws->self = i;
+        if (pthread_create(&pool->workers[i - 1], NULL, worker_main, ws) != 0) { free(ws); break; }
+        pool->threads++;
+    }
+    return pool;
+}
+
+size_t thread_pool_size(const ThreadPool* pool) {
+    return pool ? pool->threads : 1;
+}
+
+void thread_pool_run(ThreadPool* pool, size_t count, ThreadPoolTask task, void* arg) {
+    if (!pool || !task || count == 0) return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->arg = arg;
+    for (size_t i = 0; i < pool->threads; ++i) {
+        pool->ranges[i].next = count * i / pool->threads;
+        pool->ranges[i].end = count * (i + 1) / pool->threads;
+    }
+    pool->active = pool->threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_tasks(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->active > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void thread_pool_destroy(ThreadPool* pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (size_t i = 1; i < pool->threads; ++i) pthread_join(pool->workers[i - 1], NULL);
+
+    for (size_t i = 0; i < pool->threads; ++i) pthread_mutex_destroy(&pool->ranges[i].lock);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    free(pool->ranges);
+    free(pool->workers);
+    free(pool);
+}
+
+size_t thread_pool_cpu_count(void) {
+#ifdef WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    long n = (long)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return n > 0 ? (size_t)n : 1;
+}
@@ -0,0 +1,147 @@
+#include "../include/uring.h"
+
+#if !defined(__linux__) || !defined(ENIGMA_IO_URING)
+
+Uring* uring_open(unsigned entries) {
+    (void)entries;
+    return NULL;
+}
+
+int uring_submit(Uring* ring, int write, int fd, void* buf, unsigned len, int64_t offset, uint64_t tag) {
+    (void)ring; (void)write; (void)fd; (void)buf; (void)len; (void)offset; (void)tag;
+    return 1;
+}
+
+int uring_wait(Uring* ring, uint64_t* tag, int* result) {
+    (void)ring; (void)tag; (void)result;
+    return 1;
+}
+
+void uring_close(Uring* ring) {
+    (void)ring;
+}
+
+#else
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+struct Uring {
+    int fd;
+    unsigned entries;                   // submission queue entries
+    void* sq_ring;
+    size_t sq_ring_size;
+    void* cq_ring;                      // sq_ring with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_size;
+    struct io_uring_sqe* sqes;
+    size_t sqes_size;
+    unsigned* sq_head;                  // ring indices shared with the kernel
+    unsigned* sq_tail;
+    unsigned* sq_mask;
+    unsigned* sq_array;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned* cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+static int enter(int fd, unsigned submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, NULL, 0);
+}
+
+void uring_close(Uring* ring) {
+    if (!ring) return;
+    if (ring->sqes) munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring && ring->cq_ring != ring->sq_ring) munmap(ring->cq_ring, ring->cq_ring_size);
+    if (ring->sq_ring) munmap(ring->sq_ring, ring->sq_ring_size);
+    if (ring->fd >= 0) close(ring->fd);
+    free(ring);
+}
+
+Uring* uring_open(unsigned entries) {
+    Uring* ring = calloc(1, sizeof(*ring));
+    if (!ring) return NULL;
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) { free(ring); return NULL; }
+    ring->entries = p.sq_entries;
+
+    ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_ring_size > ring->sq_ring_size) ring->sq_ring_size = ring->cq_ring_size;
+
+    void* sq = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    ring->fd, IORING_OFF_SQ_RING);
+    if (sq == MAP_FAILED) { close(ring->fd); free(ring); return NULL; }
+    ring->sq_ring = sq;
+    void* cq = sq;
+    if (!single) {
+        cq = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                  ring->fd, IORING_OFF_CQ_RING);
+        if (cq == MAP_FAILED) { uring_close(ring); return NULL; }
+    }
+    ring->cq_ring = cq;
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) { uring_close(ring); return NULL; }
+    ring->sqes = sqes;
+
+    char* s = sq;
+    ring->sq_head = (unsigned*)(s + p.sq_off.head);
+    ring->sq_tail = (unsigned*)(s + p.sq_off.tail);
+    ring->sq_mask = (unsigned*)(s + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(s + p.sq_off.array);
+    char* c = cq;
+    ring->cq_head = (unsigned*)(c + p.cq_off.head);
+    ring->cq_tail = (unsigned*)(c + p.cq_off.tail);
+    ring->cq_mask = (unsigned*)(c + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(c + p.cq_off.cqes);
+    return ring;
+}
+
+int uring_submit(Uring* ring, int write, int fd, void* buf, unsigned len, int64_t offset, uint64_t tag) {
+    if (!ring) return 1;
+    unsigned tail = *ring->sq_tail;     // only we move the tail
+    if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->entries) return 1;
+
+    unsigned index = tail & *ring->sq_mask;
+    struct io_uring_sqe* sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)offset;
+    sqe->user_data = tag;
+    ring->sq_array[index] = index;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    int r;
+    do r = enter(ring->fd, 1, 0, 0); while (r < 0 && errno == EINTR);
+    return r == 1 ? 0 : 1;
+}
+
+int uring_wait(Uring* ring, uint64_t* tag, int* result) {
+    if (!ring) return 1;
+    for (;;) {
+        unsigned head = *ring->cq_head;     // only we move the head
+        if (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+            const struct io_uring_cqe* cqe = &ring->cqes[head & *ring->cq_mask];
+            *tag = cqe->user_data;
+            *result = cqe->res;
+            __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+            return 0;
+        }
+        if (enter(ring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return 1;
+    }
+}
+
+#endif
@@ -0,0 +1,520 @@
+/*
+ * enigma-check: known-answer and consistency tests of the cipher. A message is
+ * enciphered with keys of 1, 2, 3 and 5 rotors, on the period table and on the
+ * stepping path, whole and piece by piece, and compared with vectors computed by an
+ * independent model of the machine. Rotor stepping is checked press by press across
+ * the middle rotor's double step, and seek_rotors() against pressing the keys.
+ * Compiled-key images written to the scratch directory must encipher as the keys
+ * they were written from. Many short messages through the multi-message lanes must
+ * come out as they do one by one, and slices of an indexed container decipher to the
+ * same bytes as the whole ciphertext does. The libenigma API enciphers in place and
+ * piece by piece, seeks, and shares a key between streams, as the cipher does. The
+ * arena keys are allocated from aligns, rewinds and reuses its blocks. Sparse input,
+ * letters between long runs of pass-through bytes, must encipher its letters as if
+ * they stood together and leave everything else alone. Given the
+ * enigma binary, a --serve daemon must answer pipelined requests as the vectors say.
+ *
+ * Usage: enigma-check [scratch-dir [enigma-binary]] (exits with 1 if any check fails)
+ */
+#include "../include/arena.h"
+#include "../include/config.h"
+#include "../include/container.h"
+#include "../include/encrypt.h"
+#include "../include/encrypt-simd.h"
+#include "../include/enigma.h"
+#include "../include/key-compiler.h"
+#include "../include/key-image.h"
+#include "../include/multi.h"
+#include "../include/key-parser.h"
+#include "../include/server.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+/* Letters, spaces (enciphered as X), digits and punctuation (passed through) */
+static const char PLAINTEXT[] = "Attack at dawn, hold the bridge! Report 0600 via RADIO relay.";
+#define PLAINTEXT_LEN (sizeof(PLAINTEXT) - 1)
+
+typedef struct Vector {
+    const char* name;
+    const char* reflector;
+    const char* rotors;                 // fast rotor first
+    const char* rings;                  // also the start positions
+    const char* plugboard;
+    const char* ciphertext;             // of PLAINTEXT
+} Vector;
+
+static const Vector VECTORS[] = {
+    { "r1", "1", "5", "Q", "AZ",
+      "WffbhsKqwWsrcs,TbzqaFxzgQhvkwxp!MErdamiH0600GknuYWDJDEFnmywz." },
+    { "r2", "2", "2,8", "D,E", NULL,
+      "DhyaqfQrcAklwx,OfoivMthkEchbkcc!YQbgarcZ0600RmsbOTERVKLskfiz." },
+    /* The fast rotor starts at its notch and the middle rotor one short of its own:
+       the middle rotor double-steps on the second letter */
+    { "r3", "1", "3,2,5", "V,D,K", "AB,CD,EF",
+      "XoudugRynJtjfx,EgjakSnlrTtvdwrw!MGuanayY0600RchsKBFSFHQyjczj." },
+    { "r5", "1", "2,3,5,8,2", "A,B,C,D,E", "QW",
+      "ZuxnktHmsFxmcw,NehxpBkgcZlnutmz!UWsctgcJ0600EmwvUTLKDYBgnfet." },
+};
+#define VECTOR_COUNT (sizeof(VECTORS) / sizeof(VECTORS[0]))
+
+/* Letters seek_rotors() is checked at; past 26^3 every 3 rotor cycle has repeated */
+static const uint64_t SEEK_OFFSETS[] = { 0, 1, 2, 25, 26, 27, 649, 650, 651, 676, 16899, 16900, 16901, 17576, 100000, 456976 };
+#define SEEK_OFFSET_COUNT (sizeof(SEEK_OFFSETS) / sizeof(SEEK_OFFSETS[0]))
+
+static size_t checks, failures;
+
+static void expect(int ok, const char* name, const char* what) {
+    ++checks;
+    if (ok) return;
+    ++failures;
+    fprintf(stderr, "FAIL %s: %s\n", name, what);
+}
+
+static Key* open_vector_key(const Vector* v, int quick) {
+    return quick ? parse_key_components_quick(v->reflector, v->rotors, v->rings, v->plugboard)
+                 : parse_key_components(v->reflector, v->rotors, v->rings, v->plugboard);
+}
+
+/* Every vector with and without a period table, at once and in pieces of 7 bytes */
+static void check_vectors(void) {
+    char out[PLAINTEXT_LEN];
+    for (size_t i = 0; i < VECTOR_COUNT; ++i) {
+        const Vector* v = &VECTORS[i];
+        for (int quick = 0; quick <= 1; ++quick) {
+            Key* k = open_vector_key(v, quick);
+            expect(k != NULL, v->name, "key does not parse");
+            if (!k) continue;
+
+            RotorState state = k->start;
+            encrypt_buffer(k->compiled, &state, PLAINTEXT, out, PLAINTEXT_LEN);
+            expect(memcmp(out, v->ciphertext, PLAINTEXT_LEN) == 0, v->name, quick ? "stepping path" : "period table");
+
+            state = k->start;
+            for (size_t at = 0; at < PLAINTEXT_LEN; at += 7) {
+                size_t len = PLAINTEXT_LEN - at < 7 ? PLAINTEXT_LEN - at : 7;
+                encrypt_buffer(k->compiled, &state, PLAINTEXT + at, out + at, len);
+            }
+            expect(memcmp(out, v->ciphertext, PLAINTEXT_LEN) == 0, v->name, "enciphered in pieces");
+            free_key(k);
+        }
+    }
+}
+
+/* Rotors III, II and V from positions V, D, K: the fast rotor at its notch moves the
+   middle rotor onto its own, which then moves itself and the slow rotor */
+static void check_double_step(void) {
+    static const unsigned char expected[][3] = { { 21, 3, 10 }, { 22, 4, 10 }, { 23, 5, 11 }, { 24, 5, 11 } };
+    Key* k = parse_key_components("1", "3,2,5", "V,D,K", NULL);
+    expect(k != NULL, "double step", "key does not parse");
+    if (!k) return;
+    unsigned char p[MAX_ROTORS];
+    memcpy(p, k->start.positions, sizeof(p));
+    for (size_t press = 0; press < sizeof(expected) / sizeof(expected[0]); ++press) {
+        if (press) step_rotors(k->compiled, p);
+        expect(memcmp(p, expected[press], 3) == 0, "double step", "rotor positions");
+    }
+    free_key(k);
+}
+
+/* seek_rotors() lands where pressing the keys one by one does */
+static void check_seek(void) {
+    for (size_t i = 0; i < VECTOR_COUNT; ++i) {
+        const Vector* v = &VECTORS[i];
+        Key* k = open_vector_key(v, 1);
+        if (!k) continue;
+        unsigned char stepped[MAX_ROTORS];
+        memcpy(stepped, k->start.positions, sizeof(stepped));
+        uint64_t pressed = 0;
+        for (size_t s = 0; s < SEEK_OFFSET_COUNT; ++s) {
+            for (; pressed < SEEK_OFFSETS[s]; ++pressed) step_rotors(k->compiled, stepped);
+            unsigned char sought[MAX_ROTORS];
+            memcpy(sought, k->start.positions, sizeof(sought));
+            seek_rotors(k->compiled, sought, SEEK_OFFSETS[s]);
+            expect(memcmp(sought, stepped, k->rotor_count) == 0, v->name, "seek_rotors differs from stepping");
+        }
+        free_key(k);
+    }
+}
+
+/* Every vector written as an image and loaded back through load_key_file() */
+static void check_images(const char* dir) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/enigma-check.keyc", dir);
+    char out[PLAINTEXT_LEN];
+    for (size_t i = 0; i < VECTOR_COUNT; ++i) {
+        const Vector* v = &VECTORS[i];
+        Key* k = open_vector_key(v, 0);
+        if (!k) continue;
+        expect(write_key_image(k, path) == 0, v->name, "cannot write the key image");
+        free_key(k);
+
+        k = load_key_file(path);
+        expect(k != NULL && k->image != NULL, v->name, "cannot load the key image");
+        if (!k) continue;
+        RotorState state = k->start;
+        encrypt_buffer(k->compiled, &state, PLAINTEXT, out, PLAINTEXT_LEN);
+        expect(memcmp(out, v->ciphertext, PLAINTEXT_LEN) == 0, v->name, "key image");
+        free_key(k);
+    }
+    remove(path);
+}
+
+/* Messages of every length up to MULTI_MESSAGES, with every vector key, starting at
+   different offsets: encrypt_multi() against encrypt_buffer() one at a time */
+#define MULTI_MESSAGES 64
+
+static void check_multi(void) {
+    Key* keys[VECTOR_COUNT * 2];
+    size_t key_count = 0;
+    for (size_t i = 0; i < VECTOR_COUNT; ++i) {
+        for (int quick = 0; quick <= 1; ++quick) {
+            Key* k = open_vector_key(&VECTORS[i], quick);
+            if (k) keys[key_count++] = k;
+        }
+    }
+    if (!key_count) return;
+
+    static char in[MULTI_MESSAGES][MULTI_MESSAGES], out[MULTI_MESSAGES][MULTI_MESSAGES], expected[MULTI_MESSAGES][MULTI_MESSAGES];
+    RotorState states[MULTI_MESSAGES], expected_states[MULTI_MESSAGES];
+    MultiJob jobs[MULTI_MESSAGES];
+    for (size_t m = 0; m < MULTI_MESSAGES; ++m) {
+        const Key* k = keys[m % key_count];
+        for (size_t c = 0; c < m; ++c) in[m][c] = PLAINTEXT[(m + c) % PLAINTEXT_LEN];
+        states[m] = k->start;
+        seek_rotors(k->compiled, states[m].positions, m * 97);
+        expected_states[m] = states[m];
+        encrypt_buffer(k->compiled, &expected_states[m], in[m], expected[m], m);
+        jobs[m] = (MultiJob){ k->compiled, &states[m], in[m], out[m], m };
+    }
+    encrypt_multi(jobs, MULTI_MESSAGES);
+    for (size_t m = 0; m < MULTI_MESSAGES; ++m) {
+        expect(memcmp(out[m], expected[m], m) == 0, "multi", "message differs from encrypt_buffer");
+        expect(memcmp(states[m].positions, expected_states[m].positions, MAX_ROTORS) == 0, "multi", "final rotor state");
+    }
+    for (size_t i = 0; i < key_count; ++i) free_key(keys[i]);
+}
+
+/* A message of CONTAINER_MESSAGE bytes in blocks of CONTAINER_CHECK_BLOCK, written to a
+   container and read back in slices, on one thread and on two */
+#define CONTAINER_MESSAGE 1000
+#define CONTAINER_CHECK_BLOCK 64
+
+static const uint64_t RANGES[][2] = { { 0, UINT64_MAX }, { 0, 1 }, { 5, 40 }, { 63, 65 }, { 64, 128 }, { 500, 999 }, { 999, 1000 }, { 1000, 1000 } };
+#define RANGE_COUNT (sizeof(RANGES) / sizeof(RANGES[0]))
+
+static void check_container(const char* dir) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/enigma-check.idx", dir);
+    static char message[CONTAINER_MESSAGE], cipher[CONTAINER_MESSAGE], expected[CONTAINER_MESSAGE], got[CONTAINER_MESSAGE + 1];
+    for (size_t i = 0; i < CONTAINER_MESSAGE; ++i) message[i] = PLAINTEXT[i % PLAINTEXT_LEN];
+
+    for (size_t i = 0; i < VECTOR_COUNT; ++i) {
+        const Vector* v = &VECTORS[i];
+        Key* k = open_vector_key(v, 0);
+        if (!k) continue;
+        /* What the whole container deciphers to: spaces come back as X */
+        RotorState state = k->start;
+        encrypt_buffer(k->compiled, &state, message, cipher, CONTAINER_MESSAGE);
+        state = k->start;
+        encrypt_buffer(k->compiled, &state, cipher, expected, CONTAINER_MESSAGE);
+
+        for (size_t threads = 1; threads <= 2; ++threads) {
+            Config config;
+            memset(&config, 0, sizeof(config));
+            config.key = k;
+            config.state = k->start;
+            config.threads = threads;
+
+            FILE* in = tmpfile();
+            FILE* out = fopen(path, "wb");
+            int rc = !in || !out || fwrite(message, 1, CONTAINER_MESSAGE, in) != CONTAINER_MESSAGE || fseek(in, 0, SEEK_SET) != 0;
+            if (!rc) rc = write_container(&config, in, out, CONTAINER_CHECK_BLOCK);
+            if (in) fclose(in);
+            if (out && fclose(out) != 0) rc = 1;
+            expect(rc == 0, v->name, "cannot write the container");
+            if (rc) continue;
+
+            for (size_t r = 0; r < RANGE_COUNT; ++r) {
+                uint64_t begin = RANGES[r][0], end = RANGES[r][1] < CONTAINER_MESSAGE ? RANGES[r][1] : CONTAINER_MESSAGE;
+                FILE* slice = tmpfile();
+                size_t len = 0;
+                rc = !slice || read_container(&config, path, RANGES[r][0], RANGES[r][1], slice) != 0 || fseek(slice, 0, SEEK_SET) != 0;
+                if (!rc) len = fread(got, 1, sizeof(got), slice);
+                if (slice) fclose(slice);
+                expect(rc == 0 && len == end - begin && memcmp(got, expected + begin, len) == 0, v->name, "container slice");
+            }
+        }
+        free_key(k);
+    }
+    remove(path);
+}
+
+/* Every vector through libenigma: contexts in place and in pieces, seeking into the
+   middle, streams of one key, and all vectors in one enigma_process_many call */
+static void check_library(void) {
+    char buf[PLAINTEXT_LEN], many[VECTOR_COUNT][PLAINTEXT_LEN];
+    EnigmaKey* keys[VECTOR_COUNT];
+    EnigmaStream streams[VECTOR_COUNT];
+    EnigmaJob jobs[VECTOR_COUNT];
+    size_t opened = 0;
+
+    for (size_t i = 0; i < VECTOR_COUNT; ++i) {
+        const Vector* v = &VECTORS[i];
+        EnigmaContext* ctx = enigma_open_key(v->reflector, v->rotors, v->rings, v->plugboard);
+        expect(ctx != NULL, v->name, "enigma_open_key");
+        if (!ctx) continue;
+        memcpy(buf, PLAINTEXT, PLAINTEXT_LEN);
+        for (size_t at = 0; at < PLAINTEXT_LEN; at += 5) {
+            size_t len = PLAINTEXT_LEN - at < 5 ? PLAINTEXT_LEN - at : 5;
+            expect(enigma_process(ctx, buf + at, len, buf + at) == 0, v->name, "enigma_process");
+        }
+        expect(memcmp(buf, v->ciphertext, PLAINTEXT_LEN) == 0, v->name, "enigma_process in place");
+
+        /* The letters before byte 15 are "AttackXatXdawn" */
+        enigma_seek(ctx, 14);
+        memcpy(buf, PLAINTEXT, PLAINTEXT_LEN);
+        enigma_process(ctx, buf + 15, PLAINTEXT_LEN - 15, buf + 15);
+        expect(memcmp(buf + 15, v->ciphertext + 15, PLAINTEXT_LEN - 15) == 0, v->name, "enigma_seek");
+        enigma_reset(ctx);
+        enigma_process(ctx, PLAINTEXT, PLAINTEXT_LEN, buf);
+        expect(memcmp(buf, v->ciphertext, PLAINTEXT_LEN) == 0, v->name, "enigma_reset");
+        enigma_close(ctx);
+
+        EnigmaKey* key = enigma_key_open_quick(v->reflector, v->rotors, v->rings, v->plugboard);
+        expect(key != NULL, v->name, "enigma_key_open_quick");
+        if (!key) continue;
+        EnigmaStream first, second;
+        enigma_stream_init(key, &first);
+        enigma_stream_process(key, &first, PLAINTEXT, 20, buf);
+        second = first;
+        enigma_stream_process(key, &first, PLAINTEXT + 20, PLAINTEXT_LEN - 20, buf + 20);
+        expect(memcmp(buf, v->ciphertext, PLAINTEXT_LEN) == 0, v->name, "enigma_stream_process");
+        enigma_stream_process(key, &second, PLAINTEXT + 20, PLAINTEXT_LEN - 20, buf + 20);
+        expect(memcmp(buf + 20, v->ciphertext + 20, PLAINTEXT_LEN - 20) == 0, v->name, "copied stream");
+
+        keys[opened] = key;
+        enigma_stream_init(key, &streams[opened]);
+        memcpy(many[opened], PLAINTEXT, PLAINTEXT_LEN);
+        jobs[opened] = (EnigmaJob){ key, &streams[opened], many[opened], many[opened], PLAINTEXT_LEN };
+        ++opened;
+    }
+
+    expect(enigma_process_many(jobs, opened) == 0, "library", "enigma_process_many");
+    for (size_t i = 0; i < opened; ++i) {
+        const Vector* v = &VECTORS[i];
+        expect(memcmp(many[i], v->ciphertext, PLAINTEXT_LEN) == 0, v->name, "enigma_process_many in place");
+        enigma_key_close(keys[i]);
+    }
+}
+
+/* Runs of pass-through bytes of every length up to SPARSE_MAX_RUN (so the vector scans
+   end at every offset of their blocks), each followed by a few letters */
+#define SPARSE_MAX_RUN 200
+#define SPARSE_LEN (SPARSE_MAX_RUN * (SPARSE_MAX_RUN + 1) / 2 + 4 * SPARSE_MAX_RUN)
+
+static void check_sparse(void) {
+    static char in[SPARSE_LEN], out[SPARSE_LEN], letters[SPARSE_LEN], dense[SPARSE_LEN], expected[SPARSE_LEN];
+    size_t len = 0, count = 0;
+    for (size_t run = 1; run <= SPARSE_MAX_RUN; ++run) {
+        for (size_t i = 0, seed = len * 131; i < run; ++i) {
+            unsigned char c;
+            int upper;
+            do c = (unsigned char)(seed += 7); while (cipher_index(c, &upper) >= 0);
+            in[len++] = (char)c;
+        }
+        for (size_t i = 0; i < run % 4 + 1; ++i) in[len++] = PLAINTEXT[(run + i) % PLAINTEXT_LEN];
+    }
+    for (size_t i = 0; i < len; ++i) {
+        int upper;
+        if (cipher_index((unsigned char)in[i], &upper) >= 0) letters[count++] = in[i];
+    }
+
+    for (size_t i = 0; i < VECTOR_COUNT; ++i) {
+        const Vector* v = &VECTORS[i];
+        for (int quick = 0; quick <= 1; ++quick) {
+            Key* k = open_vector_key(v, quick);
+            if (!k) continue;
+            RotorState state = k->start;
+            encrypt_buffer(k->compiled, &state, letters, dense, count);
+            memcpy(expected, in, len);
+            for (size_t j = 0, l = 0; j < len; ++j) {
+                int upper;
+                if (cipher_index((unsigned char)in[j], &upper) >= 0) expected[j] = dense[l++];
+            }
+
+            state = k->start;
+            encrypt_buffer(k->compiled, &state, in, out, len);
+            expect(memcmp(out, expected, len) == 0, v->name, quick ? "sparse input, stepping path" : "sparse input, period table");
+            memcpy(out, in, len);
+            state = k->start;
+            encrypt_buffer(k->compiled, &state, out, out, len);
+            expect(memcmp(out, expected, len) == 0, v->name, "sparse input in place");
+            free_key(k);
+        }
+    }
+}
+
+/* Allocations are aligned and adjacent within a block, requests larger than a block
+   get their own, and rewinding or resetting hands the same memory out again */
+static void check_arena(void) {
+    Arena arena;
+    arena_init(&arena, 256);
+    unsigned char* a = arena_alloc(&arena, 10);
+    unsigned char* b = arena_alloc(&arena, 20);
+    expect(a && b && (uintptr_t)a % ARENA_ALIGN == 0 && (uintptr_t)b % ARENA_ALIGN == 0, "arena", "alignment");
+    expect(b == a + ARENA_ALIGN, "arena", "adjacent allocations");
+
+    ArenaMark mark = arena_mark(&arena);
+    unsigned char* c = arena_alloc(&arena, 100);
+    unsigned char* big = arena_alloc(&arena, 4096);
+    expect(c && big, "arena", "allocation");
+    if (big) memset(big, 0xAB, 4096);
+    arena_rewind(&arena, mark);
+    expect(arena_alloc(&arena, 100) == c, "arena", "rewind");
+
+    arena_reset(&arena);
+    expect(arena_alloc(&arena, 10) == a, "arena", "reset reuses the first block");
+    unsigned char* zeroed = arena_calloc(&arena, 512, 8);
+    int zero = zeroed != NULL;
+    for (size_t i = 0; zeroed && i < 512 * 8; ++i) zero &= zeroed[i] == 0;
+    expect(zero, "arena", "calloc of a reused block");
+    expect(arena_calloc(&arena, SIZE_MAX / 2, 4) == NULL, "arena", "calloc overflow");
+    arena_free(&arena);
+}
+
+#ifndef WIN32
+/* Send one request (all of it) on fd; 0 on success */
+static int send_request(int fd, const char* key_path, const char* data, size_t len, uint64_t offset) {
+    ServeRequest req = { SERVE_REQUEST_MAGIC, (uint32_t)strlen(key_path), len, offset };
+    const char* parts[] = { (const char*)&req, key_path, data };
+    size_t sizes[] = { sizeof(req), req.key_len, len };
+    for (size_t i = 0; i < 3; ++i) {
+        for (size_t done = 0; done < sizes[i];) {
+            ssize_t n = write(fd, parts[i] + done, sizes[i] - done);
+            if (n <= 0) return 1;
+            done += (size_t)n;
+        }
+    }
+    return 0;
+}
+
+/* Read exactly len bytes from fd; 0 on success */
+static int read_exactly(int fd, void* buf, size_t len) {
+    for (size_t done = 0; done < len;) {
+        ssize_t n = read(fd, (char*)buf + done, len - done);
+        if (n <= 0) return 1;
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+/* Read a response of at most PLAINTEXT_LEN bytes into out; its status, or -1 */
+static int read_response(int fd, char* out, size_t* len) {
+    ServeResponse res;
+    if (read_exactly(fd, &res, sizeof(res)) != 0 || res.magic != SERVE_RESPONSE_MAGIC || res.data_len > PLAINTEXT_LEN) return -1;
+    *len = (size_t)res.data_len;
+    if (read_exactly(fd, out, *len) != 0) return -1;
+    return (int)res.status;
+}
+
+/* A daemon started from the enigma binary: every vector as a whole message and as its
+   second part from a letter offset, pipelined on one connection, then a missing key.
+   SIGTERM must shut it down cleanly. */
+static void check_serve(const char* dir, const char* binary) {
+    char socket_path[108], key_path[4096];
+    snprintf(socket_path, sizeof(socket_path), "%s/enigma-check.sock", dir);
+    unlink(socket_path);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!freopen("/dev/null", "w", stdout) || !freopen("/dev/null", "w", stderr)) _exit(127);
+        execl(binary, binary, "--serve", socket_path, "-j", "2", (char*)NULL);
+        _exit(127);
+    }
+    expect(pid > 0, "serve", "cannot start the daemon");
+    if (pid <= 0) return;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    int fd = -1;
+    for (int tries = 0; fd < 0 && tries < 200; ++tries) {
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            close(fd);
+            fd = -1;
+            usleep(10000);
+        }
+    }
+    expect(fd >= 0, "serve", "cannot connect to the daemon");
+
+    /* The letters before byte 15 are "AttackXatXdawn" */
+    int sent = fd >= 0;
+    for (size_t i = 0; sent && i < VECTOR_COUNT; ++i) {
+        const Vector* v = &VECTORS[i];
+        snprintf(key_path, sizeof(key_path), "%s/enigma-check-%s.key", dir, v->name);
+        FILE* f = fopen(key_path, "w");
+        if (!f) { sent = 0; break; }
+        fprintf(f, "reflector=%s\nrotors=%s\nrings=%s\n", v->reflector, v->rotors, v->rings);
+        if (v->plugboard) fprintf(f, "plugboard=%s\n", v->plugboard);
+        fclose(f);
+        sent = send_request(fd, key_path, PLAINTEXT, PLAINTEXT_LEN, 0) == 0 &&
+               send_request(fd, key_path, PLAINTEXT + 15, PLAINTEXT_LEN - 15, 14) == 0;
+    }
+    snprintf(key_path, sizeof(key_path), "%s/enigma-check-missing.key", dir);
+    if (sent) sent = send_request(fd, key_path, PLAINTEXT, PLAINTEXT_LEN, 0) == 0;
+    expect(sent, "serve", "cannot send the requests");
+
+    char out[PLAINTEXT_LEN];
+    size_t len = 0;
+    for (size_t i = 0; sent && i < VECTOR_COUNT; ++i) {
+        const Vector* v = &VECTORS[i];
+        int status = read_response(fd, out, &len);
+        expect(status == SERVE_OK && len == PLAINTEXT_LEN && memcmp(out, v->ciphertext, len) == 0, v->name, "served message");
+        status = read_response(fd, out, &len);
+        expect(status == SERVE_OK && len == PLAINTEXT_LEN - 15 && memcmp(out, v->ciphertext + 15, len) == 0, v->name,
+               "served message from an offset");
+    }
+    if (sent) expect(read_response(fd, out, &len) == SERVE_BAD_KEY && len == 0, "serve", "missing key");
+    if (fd >= 0) close(fd);
+
+    int status = 0;
+    kill(pid, SIGTERM);
+    waitpid(pid, &status, 0);
+    expect(WIFEXITED(status) && WEXITSTATUS(status) == 0, "serve", "clean shutdown");
+    for (size_t i = 0; i < VECTOR_COUNT; ++i) {
+        snprintf(key_path, sizeof(key_path), "%s/enigma-check-%s.key", dir, VECTORS[i].name);
+        remove(key_path);
+    }
+}
+#endif
+
+int main(int argc, char* argv[]) {
+    const char* dir = argc > 1 ? argv[1] : ".";
+    check_vectors();
+    check_double_step();
+    check_seek();
+    check_images(dir);
+    check_multi();
+    check_container(dir);
+    check_library();
+    check_arena();
+    check_sparse();
+#ifndef WIN32
+    if (argc > 2) check_serve(dir, argv[2]);
+#endif
+    printf("%zu checks, %zu failed\n", checks, failures);
+    return failures ? 1 : 0;
+}
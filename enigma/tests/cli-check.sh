@@ -0,0 +1,185 @@
+#!/bin/sh
+#
+# cli-check: round trips through the enigma command line. A few megabytes of text
+# are enciphered with --buffered, the reference every other way of running the
+# program is compared with, and deciphered back to the text (spaces come back as X).
+#
+# Usage: cli-check.sh enigma-binary [scratch-dir] (exits with 1 if any check fails)
+#
+set -u
+
+BIN=$1
+DIR=${2:-.}/cli-check
+checks=0
+failures=0
+
+# No engine profile of this machine: every run picks its path from the defaults
+ENIGMA_PROFILE=
+export ENIGMA_PROFILE
+
+# expect STATUS NAME: count a check, passed when STATUS is 0
+expect() {
+    checks=$((checks + 1))
+    if [ "$1" -ne 0 ]; then
+        failures=$((failures + 1))
+        echo "FAIL $2"
+    fi
+}
+
+# same FILE EXPECTED NAME: FILE must hold the bytes of EXPECTED
+same() {
+    cmp -s "$1" "$2"
+    expect $? "$3"
+}
+
+# run NAME ARGS...: run the program quietly, passed when it succeeds
+run() {
+    name=$1
+    shift
+    "$BIN" "$@" > /dev/null 2>&1
+    expect $? "$name"
+}
+
+rm -rf "$DIR"
+mkdir -p "$DIR" || exit 1
+
+# Rotors II, V and VIII are permutations, so deciphering gives the text back
+cat > "$DIR/m3.key" <<EOF
+reflector=1
+rotors=2,5,8
+rings=D,E,F
+plugboard=AB,CD,QZ
+EOF
+
+# Longer than a parallel chunk (1 MiB) and a stream chunk (256 KiB) several times over
+awk 'BEGIN { for (i = 0; i < 40000; ++i) printf "Line %d: the quick brown fox jumps over the lazy dog, again!\n", i }' > "$DIR/plain.txt"
+tr ' ' X < "$DIR/plain.txt" > "$DIR/plain.x"
+
+run "--buffered" -i "$DIR/plain.txt" -k "$DIR/m3.key" -o "$DIR/ref.enc" --buffered
+run "--buffered -d" -i "$DIR/ref.enc" -k "$DIR/m3.key" -o "$DIR/ref.dec" -d --buffered
+same "$DIR/ref.dec" "$DIR/plain.x" "--buffered round trip"
+! cmp -s "$DIR/ref.enc" "$DIR/plain.txt"
+expect $? "--buffered enciphers"
+
+# Chunk-parallel: the chunks seek their rotors independently
+for j in 2 3 8; do
+    run "--buffered -j $j" -i "$DIR/plain.txt" -k "$DIR/m3.key" -o "$DIR/par.enc" --buffered -j $j
+    same "$DIR/par.enc" "$DIR/ref.enc" "--buffered -j $j output"
+done
+
+# Streaming, the default, from files and through stdin and stdout
+run "--stream" -i "$DIR/plain.txt" -k "$DIR/m3.key" -o "$DIR/stream.enc" --stream
+same "$DIR/stream.enc" "$DIR/ref.enc" "--stream output"
+run "default mode" -i "$DIR/plain.txt" -k "$DIR/m3.key" -o "$DIR/default.enc"
+same "$DIR/default.enc" "$DIR/ref.enc" "default mode output"
+"$BIN" -i - -o - -k "$DIR/m3.key" < "$DIR/plain.txt" > "$DIR/pipe.enc" 2> /dev/null
+expect $? "stdin to stdout"
+same "$DIR/pipe.enc" "$DIR/ref.enc" "stdin to stdout output"
+cat "$DIR/ref.enc" | "$BIN" -i - -o "$DIR/pipe.dec" -k "$DIR/m3.key" -d > /dev/null 2>&1
+expect $? "pipe to file -d"
+same "$DIR/pipe.dec" "$DIR/plain.x" "pipe to file -d output"
+
+# Zero-copy mmap, in place when the output is the input, and to a device
+run "--mmap" -i "$DIR/plain.txt" -k "$DIR/m3.key" -o "$DIR/mmap.enc" --mmap
+same "$DIR/mmap.enc" "$DIR/ref.enc" "--mmap output"
+run "--mmap -j 4" -i "$DIR/plain.txt" -k "$DIR/m3.key" -o "$DIR/mmap.enc" --mmap -j 4
+same "$DIR/mmap.enc" "$DIR/ref.enc" "--mmap -j 4 output"
+cp "$DIR/plain.txt" "$DIR/inplace.txt"
+run "--mmap in place" -i "$DIR/inplace.txt" -k "$DIR/m3.key" -o "$DIR/inplace.txt" --mmap
+same "$DIR/inplace.txt" "$DIR/ref.enc" "--mmap in place output"
+run "--mmap to a device" -i "$DIR/plain.txt" -k "$DIR/m3.key" -o /dev/null --mmap
+
+# A batch manifest: jobs in parallel, with the key file parsed once
+cat > "$DIR/jobs.manifest" <<EOF
+$DIR/plain.txt $DIR/m3.key $DIR/batch1.enc encrypt
+$DIR/ref.enc $DIR/m3.key $DIR/batch.dec decrypt
+$DIR/plain.txt $DIR/m3.key $DIR/batch2.enc
+EOF
+run "--batch" --batch "$DIR/jobs.manifest" -j 2
+same "$DIR/batch1.enc" "$DIR/ref.enc" "--batch encrypt job"
+same "$DIR/batch.dec" "$DIR/plain.x" "--batch decrypt job"
+same "$DIR/batch2.enc" "$DIR/ref.enc" "--batch job without a direction"
+
+# A compiled key enciphers as the key file it was compiled from
+run "--compile-key" --compile-key "$DIR/m3.key" "$DIR/m3.keyc"
+run "compiled key" -i "$DIR/plain.txt" -k "$DIR/m3.keyc" -o "$DIR/keyc.enc"
+same "$DIR/keyc.enc" "$DIR/ref.enc" "compiled key output"
+
+# The stream pipeline with -j, and in place when the output is the input. Built with
+# make IO_URING=1, these go through io_uring.
+run "--stream -j 4" -i "$DIR/plain.txt" -k "$DIR/m3.key" -o "$DIR/stream.enc" --stream -j 4
+same "$DIR/stream.enc" "$DIR/ref.enc" "--stream -j 4 output"
+cat "$DIR/plain.txt" | "$BIN" -i - -o - -k "$DIR/m3.key" -j 4 > "$DIR/pipe.enc" 2> /dev/null
+expect $? "pipe -j 4"
+same "$DIR/pipe.enc" "$DIR/ref.enc" "pipe -j 4 output"
+cp "$DIR/plain.txt" "$DIR/inplace.txt"
+run "--stream in place" -i "$DIR/inplace.txt" -k "$DIR/m3.key" -o "$DIR/inplace.txt"
+same "$DIR/inplace.txt" "$DIR/ref.enc" "--stream in place output"
+
+# --stats leaves the output alone and counts every byte of it, across threads
+letters=$(($(tr -cd 'A-Za-z' < "$DIR/plain.txt" | wc -c)))
+spaces=$(($(tr -cd ' ' < "$DIR/plain.txt" | wc -c)))
+bytes=$(($(wc -c < "$DIR/plain.txt")))
+others=$((bytes - letters - spaces))
+for mode in --buffered --stream --mmap; do
+    "$BIN" -i "$DIR/plain.txt" -k "$DIR/m3.key" -o "$DIR/stats.enc" $mode -j 4 --stats=json > /dev/null 2> "$DIR/stats.json"
+    expect $? "--stats $mode"
+    same "$DIR/stats.enc" "$DIR/ref.enc" "--stats $mode output"
+    grep -q "\"bytes_read\": $bytes, \"bytes_written\": $bytes, \"letters\": $letters, \"spaces\": $spaces, \"passthrough\": $others}" "$DIR/stats.json"
+    expect $? "--stats $mode counts"
+done
+
+# An indexed container deciphers whole, on several threads, and in slices
+run "--indexed" -i "$DIR/plain.txt" -k "$DIR/m3.key" -o "$DIR/plain.idx" --indexed --block-size 65536 -j 4
+run "-d --indexed" -i "$DIR/plain.idx" -k "$DIR/m3.key" -o "$DIR/idx.dec" -d --indexed -j 4
+same "$DIR/idx.dec" "$DIR/plain.x" "-d --indexed output"
+run "-d --range" -i "$DIR/plain.idx" -k "$DIR/m3.key" -o "$DIR/range.dec" -d --range 100000:1500001
+tail -c +100001 "$DIR/plain.x" | head -c 1400001 > "$DIR/range.x"
+same "$DIR/range.dec" "$DIR/range.x" "-d --range output"
+
+# --crack on a short English message under a 2 rotor key with two plug pairs: the key
+# it recovers must decipher the message, though its rings need not be the same
+cat > "$DIR/english.txt" <<EOF
+The weather in the north sea will be rough tonight with strong winds from the west.
+All ships of the second flotilla are to return to port before midnight and report
+their position to the harbour master. The convoy that was expected at dawn has been
+delayed by the storm and will now arrive in the evening of the following day. Keep
+watch for enemy aircraft over the coast and send any sighting to headquarters at once.
+EOF
+tr ' ' X < "$DIR/english.txt" > "$DIR/english.x"
+cat > "$DIR/k2.key" <<EOF
+reflector=1
+rotors=2,5
+rings=D,K
+plugboard=AQ,EZ
+EOF
+run "english" -i "$DIR/english.txt" -k "$DIR/k2.key" -o "$DIR/english.enc"
+run "--crack" -i "$DIR/english.enc" --crack --crack-rotors 2 -o "$DIR/cracked.key"
+run "cracked key" -i "$DIR/english.enc" -k "$DIR/cracked.key" -o "$DIR/cracked.dec" -d
+same "$DIR/cracked.dec" "$DIR/english.x" "--crack recovers the key"
+
+# --crib with the opening words of the same message: the best stop is a key that
+# deciphers it. Anywhere near the start, every stop is tested or ruled out: two
+# reflectors, 8 * 7 rotor orders and 26 settings of the second rotor per offset.
+run "--crib" -i "$DIR/english.enc" --crib "The weather in the north sea" --crib-at 0 --crack-rotors 2 -o "$DIR/stops"
+awk '/^# Stop 2:/ { exit } { print }' "$DIR/stops" > "$DIR/stop.key"
+run "best stop" -i "$DIR/english.enc" -k "$DIR/stop.key" -o "$DIR/stop.dec" -d
+same "$DIR/stop.dec" "$DIR/english.x" "--crib finds the key"
+"$BIN" -i "$DIR/english.enc" --crib "The weather" --crack-rotors 2 -o "$DIR/stops" 2> "$DIR/crib.log" > /dev/null
+expect $? "--crib anywhere"
+set -- $(sed -n 's/^Crib search: \([0-9]*\) stops at \([0-9]*\) crib offsets (\([0-9]*\) more ruled out).*/\1 \2 \3/p' "$DIR/crib.log")
+[ $# -eq 3 ] && [ $(($1 + $3)) -eq $(($2 * 2 * 56 * 26)) ] && [ "$3" -gt 0 ]
+expect $? "--crib stops tested and ruled out"
+
+# The same --crack in shards sharing a work directory, one of them run twice (it
+# resumes from its checkpoint), then merged: the same key as in one run
+mkdir -p "$DIR/work"
+for shard in 0/3 1/3 2/3 1/3; do
+    run "--shard $shard" -i "$DIR/english.enc" --crack --crack-rotors 2 --shard $shard --work-dir "$DIR/work"
+done
+run "--merge" -i "$DIR/english.enc" --crack --crack-rotors 2 --merge 3 --work-dir "$DIR/work" -o "$DIR/merged.key"
+same "$DIR/merged.key" "$DIR/cracked.key" "--merge finds the key of one run"
+
+echo "$checks checks, $failures failed"
+[ "$failures" -eq 0 ] && rm -rf "$DIR"
+[ "$failures" -eq 0 ]